@@ -0,0 +1,182 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Validation of the device-independent size estimator of ASSizeEstimator.h
+against the hierarchies actually produced by the CPU builder. For increasing
+triangle counts, a random triangle soup and a regular grid are built with the
+binned SAH builder, with the SAH builder limited to one triangle per leaf (the
+worst case of the estimate), and with the linear BVH builder. Each row gives
+the estimated result size, the worst-case and compacted sizes of the CPU
+hierarchy image, and the ratio between the estimate and the compacted size.
+
+The validation fails if an estimate is smaller than the worst-case size of the
+corresponding CPU hierarchy, which would make it unsafe for budgeting.
+
+The validation is built by the ASSizeEstimatorValidation project of the
+solution. It does not need a GPU, but includes d3d12.h for the build flags.
+
+Usage: ASSizeEstimatorValidation [maxTriangleCount]
+
+*/
+
+#include "ASSizeEstimator.h"
+#include "BVHImage.h"
+#include "BenchmarkHelpers.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace nv_helpers_dx12;
+
+namespace
+{
+// Triangles with random vertices within the unit cube
+std::vector<BVHTriangle> CreateSoup(uint32_t triangleCount)
+{
+  benchmarks::Random uniform(3);
+  std::vector<BVHTriangle> triangles(triangleCount);
+  for (uint32_t i = 0; i < triangleCount; i++)
+  {
+    BVHTriangle& tri = triangles[i];
+    float center[3] = {uniform(), uniform(), uniform()};
+    for (int k = 0; k < 3; k++)
+    {
+      tri.v0[k] = center[k] + 0.01f * uniform();
+      tri.v1[k] = center[k] + 0.01f * uniform();
+      tri.v2[k] = center[k] + 0.01f * uniform();
+    }
+    tri.geometryIndex = 0;
+    tri.primitiveIndex = i;
+  }
+  return triangles;
+}
+
+// Regular grid of about triangleCount triangles in the y=0 plane
+std::vector<BVHTriangle> CreateGrid(uint32_t triangleCount)
+{
+  uint32_t side = 1;
+  while (2 * (side + 1) * (side + 1) <= triangleCount)
+  {
+    side++;
+  }
+  std::vector<BVHTriangle> triangles;
+  for (uint32_t i = 0; i < side; i++)
+  {
+    for (uint32_t j = 0; j < side; j++)
+    {
+      auto x = static_cast<float>(i);
+      auto z = static_cast<float>(j);
+      BVHTriangle a = {{x, 0.f, z}, {x + 1.f, 0.f, z}, {x, 0.f, z + 1.f}, 0, 0};
+      BVHTriangle b = {{x + 1.f, 0.f, z}, {x + 1.f, 0.f, z + 1.f}, {x, 0.f, z + 1.f}, 0, 0};
+      a.primitiveIndex = static_cast<uint32_t>(triangles.size());
+      triangles.push_back(a);
+      b.primitiveIndex = static_cast<uint32_t>(triangles.size());
+      triangles.push_back(b);
+    }
+  }
+  return triangles;
+}
+
+// Build the hierarchy, store its image, and compare its sizes with the estimate. Returns false if
+// the estimate is too small.
+bool Validate(const char* sceneName, const char* builderName,
+              const std::vector<BVHTriangle>& triangles, const BVHBuilder& builder, bool linear)
+{
+  BVH bvh;
+  if (linear)
+  {
+    builder.BuildLBVH(triangles, &bvh);
+  }
+  else
+  {
+    builder.BuildSAH(triangles, &bvh);
+  }
+
+  auto triangleCount = static_cast<uint32_t>(triangles.size());
+  uint64_t maxSize = GetBVHImageMaxSize(triangleCount);
+  std::vector<uint8_t> image(maxSize);
+  StoreBVHImage(bvh, image.data(), maxSize);
+  uint64_t compactedSize = GetBVHImageCompactedSize(image.data());
+
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags =
+      linear ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD
+             : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info =
+      EstimateBottomLevelASPrebuildInfo(triangleCount, 1, flags);
+
+  bool valid = info.ResultDataMaxSizeInBytes >= maxSize;
+  printf("%-6s %-10s %-9u %-12llu %-12llu %-12llu %-6.2f %s\n", sceneName, builderName,
+         triangleCount, static_cast<unsigned long long>(info.ResultDataMaxSizeInBytes),
+         static_cast<unsigned long long>(maxSize), static_cast<unsigned long long>(compactedSize),
+         static_cast<double>(info.ResultDataMaxSizeInBytes) / static_cast<double>(compactedSize),
+         valid ? "ok" : "UNDERESTIMATED");
+  return valid;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  uint32_t maxTriangleCount = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 1000000;
+  if (maxTriangleCount == 0)
+  {
+    printf("Usage: ASSizeEstimatorValidation [maxTriangleCount]\n");
+    return 1;
+  }
+
+  BVHBuilder sahBuilder;
+  BVHBuilder singleLeafBuilder;
+  singleLeafBuilder.SetMaxLeafSize(1);
+
+  printf("scene  builder    triangles estimate     CPU max      CPU compact  ratio\n");
+  bool valid = true;
+  for (uint32_t triangleCount = 1; triangleCount <= maxTriangleCount; triangleCount *= 10)
+  {
+    const std::vector<BVHTriangle> scenes[] = {CreateSoup(triangleCount),
+                                               CreateGrid(triangleCount)};
+    const char* sceneNames[] = {"soup", "grid"};
+    for (int s = 0; s < 2; s++)
+    {
+      valid &= Validate(sceneNames[s], "SAH", scenes[s], sahBuilder, false);
+      valid &= Validate(sceneNames[s], "SAH leaf 1", scenes[s], singleLeafBuilder, false);
+      valid &= Validate(sceneNames[s], "LBVH", scenes[s], sahBuilder, true);
+    }
+  }
+
+  // The top-level estimate only depends on the instance count
+  for (uint64_t instanceCount = 1; instanceCount <= 10000000; instanceCount *= 100)
+  {
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info = EstimateTopLevelASPrebuildInfo(
+        instanceCount, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE);
+    printf("TLAS   %-10llu instances: result %llu bytes, scratch %llu bytes\n",
+           static_cast<unsigned long long>(instanceCount),
+           static_cast<unsigned long long>(info.ResultDataMaxSizeInBytes),
+           static_cast<unsigned long long>(info.ScratchDataSizeInBytes));
+  }
+
+  printf(valid ? "\nAll estimates bound the CPU hierarchies\n"
+               : "\nError: some estimates are smaller than the CPU hierarchies\n");
+  return valid ? 0 : 1;
+}
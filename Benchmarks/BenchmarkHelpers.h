@@ -0,0 +1,139 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Helpers shared by the benchmark and validation programs, which run the helpers
+of nv_helpers_dx12 without a GPU:
+- a deterministic generator of random floats, so that the scenes are the same
+  from one run to the next
+- a buffer in host memory standing for an upload heap resource, which only
+  supports Map and GetGPUVirtualAddress
+
+Example:
+
+benchmarks::Random uniform(5);
+float x = uniform() * extent;
+
+benchmarks::HostBuffer descriptors(descriptorsSize, 0x200000);
+generator.UpdateInstanceDescriptors(&descriptors);
+
+*/
+
+#pragma once
+
+#include "d3d12.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace benchmarks
+{
+
+/// Linear congruential generator of floats in [0, 1). <random> is avoided since
+/// d3d12.h may define the min and max macros.
+class Random
+{
+public:
+  explicit Random(uint32_t seed) : m_state(seed) {}
+
+  float operator()()
+  {
+    m_state = m_state * 1664525u + 1013904223u;
+    return static_cast<float>(m_state >> 8) / 16777216.f;
+  }
+
+private:
+  uint32_t m_state;
+};
+
+/// Buffer in host memory standing for a buffer in the upload heap. The storage
+/// comes from the default allocator, whose 16-byte alignment is enough for the
+/// instance descriptors and the shader binding table.
+class HostBuffer : public ID3D12Resource
+{
+public:
+  HostBuffer(UINT64 sizeInBytes, D3D12_GPU_VIRTUAL_ADDRESS address)
+      : m_data(static_cast<size_t>(sizeInBytes)), m_address(address)
+  {
+  }
+
+  const uint8_t* GetData() const { return m_data.data(); }
+
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void** object) override
+  {
+    *object = nullptr;
+    return E_NOINTERFACE;
+  }
+  ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+  ULONG STDMETHODCALLTYPE Release() override { return 1; }
+  HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID, UINT*, void*) override { return E_NOTIMPL; }
+  HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, UINT, const void*) override
+  {
+    return E_NOTIMPL;
+  }
+  HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID, const IUnknown*) override
+  {
+    return E_NOTIMPL;
+  }
+  HRESULT STDMETHODCALLTYPE SetName(LPCWSTR) override { return S_OK; }
+  HRESULT STDMETHODCALLTYPE GetDevice(REFIID, void** device) override
+  {
+    *device = nullptr;
+    return E_NOTIMPL;
+  }
+  HRESULT STDMETHODCALLTYPE Map(UINT, const D3D12_RANGE*, void** data) override
+  {
+    *data = m_data.data();
+    return S_OK;
+  }
+  void STDMETHODCALLTYPE Unmap(UINT, const D3D12_RANGE*) override {}
+  D3D12_RESOURCE_DESC STDMETHODCALLTYPE GetDesc() override
+  {
+    D3D12_RESOURCE_DESC desc = {};
+    desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+    desc.Width = m_data.size();
+    return desc;
+  }
+  D3D12_GPU_VIRTUAL_ADDRESS STDMETHODCALLTYPE GetGPUVirtualAddress() override { return m_address; }
+  HRESULT STDMETHODCALLTYPE WriteToSubresource(UINT, const D3D12_BOX*, const void*, UINT,
+                                               UINT) override
+  {
+    return E_NOTIMPL;
+  }
+  HRESULT STDMETHODCALLTYPE ReadFromSubresource(void*, UINT, UINT, UINT,
+                                                const D3D12_BOX*) override
+  {
+    return E_NOTIMPL;
+  }
+  HRESULT STDMETHODCALLTYPE GetHeapProperties(D3D12_HEAP_PROPERTIES*, D3D12_HEAP_FLAGS*) override
+  {
+    return E_NOTIMPL;
+  }
+
+private:
+  std::vector<uint8_t> m_data;
+  D3D12_GPU_VIRTUAL_ADDRESS m_address;
+};
+} // namespace benchmarks
@@ -0,0 +1,207 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Benchmark comparing the binned SAH builder with the spatial split builder
+(SBVH) on a procedural architectural scene: floor slabs made of large triangles,
+crossed by a lattice of long thin diagonal braces. The braces are the only
+geometry allowed to be split, as would be selected per geometry in
+BottomLevelASGenerator::AddVertexBuffer.
+
+The traversal work is measured in ray/box and ray/triangle tests per ray, which
+does not depend on the machine running the benchmark. Each SBVH row also gives
+the reduction of ray/box tests relative to the SAH hierarchy.
+
+The benchmark is built by the SBVHBenchmark project of the solution. It only
+depends on the CPU builder, and can also be compiled on its own:
+
+cl /O2 /EHsc /I..\nv_helpers_dx12 SBVHBenchmark.cpp ..\nv_helpers_dx12\BVHBuilder.cpp
+g++ -O2 -pthread -I../nv_helpers_dx12 SBVHBenchmark.cpp ../nv_helpers_dx12/BVHBuilder.cpp
+
+Usage: SBVHBenchmark [rayCount] [latticeSize]
+
+*/
+
+#include "BVHBuilder.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace nv_helpers_dx12;
+
+namespace
+{
+// Geometry indices of the scene
+const uint32_t kBraceGeometry = 0;
+const uint32_t kSlabGeometry = 1;
+
+void AddTriangle(std::vector<BVHTriangle>& triangles, uint32_t geometryIndex, const float v0[3],
+                 const float v1[3], const float v2[3])
+{
+  BVHTriangle tri;
+  for (int k = 0; k < 3; k++)
+  {
+    tri.v0[k] = v0[k];
+    tri.v1[k] = v1[k];
+    tri.v2[k] = v2[k];
+  }
+  tri.geometryIndex = geometryIndex;
+  tri.primitiveIndex = static_cast<uint32_t>(triangles.size());
+  triangles.push_back(tri);
+}
+
+// Build a scene of latticeSize x latticeSize cells, each the origin of two thin
+// braces spanning about twenty cells and all the floors, covered by floor slabs
+std::vector<BVHTriangle> CreateScene(uint32_t latticeSize)
+{
+  const float kBraceWidth = 0.02f;
+  const float kHeight = 8.f;
+  const int kFloorCount = 4;
+  std::vector<BVHTriangle> triangles;
+
+  for (uint32_t i = 0; i < latticeSize; i++)
+  {
+    for (uint32_t j = 0; j < latticeSize; j++)
+    {
+      auto x = static_cast<float>(i);
+      auto z = static_cast<float>(j);
+      float a0[3] = {x, 0.f, z};
+      float a1[3] = {x + 20.f, kHeight, z + 15.f};
+      float a2[3] = {x + kBraceWidth, 0.f, z + kBraceWidth};
+      AddTriangle(triangles, kBraceGeometry, a0, a1, a2);
+      float b0[3] = {x + 3.f, 0.f, z};
+      float b1[3] = {x - 15.f, kHeight, z + 20.f};
+      float b2[3] = {x + 3.f + kBraceWidth, 0.f, z};
+      AddTriangle(triangles, kBraceGeometry, b0, b1, b2);
+    }
+  }
+
+  for (int floor = 0; floor < kFloorCount; floor++)
+  {
+    float y = kHeight * static_cast<float>(floor) / static_cast<float>(kFloorCount);
+    for (uint32_t i = 0; i < latticeSize / 2; i++)
+    {
+      for (uint32_t j = 0; j < latticeSize / 2; j++)
+      {
+        float x = 2.f * static_cast<float>(i);
+        float z = 2.f * static_cast<float>(j);
+        float c00[3] = {x, y, z};
+        float c10[3] = {x + 2.f, y, z};
+        float c01[3] = {x, y, z + 2.f};
+        float c11[3] = {x + 2.f, y, z + 2.f};
+        AddTriangle(triangles, kSlabGeometry, c00, c10, c01);
+        AddTriangle(triangles, kSlabGeometry, c10, c11, c01);
+      }
+    }
+  }
+  return triangles;
+}
+
+// Rays starting within the scene, in uniformly distributed directions
+std::vector<BVHRay> CreateRays(uint32_t rayCount, uint32_t latticeSize)
+{
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  std::vector<BVHRay> rays(rayCount);
+  for (auto& ray : rays)
+  {
+    ray.origin[0] = uniform(rng) * static_cast<float>(latticeSize);
+    ray.origin[1] = uniform(rng) * 8.f;
+    ray.origin[2] = uniform(rng) * static_cast<float>(latticeSize);
+    float cosTheta = 2.f * uniform(rng) - 1.f;
+    float sinTheta = std::sqrt(1.f - cosTheta * cosTheta);
+    float phi = 6.2831853f * uniform(rng);
+    ray.direction[0] = sinTheta * std::cos(phi);
+    ray.direction[1] = cosTheta;
+    ray.direction[2] = sinTheta * std::sin(phi);
+    ray.tMin = 0.f;
+    ray.tMax = 1e30f;
+  }
+  return rays;
+}
+
+// Trace all the rays, returning the traversal statistics and the number of hits
+BVHTraversalStats Trace(const BVH& bvh, const std::vector<BVHRay>& rays, uint32_t* hitCount)
+{
+  BVHTraversalStats stats;
+  *hitCount = 0;
+  for (const auto& ray : rays)
+  {
+    BVHHit hit;
+    *hitCount += bvh.Intersect(ray, &hit, &stats) ? 1 : 0;
+  }
+  return stats;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  uint32_t rayCount = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 100000;
+  uint32_t latticeSize = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 60;
+  if (rayCount == 0 || latticeSize < 2)
+  {
+    printf("Usage: SBVHBenchmark [rayCount] [latticeSize]\n");
+    return 1;
+  }
+
+  std::vector<BVHTriangle> triangles = CreateScene(latticeSize);
+  std::vector<BVHRay> rays = CreateRays(rayCount, latticeSize);
+  std::vector<bool> splittableGeometries = {true, false};
+  printf("%zu triangles, %u rays\n\n", triangles.size(), rayCount);
+  printf("builder  budget  refs      build ms  SAH cost  box/ray  tri/ray  box tests saved\n");
+
+  BVHBuilder builder;
+  BVH bvh;
+  builder.BuildSAH(triangles, &bvh);
+  uint32_t hitCount = 0;
+  BVHTraversalStats reference = Trace(bvh, rays, &hitCount);
+  uint32_t referenceHitCount = hitCount;
+  printf("SAH      -       %-9zu %-9.1f %-9.1f %-8.1f %-8.1f -\n", bvh.primIndices.size(),
+         bvh.stats.buildTimeMs, bvh.stats.sahCost,
+         static_cast<double>(reference.boxTests) / rayCount,
+         static_cast<double>(reference.triangleTests) / rayCount);
+
+  const float kBudgets[] = {0.1f, 0.25f, 0.5f, 1.f};
+  for (float budget : kBudgets)
+  {
+    builder.SetSpatialSplitBudget(budget);
+    builder.BuildSBVH(triangles, &bvh, splittableGeometries);
+    BVHTraversalStats stats = Trace(bvh, rays, &hitCount);
+    double saved = 100.0 * (1.0 - static_cast<double>(stats.boxTests) /
+                                      static_cast<double>(reference.boxTests));
+    printf("SBVH     %-7.2f %-9zu %-9.1f %-9.1f %-8.1f %-8.1f %.1f%%\n", budget,
+           bvh.primIndices.size(), bvh.stats.buildTimeMs, bvh.stats.sahCost,
+           static_cast<double>(stats.boxTests) / rayCount,
+           static_cast<double>(stats.triangleTests) / rayCount, saved);
+    if (hitCount != referenceHitCount)
+    {
+      printf("Error: %u hits instead of %u\n", hitCount, referenceHitCount);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,205 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Validation of the shader identifier cache of ShaderIdentifierCache.h, as used by
+ShaderBindingTableGenerator. The raytracing pipeline is replaced by a fake
+ID3D12StateObjectProperties which returns a distinct identifier for each known
+export and counts the calls to GetShaderIdentifier, and the SBT is written into
+a fake buffer in host memory. The validation checks that:
+- many SBT records sharing an export cause a single lookup of its identifier
+- generating the SBT again with the same pipeline does not look anything up
+- identifiers resolved right after the pipeline creation are not looked up again
+- changing the pipeline resolves the identifiers again, from the new pipeline
+- an export unknown to the pipeline throws
+
+No GPU is needed, and the validation does not call D3D12. It is built by the
+ShaderIdentifierCacheValidation project of the solution, and on Linux against
+the DirectX-Headers package, which provides d3d12.h:
+
+g++ -O2 -I../nv_helpers_dx12 -I<DirectX-Headers>/include/directx
+    -I<DirectX-Headers>/include/wsl/stubs ShaderIdentifierCacheValidation.cpp
+    ../nv_helpers_dx12/ShaderIdentifierCache.cpp
+    ../nv_helpers_dx12/ShaderBindingTableGenerator.cpp
+
+Usage: ShaderIdentifierCacheValidation [recordCount]
+
+*/
+
+#include "BenchmarkHelpers.h"
+#include "ShaderBindingTableGenerator.h"
+#include "ShaderIdentifierCache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace nv_helpers_dx12;
+
+namespace
+{
+// Pipeline properties returning an identifier for each of a fixed set of exports, filled with a
+// byte specific to the export and to the pipeline, and counting the lookups
+class FakeStateObjectProperties : public ID3D12StateObjectProperties
+{
+public:
+  FakeStateObjectProperties(const std::vector<std::wstring>& exportNames, uint8_t pipelineTag)
+      : m_exportNames(exportNames), m_identifiers(exportNames.size() * kIdentifierSize)
+  {
+    for (size_t i = 0; i < exportNames.size(); i++)
+    {
+      memset(&m_identifiers[i * kIdentifierSize], GetIdentifierByte(pipelineTag, i),
+             kIdentifierSize);
+    }
+  }
+
+  /// Byte filling the identifier of an export
+  static uint8_t GetIdentifierByte(uint8_t pipelineTag, size_t exportIndex)
+  {
+    return static_cast<uint8_t>(pipelineTag + exportIndex + 1);
+  }
+
+  UINT GetLookupCount() const { return m_lookupCount; }
+
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void** object) override
+  {
+    *object = nullptr;
+    return E_NOINTERFACE;
+  }
+  ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+  ULONG STDMETHODCALLTYPE Release() override { return 1; }
+  void* STDMETHODCALLTYPE GetShaderIdentifier(LPCWSTR exportName) override
+  {
+    m_lookupCount++;
+    for (size_t i = 0; i < m_exportNames.size(); i++)
+    {
+      if (m_exportNames[i] == exportName)
+      {
+        return &m_identifiers[i * kIdentifierSize];
+      }
+    }
+    return nullptr;
+  }
+  UINT64 STDMETHODCALLTYPE GetShaderStackSize(LPCWSTR) override { return 0; }
+  UINT64 STDMETHODCALLTYPE GetPipelineStackSize() override { return 0; }
+  void STDMETHODCALLTYPE SetPipelineStackSize(UINT64) override {}
+
+private:
+  static const UINT kIdentifierSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
+
+  std::vector<std::wstring> m_exportNames;
+  std::vector<uint8_t> m_identifiers;
+  UINT m_lookupCount = 0;
+};
+
+// Print the outcome of a check, returning it
+bool Check(bool condition, const char* description)
+{
+  printf("%s  %s\n", condition ? "ok    " : "FAILED", description);
+  return condition;
+}
+
+// Whether the hit group records of the SBT start with the identifier of the given export
+bool CheckHitGroupIdentifiers(ShaderBindingTableGenerator& sbt, const benchmarks::HostBuffer& buffer,
+                              uint8_t identifierByte)
+{
+  const uint8_t* hitGroups =
+      buffer.GetData() + sbt.GetRayGenSectionSize() + sbt.GetMissSectionSize();
+  UINT recordCount = sbt.GetHitGroupSectionSize() / sbt.GetHitGroupEntrySize();
+  for (UINT i = 0; i < recordCount; i++)
+  {
+    const uint8_t* record = hitGroups + static_cast<size_t>(i) * sbt.GetHitGroupEntrySize();
+    for (UINT b = 0; b < D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES; b++)
+    {
+      if (record[b] != identifierByte)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  UINT recordCount = argc > 1 ? static_cast<UINT>(atoi(argv[1])) : 10000;
+  const std::vector<std::wstring> exportNames = {L"RayGen", L"Miss", L"HitGroup"};
+  FakeStateObjectProperties pipeline(exportNames, 0x10);
+  FakeStateObjectProperties rebuiltPipeline(exportNames, 0x20);
+  bool valid = true;
+
+  // One ray generation program, one miss program, and many records of the same hit group
+  ShaderBindingTableGenerator sbt;
+  sbt.AddRayGenerationProgram(L"RayGen", {});
+  sbt.AddMissProgram(L"Miss", {});
+  for (UINT i = 0; i < recordCount; i++)
+  {
+    sbt.AddHitGroup(L"HitGroup", {reinterpret_cast<void*>(static_cast<uintptr_t>(i))});
+  }
+  ShaderIdentifierCache& cache = sbt.GetShaderIdentifierCache();
+  printf("%u hit group records sharing one export\n", recordCount);
+  valid &= Check(cache.GetExportCount() == 3, "each export name is interned once");
+
+  benchmarks::HostBuffer buffer(sbt.ComputeSBTSize(), 0x100000);
+  sbt.Generate(&buffer, &pipeline);
+  valid &= Check(pipeline.GetLookupCount() == 3 && cache.GetLookupCount() == 3,
+                 "the first SBT build looks each export up once");
+  valid &= Check(CheckHitGroupIdentifiers(sbt, buffer,
+                                          FakeStateObjectProperties::GetIdentifierByte(0x10, 2)),
+                 "all the hit group records hold the identifier of their export");
+
+  sbt.Generate(&buffer, &pipeline);
+  valid &= Check(pipeline.GetLookupCount() == 3,
+                 "building the SBT again with the same pipeline looks nothing up");
+
+  // A new pipeline resolved upfront, as done right after its creation
+  cache.SetPipeline(&rebuiltPipeline);
+  cache.Resolve(exportNames);
+  valid &= Check(rebuiltPipeline.GetLookupCount() == 3 && cache.GetLookupCount() == 6,
+                 "changing the pipeline resolves the identifiers again");
+  sbt.Generate(&buffer, &rebuiltPipeline);
+  valid &= Check(rebuiltPipeline.GetLookupCount() == 3,
+                 "identifiers resolved upfront are not looked up by the SBT build");
+  valid &= Check(CheckHitGroupIdentifiers(sbt, buffer,
+                                          FakeStateObjectProperties::GetIdentifierByte(0x20, 2)),
+                 "the records hold the identifiers of the new pipeline");
+
+  bool thrown = false;
+  try
+  {
+    cache.Resolve({L"UnknownExport"});
+  }
+  catch (const std::logic_error&)
+  {
+    thrown = true;
+  }
+  valid &= Check(thrown, "an export unknown to the pipeline throws");
+
+  printf(valid ? "\nThe shader identifier cache behaves as expected\n"
+               : "\nError: some checks of the shader identifier cache failed\n");
+  return valid ? 0 : 1;
+}
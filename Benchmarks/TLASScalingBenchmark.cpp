@@ -0,0 +1,289 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Scaling benchmark of TopLevelASGenerator, from a thousand to millions of
+instances of a single bottom-level AS. For each instance count, it gives the
+time per instance of:
+- AddInstance, including the construction of the transform matrix
+- ComputeASBufferSizes without a device, using the size estimator
+- the packing of all the instance descriptors by UpdateInstanceDescriptors, on
+  the calling thread and on a thread pool
+- the CPU build of the top-level hierarchy by GenerateOnCPU, up to a separate
+  instance count as the CPU hierarchy takes about 200 bytes per instance
+
+No GPU is needed: the descriptor buffer is a mock resource in host memory, and
+the bottom-level AS is only referenced by its address. Rather than mocking a
+device, the sizes are computed with a null device, which makes
+ComputeASBufferSizes use the device-independent estimate of ASSizeEstimator.h.
+Small instance counts are measured several times, keeping the fastest run. The
+results are also written as JSON, for tracking them over time.
+
+The benchmark is built by the TLASScalingBenchmark project of the solution. It
+includes d3d12.h for the descriptor types, but does not call D3D12, and can also
+be compiled on its own:
+
+cl /O2 /EHsc /I..\nv_helpers_dx12 TLASScalingBenchmark.cpp
+   ..\nv_helpers_dx12\TopLevelASGenerator.cpp ..\nv_helpers_dx12\TopLevelBVH.cpp
+   ..\nv_helpers_dx12\BVHBuilder.cpp ..\nv_helpers_dx12\ASSizeEstimator.cpp
+   ..\nv_helpers_dx12\ThreadPool.cpp
+
+Usage: TLASScalingBenchmark [maxInstanceCount] [maxCPUBuildInstanceCount] [jsonFile]
+
+*/
+
+#include "BenchmarkHelpers.h"
+#include "TopLevelASGenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace nv_helpers_dx12;
+
+namespace
+{
+// Address of the bottom-level AS referenced by all the instances
+const D3D12_GPU_VIRTUAL_ADDRESS kBottomLevelASAddress = 0x100000;
+
+// Each measurement is repeated until this many instances were processed, for stable timings at
+// small instance counts
+const uint32_t kMinMeasuredInstanceCount = 1000000;
+
+// Time per instance of each measured operation, in nanoseconds. A negative time indicates the
+// operation was not measured.
+struct ScalingResult
+{
+  uint32_t instanceCount;
+  double addInstanceNs = -1.0;
+  double computeSizesNs = -1.0;
+  double packDescriptorsNs = -1.0;
+  double packDescriptorsParallelNs = -1.0;
+  double cpuBuildNs = -1.0;
+};
+
+class Timer
+{
+public:
+  Timer() : m_start(std::chrono::high_resolution_clock::now()) {}
+  // Elapsed time since construction divided by the instance count, in nanoseconds
+  double NsPer(uint32_t instanceCount) const
+  {
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::high_resolution_clock::now() - m_start;
+    return elapsed.count() / static_cast<double>(instanceCount);
+  }
+
+private:
+  std::chrono::high_resolution_clock::time_point m_start;
+};
+
+// Keep the fastest of the measurements
+void KeepMin(double* result, double measured)
+{
+  *result = *result < 0.0 ? measured : (std::min)(*result, measured);
+}
+
+// Bottom-level hierarchy of a unit cube, shared by all the instances
+void BuildCube(BVH* bvh)
+{
+  const float corners[8][3] = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0},
+                               {0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 1, 1}};
+  const int faces[12][3] = {{0, 2, 1}, {1, 2, 3}, {4, 5, 6}, {5, 7, 6}, {0, 1, 4}, {1, 5, 4},
+                            {2, 6, 3}, {3, 6, 7}, {0, 4, 2}, {2, 4, 6}, {1, 3, 5}, {3, 7, 5}};
+  std::vector<BVHTriangle> triangles(12);
+  for (uint32_t i = 0; i < 12; i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      triangles[i].v0[k] = corners[faces[i][0]][k];
+      triangles[i].v1[k] = corners[faces[i][1]][k];
+      triangles[i].v2[k] = corners[faces[i][2]][k];
+    }
+    triangles[i].geometryIndex = 0;
+    triangles[i].primitiveIndex = i;
+  }
+  BVHBuilder().BuildSAH(triangles, bvh);
+}
+
+// Random positions and rotations of the instances, spread with a constant density
+void CreatePlacements(uint32_t instanceCount, std::vector<DirectX::XMFLOAT4>* placements)
+{
+  benchmarks::Random uniform(5);
+  float extent = 4.f * std::cbrt(static_cast<float>(instanceCount));
+  placements->resize(instanceCount);
+  for (auto& placement : *placements)
+  {
+    placement.x = uniform() * extent;
+    placement.y = uniform() * extent;
+    placement.z = uniform() * extent;
+    placement.w = uniform() * DirectX::XM_2PI;
+  }
+}
+
+ScalingResult Measure(uint32_t instanceCount, uint32_t maxCPUBuildInstanceCount,
+                      ThreadPool* threadPool, const BVH& cube)
+{
+  ScalingResult result;
+  result.instanceCount = instanceCount;
+  std::vector<DirectX::XMFLOAT4> placements;
+  CreatePlacements(instanceCount, &placements);
+  std::unordered_map<D3D12_GPU_VIRTUAL_ADDRESS, const BVH*> hierarchies = {
+      {kBottomLevelASAddress, &cube}};
+
+  uint32_t runCount = (std::max)(1u, kMinMeasuredInstanceCount / instanceCount);
+  for (uint32_t run = 0; run < runCount; run++)
+  {
+    TopLevelASGenerator generator;
+    Timer addTimer;
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+      const DirectX::XMFLOAT4& p = placements[i];
+      DirectX::XMMATRIX transform =
+          DirectX::XMMatrixRotationY(p.w) * DirectX::XMMatrixTranslation(p.x, p.y, p.z);
+      generator.AddInstance(kBottomLevelASAddress, transform, i, 0);
+    }
+    KeepMin(&result.addInstanceNs, addTimer.NsPer(instanceCount));
+
+    UINT64 scratchSize, resultSize, descriptorsSize;
+    Timer sizeTimer;
+    generator.ComputeASBufferSizes(nullptr, false, &scratchSize, &resultSize, &descriptorsSize);
+    KeepMin(&result.computeSizesNs, sizeTimer.NsPer(instanceCount));
+
+    // The first write also touches the pages of the buffer for the first time, which is not
+    // representative of a buffer reused across frames
+    // Descriptors are mapped right after the bottom-level AS
+    benchmarks::HostBuffer descriptors(descriptorsSize, 0x200000);
+    generator.UpdateInstanceDescriptors(&descriptors);
+
+    // ComputeASBufferSizes expects new buffers, whose descriptors are then all written
+    generator.ComputeASBufferSizes(nullptr, false, &scratchSize, &resultSize, &descriptorsSize);
+    Timer packTimer;
+    generator.UpdateInstanceDescriptors(&descriptors);
+    KeepMin(&result.packDescriptorsNs, packTimer.NsPer(instanceCount));
+
+    generator.SetThreadPool(threadPool);
+    generator.ComputeASBufferSizes(nullptr, false, &scratchSize, &resultSize, &descriptorsSize);
+    Timer parallelPackTimer;
+    generator.UpdateInstanceDescriptors(&descriptors);
+    KeepMin(&result.packDescriptorsParallelNs, parallelPackTimer.NsPer(instanceCount));
+
+    if (instanceCount <= maxCPUBuildInstanceCount)
+    {
+      TopLevelBVH topLevelBvh;
+      Timer buildTimer;
+      generator.GenerateOnCPU(hierarchies, &topLevelBvh);
+      KeepMin(&result.cpuBuildNs, buildTimer.NsPer(instanceCount));
+    }
+  }
+  return result;
+}
+
+void PrintTime(FILE* file, const char* name, double ns, bool last)
+{
+  if (ns < 0.0)
+  {
+    fprintf(file, "\"%s\": null%s", name, last ? "" : ", ");
+  }
+  else
+  {
+    fprintf(file, "\"%s\": %.3f%s", name, ns, last ? "" : ", ");
+  }
+}
+
+bool WriteJson(const char* fileName, uint32_t threadCount,
+               const std::vector<ScalingResult>& results)
+{
+  FILE* file = fopen(fileName, "w");
+  if (!file)
+  {
+    return false;
+  }
+  fprintf(file, "{\n  \"benchmark\": \"TLASScaling\",\n  \"unit\": \"ns/instance\",\n");
+  fprintf(file, "  \"threadCount\": %u,\n  \"results\": [\n", threadCount);
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const ScalingResult& r = results[i];
+    fprintf(file, "    {\"instanceCount\": %u, ", r.instanceCount);
+    PrintTime(file, "addInstance", r.addInstanceNs, false);
+    PrintTime(file, "computeASBufferSizes", r.computeSizesNs, false);
+    PrintTime(file, "packDescriptors", r.packDescriptorsNs, false);
+    PrintTime(file, "packDescriptorsParallel", r.packDescriptorsParallelNs, false);
+    PrintTime(file, "cpuBuild", r.cpuBuildNs, true);
+    fprintf(file, "}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return true;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  uint32_t maxInstanceCount = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 10000000;
+  uint32_t maxCPUBuildInstanceCount =
+      argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 1000000;
+  const char* jsonFile = argc > 3 ? argv[3] : "TLASScalingBenchmark.json";
+  if (maxInstanceCount < 1000)
+  {
+    printf("Usage: TLASScalingBenchmark [maxInstanceCount] [maxCPUBuildInstanceCount] "
+           "[jsonFile]\n");
+    return 1;
+  }
+
+  BVH cube;
+  BuildCube(&cube);
+  ThreadPool threadPool;
+  printf("%u threads, times in ns/instance\n\n", threadPool.GetThreadCount());
+  printf("instances  AddInstance  sizes    pack     pack (pool)  CPU build\n");
+
+  std::vector<ScalingResult> results;
+  for (uint64_t count = 1000; count <= maxInstanceCount; count *= 10)
+  {
+    ScalingResult r = Measure(static_cast<uint32_t>(count), maxCPUBuildInstanceCount,
+                              &threadPool, cube);
+    printf("%-10u %-12.2f %-8.3f %-8.2f %-12.2f ", r.instanceCount, r.addInstanceNs,
+           r.computeSizesNs, r.packDescriptorsNs, r.packDescriptorsParallelNs);
+    if (r.cpuBuildNs < 0.0)
+    {
+      printf("-\n");
+    }
+    else
+    {
+      printf("%.1f\n", r.cpuBuildNs);
+    }
+    results.push_back(r);
+  }
+
+  if (!WriteJson(jsonFile, threadPool.GetThreadCount(), results))
+  {
+    printf("Error: cannot write %s\n", jsonFile);
+    return 1;
+  }
+  printf("\nResults written to %s\n", jsonFile);
+  return 0;
+}
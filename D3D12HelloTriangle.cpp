@@ -563,7 +563,9 @@ void D3D12HelloTriangle::OnKeyUp(UINT8 key) {
 
 D3D12HelloTriangle::AccelerationStructureBuffers
 D3D12HelloTriangle::CreateBottomLevelAS(
-    std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vVertexBuffers) {
+    std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vVertexBuffers,
+    D3D12_GPU_VIRTUAL_ADDRESS compactedSizeAddress,
+    nv_helpers_dx12::BottomLevelASContentKey *contentKey) {
   nv_helpers_dx12::BottomLevelASGenerator bottomLevelAS;
 
   // Adding all vertex buffers and not transforming their position.
@@ -573,6 +575,25 @@ D3D12HelloTriangle::CreateBottomLevelAS(
                                   sizeof(Vertex), 0, 0);
   }
 
+  // Geometry with the same content as an existing structure reuses it instead
+  // of being built again. Compaction does not change the traced structure, so
+  // compacted and non-compacted builds share the same key. A shared structure
+  // is returned without scratch buffer, and nothing is written at
+  // compactedSizeAddress.
+  // 既存の構造と同じ内容のジオメトリは、再構築せずにその構造を再利用します。
+  // 圧縮はトレースされる構造を変えないため、圧縮ありとなしのビルドは同じキーを共有します。
+  // 共有された構造はスクラッチ バッファなしで返され、compactedSizeAddress には何も書き込まれません。
+  nv_helpers_dx12::BottomLevelASContentKey key = bottomLevelAS.ComputeContentKey(
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE);
+  if (contentKey) {
+    *contentKey = key;
+  }
+  AccelerationStructureBuffers shared;
+  shared.pResult = m_bottomLevelASRegistry.Acquire(key);
+  if (shared.pResult) {
+    return shared;
+  }
+
   // The AS build requires some scratch space to store temporary information.
   // AS ビルドには、一時的な情報を保存するためのスクラッチ スペースが必要です。
   // The amount of scratch memory is dependent on the scene complexity.
@@ -584,8 +605,14 @@ D3D12HelloTriangle::CreateBottomLevelAS(
   // サイズもシーンの複雑さに依存します。
   UINT64 resultSizeInBytes = 0;
 
-  bottomLevelAS.ComputeASBufferSizes(m_device.Get(), false, &scratchSizeInBytes,
-                                     &resultSizeInBytes);
+  // Compaction is allowed when the caller wants to know the compacted size, so
+  // that the structure can be copied into a tightly sized buffer afterwards
+  // 呼び出し元が圧縮後のサイズを必要とする場合は圧縮を許可し、
+  // 後で構造をぴったりのサイズのバッファにコピーできるようにします
+  bottomLevelAS.ComputeASBufferSizes(
+      m_device.Get(), false, &scratchSizeInBytes, &resultSizeInBytes,
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE,
+      compactedSizeAddress != 0);
 
   // Once the sizes are obtained, the application is responsible for allocatingthe necessary buffers. 
   // サイズが取得されると、アプリケーションは必要なバッファを割り当てる責任があります
@@ -608,8 +635,15 @@ D3D12HelloTriangle::CreateBottomLevelAS(
   // 加速構造を構築します。この呼び出しは、生成された AS にバリアを統合することに注意してください。
   // このメソッドの直後にトップレベル AS を計算するために使用できるようにします。
   bottomLevelAS.Generate(m_commandList.Get(), buffers.pScratch.Get(),
-                         buffers.pResult.Get(), false, nullptr);
-
+                         buffers.pResult.Get(), false, nullptr,
+                         compactedSizeAddress);
+
+  // A structure built for compaction is registered by the caller once
+  // compacted, as the compacted copy is the one kept
+  // 圧縮用に構築された構造は、圧縮後のコピーが保持されるため、圧縮後に呼び出し元が登録します
+  if (compactedSizeAddress == 0) {
+    m_bottomLevelASRegistry.Register(key, buffers.pResult.Get());
+  }
   return buffers;
 }
 
@@ -621,12 +655,19 @@ D3D12HelloTriangle::CreateBottomLevelAS(
 // 最下位レベルの AS 生成と同様に、インスタンスの収集、AS のメモリ要件の計算、AS 自体の構築という 3 つのステップで実行されます。
 void D3D12HelloTriangle::CreateTopLevelAS(
     const std::vector<std::pair<ComPtr<ID3D12Resource>, DirectX::XMMATRIX>>
-        &instances // pair of bottom level AS and matrix of the instance
+        &instances, // pair of bottom level AS and matrix of the instance
 				   // インスタンスの最下位 AS と行列のペア
+    const std::vector<uint8_t> *visibility // optional visibility of each instance
+                                           // 各インスタンスのオプションの可視性
 ) {
-  // Gather all the instances into the builder helper
-  // すべてのインスタンスをビルダー ヘルパーに集める
+  // Gather all the instances into the builder helper, skipping the culled
+  // ones. The instance ID remains the index of the instance in the scene.
+  // すべてのインスタンスをビルダー ヘルパーに集め、カリングされたものはスキップします。
+  // インスタンス ID はシーン内のインスタンスのインデックスのままです。
   for (size_t i = 0; i < instances.size(); i++) {
+    if (visibility && !(*visibility)[i]) {
+      continue;
+    }
     m_topLevelASGenerator.AddInstance(instances[i].first.Get(),
                                       instances[i].second, static_cast<UINT>(i),
                                       static_cast<UINT>(0));
@@ -686,35 +727,108 @@ void D3D12HelloTriangle::CreateTopLevelAS(
 // structure required to raytrace the scene
 // BLAS ビルドと TLAS ビルドを組み合わせて、シーンのレイトレースに必要な加速構造全体を構築します
 void D3D12HelloTriangle::CreateAccelerationStructures() {
+  // Flush the command list and wait for it to finish. Once the command list is
+  // finished executing, reset it to be reused
+  // コマンドリストをフラッシュし、完了するのを待ちます。
+  // コマンド リストの実行が終了したら、再利用するためにリセットします
+  auto flushCommandList = [this]() {
+    m_commandList->Close();
+    ID3D12CommandList *ppCommandLists[] = {m_commandList.Get()};
+    m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+    m_fenceValue++;
+    m_commandQueue->Signal(m_fence.Get(), m_fenceValue);
+
+    m_fence->SetEventOnCompletion(m_fenceValue, m_fenceEvent);
+    WaitForSingleObject(m_fenceEvent, INFINITE);
+
+    ThrowIfFailed(
+        m_commandList->Reset(m_commandAllocator.Get(), m_pipelineState.Get()));
+  };
+
+  // The builder only knows the actual size of the bottom-level AS once it is
+  // built. It is written by the GPU in a small buffer, which is then copied to
+  // the readback heap for the CPU to read it
+  // ビルダーは、最下位 AS のビルド後にのみ実際のサイズを知ることができます。
+  // サイズは GPU によって小さなバッファーに書き込まれ、CPU が読み取れるように
+  // リードバック ヒープにコピーされます
+  ComPtr<ID3D12Resource> compactedSizeBuffer = nv_helpers_dx12::CreateBuffer(
+      m_device.Get(), sizeof(UINT64), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+      D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nv_helpers_dx12::kDefaultHeapProps);
+  ComPtr<ID3D12Resource> compactedSizeReadback = nv_helpers_dx12::CreateBuffer(
+      m_device.Get(), sizeof(UINT64), D3D12_RESOURCE_FLAG_NONE,
+      D3D12_RESOURCE_STATE_COPY_DEST, nv_helpers_dx12::kReadbackHeapProps);
+
   // Build the bottom AS from the Triangle vertex buffer
   // Triangle 頂点バッファーから下の AS を構築します
+  // A structure with the same content may already be registered, in which
+  // case it is used as is, without building nor compacting it again
+  // 同じ内容の構造が既に登録されている場合は、再度ビルドや圧縮をせずにそのまま使用されます
+  nv_helpers_dx12::BottomLevelASContentKey contentKey;
   AccelerationStructureBuffers bottomLevelBuffers =
-      CreateBottomLevelAS({{m_vertexBuffer.Get(), 3}});
+      CreateBottomLevelAS({{m_vertexBuffer.Get(), 3}},
+                          compactedSizeBuffer->GetGPUVirtualAddress(),
+                          &contentKey);
+
+  ComPtr<ID3D12Resource> compactedBottomLevelAS = bottomLevelBuffers.pResult;
+  if (bottomLevelBuffers.pScratch) {
+    D3D12_RESOURCE_BARRIER barrier = {};
+    barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    barrier.Transition.pResource = compactedSizeBuffer.Get();
+    barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+    barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
+    barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+    m_commandList->ResourceBarrier(1, &barrier);
+    m_commandList->CopyResource(compactedSizeReadback.Get(),
+                                compactedSizeBuffer.Get());
+    flushCommandList();
+
+    UINT64 *compactedSize = nullptr;
+    D3D12_RANGE readRange = {0, sizeof(UINT64)};
+    ThrowIfFailed(compactedSizeReadback->Map(
+        0, &readRange, reinterpret_cast<void **>(&compactedSize)));
+    UINT64 compactedSizeInBytes = *compactedSize;
+    D3D12_RANGE writtenRange = {0, 0};
+    compactedSizeReadback->Unmap(0, &writtenRange);
+
+    // Copy the bottom AS into a tightly sized buffer. The oversized buffer is
+    // released once we exit the function
+    // 最下位 AS をぴったりのサイズのバッファにコピーします。
+    // 大きすぎるバッファは関数を終了すると解放されます
+    compactedBottomLevelAS = nv_helpers_dx12::CreateBuffer(
+        m_device.Get(),
+        ROUND_UP(compactedSizeInBytes,
+                 D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT),
+        D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+        nv_helpers_dx12::kDefaultHeapProps);
+    nv_helpers_dx12::BottomLevelASGenerator::Compact(
+        m_commandList.Get(), bottomLevelBuffers.pResult.Get(),
+        compactedBottomLevelAS.Get());
+
+    // Report the memory reclaimed by the compaction
+    // 圧縮によって回収されたメモリを報告します
+    UINT64 maxSizeInBytes = bottomLevelBuffers.pResult->GetDesc().Width;
+    std::wstring report = L"BLAS 0: " + std::to_wstring(maxSizeInBytes) +
+                          L" bytes before compaction, " +
+                          std::to_wstring(compactedSizeInBytes) + L" bytes after\n";
+    OutputDebugStringW(report.c_str());
+
+    // The compacted copy is the one shared with the geometry of the same content
+    // 圧縮後のコピーが、同じ内容のジオメトリと共有されます
+    m_bottomLevelASRegistry.Register(contentKey, compactedBottomLevelAS.Get());
+  }
 
-  // Just one instance for now
-  // 現時点では 1 つのインスタンスのみ
-  m_instances = {{bottomLevelBuffers.pResult, XMMatrixIdentity()}};
+  // Just one instance for now. The top-level AS references the compacted
+  // bottom-level AS, which is copied by the time it is built
+  // 現時点では 1 つのインスタンスのみ。トップレベル AS は圧縮された最下位 AS を参照します
+  m_instances = {{compactedBottomLevelAS, XMMatrixIdentity()}};
   CreateTopLevelAS(m_instances);
 
-  // Flush the command list and wait for it to finish
-  // コマンドリストをフラッシュし、完了するのを待ちます
-  m_commandList->Close();
-  ID3D12CommandList *ppCommandLists[] = {m_commandList.Get()};
-  m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
-  m_fenceValue++;
-  m_commandQueue->Signal(m_fence.Get(), m_fenceValue);
-
-  m_fence->SetEventOnCompletion(m_fenceValue, m_fenceEvent);
-  WaitForSingleObject(m_fenceEvent, INFINITE);
-
-  // Once the command list is finished executing, reset it to be reused for rendering
-  // コマンド リストの実行が終了したら、レンダリングに再利用するためにリセットします
-  ThrowIfFailed(
-      m_commandList->Reset(m_commandAllocator.Get(), m_pipelineState.Get()));
+  flushCommandList();
 
   // Store the AS buffers. The rest of the buffers will be released once we exit the function
   // AS バッファを保存します。関数を終了すると、残りのバッファは解放されます。
-  m_bottomLevelAS = bottomLevelBuffers.pResult;
+  m_bottomLevelAS = compactedBottomLevelAS;
 }
 
 //-----------------------------------------------------------------------------
@@ -872,6 +986,12 @@ void D3D12HelloTriangle::CreateRaytracingPipeline() {
   // 状態オブジェクトをプロパティ オブジェクトにキャストし、後で名前でシェーダー ポインターにアクセスできるようにします
   ThrowIfFailed(
       m_rtStateObject->QueryInterface(IID_PPV_ARGS(&m_rtStateObjectProps)));
+
+  // Fetch the shader identifiers once, so that the SBT builds copy them from the cache
+  // SBT の構築時にキャッシュからコピーできるように、シェーダー識別子を一度だけ取得します
+  nv_helpers_dx12::ShaderIdentifierCache& identifiers = m_sbtHelper.GetShaderIdentifierCache();
+  identifiers.SetPipeline(m_rtStateObjectProps.Get());
+  identifiers.Resolve({L"RayGen", L"Miss", L"HitGroup"});
 }
 
 //-----------------------------------------------------------------------------
@@ -16,6 +16,7 @@
 #include <dxcapi.h>
 #include <vector>
 
+#include "nv_helpers_dx12/BottomLevelASRegistry.h"
 #include "nv_helpers_dx12/ShaderBindingTableGenerator.h"
 #include "nv_helpers_dx12/TopLevelASGenerator.h"
 
@@ -93,6 +94,9 @@ private:
   };
 
   ComPtr<ID3D12Resource> m_bottomLevelAS; // Storage for the bottom Level AS(ŉ AS ̃Xg[W)
+  // Bottom-level AS shared between geometries with the same content
+  // ẽWIgԂŋLŉ AS
+  nv_helpers_dx12::BottomLevelASRegistry m_bottomLevelASRegistry;
 
   nv_helpers_dx12::TopLevelASGenerator m_topLevelASGenerator;
   AccelerationStructureBuffers m_topLevelASBuffers;
@@ -102,18 +106,37 @@ private:
   ///
   /// \param     vVertexBuffers : pair of buffer and vertex count
   /// p[^ vVertexBuffers: obt@ƒ_̃yA
+  /// \param     compactedSizeAddress : optional address receiving the compacted size of the AS.
+  /// p[^ compactedSizeAddress: AS ̈k̃TCY󂯎IvṼAhXB
+  /// \param     contentKey : optional key of the content of the AS. A structure with the same
+  /// content is shared through m_bottomLevelASRegistry, to which the caller releases the result.
+  /// A shared structure is returned without scratch buffer. Otherwise, a structure built without
+  /// compactedSizeAddress is registered, while one built for compaction is registered by the
+  /// caller under contentKey once compacted.
+  /// p[^ contentKey: AS ̓ẽIvṼL[Be̍\
+  /// m_bottomLevelASRegistry ʂċLAĂяo͌ʂWXgɉ܂B
+  /// Lꂽ\̓XNb` obt@ȂŕԂ܂BȊȌꍇAcompactedSizeAddress
+  /// Ȃō\zꂽ\͓o^Akpɍ\zꂽ\͈kɌĂяo
+  /// contentKey œo^܂B
   /// \return    AccelerationStructureBuffers for TLAS
   /// ߂l	 TLAS  AccelerationStructureBuffers 
   AccelerationStructureBuffers CreateBottomLevelAS(
-      std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vVertexBuffers);
+      std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vVertexBuffers,
+      D3D12_GPU_VIRTUAL_ADDRESS compactedSizeAddress = 0,
+      nv_helpers_dx12::BottomLevelASContentKey *contentKey = nullptr);
 
   /// Create the main acceleration structure that holds all instances of the scene
   /// V[ׂ̂ẴCX^Xێ郁C̉\쐬܂
   /// \param     instances : pair of BLAS and transform
   ///p[^@CX^X: BLAS ƕϊ̃yA
+  /// \param     visibility : optional visibility of each instance, as computed
+  /// by nv_helpers_dx12::InstanceCuller. Culled instances are not added.
+  /// p[^ visibility: nv_helpers_dx12::InstanceCuller ŌvZꂽeCX^X
+  /// IvV̉BJOꂽCX^X͒ǉ܂B
   void CreateTopLevelAS(
       const std::vector<std::pair<ComPtr<ID3D12Resource>, DirectX::XMMATRIX>>
-          &instances);
+          &instances,
+      const std::vector<uint8_t> *visibility = nullptr);
 
   /// Create all acceleration structures, bottom and top
   /// Ə㕔ׂ̂Ẳ\쐬܂
@@ -56,6 +56,11 @@ static const D3D12_HEAP_PROPERTIES kUploadHeapProps = {
 static const D3D12_HEAP_PROPERTIES kDefaultHeapProps = {
     D3D12_HEAP_TYPE_DEFAULT, D3D12_CPU_PAGE_PROPERTY_UNKNOWN, D3D12_MEMORY_POOL_UNKNOWN, 0, 0};
 
+// Specifies a heap used for reading back. This heap type has CPU access optimized
+// for reading data written by the GPU.
+static const D3D12_HEAP_PROPERTIES kReadbackHeapProps = {
+    D3D12_HEAP_TYPE_READBACK, D3D12_CPU_PAGE_PROPERTY_UNKNOWN, D3D12_MEMORY_POOL_UNKNOWN, 0, 0};
+
 //--------------------------------------------------------------------------------------------------
 // Compile a HLSL file into a DXIL library
 //
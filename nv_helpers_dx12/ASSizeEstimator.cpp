@@ -0,0 +1,127 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Analytical estimate of the prebuild sizes of acceleration structures. See
+ASSizeEstimator.h for details.
+*/
+
+#include "ASSizeEstimator.h"
+
+#include "BVHImage.h"
+
+// Helper to compute aligned buffer sizes
+#ifndef ROUND_UP
+#define ROUND_UP(v, powerOf2Alignment) (((v) + (powerOf2Alignment)-1) & ~((powerOf2Alignment)-1))
+#endif
+
+namespace nv_helpers_dx12
+{
+
+namespace
+{
+// Fixed part of a structure, and slack for aligning its sections
+const uint64_t kHeaderSize = 256;
+const uint64_t kSectionSlack = 3 * 16;
+// Data stored per geometry descriptor: flags, index and triangle range
+const uint64_t kGeometrySize = 64;
+// Box node of a binary hierarchy
+const uint64_t kNodeSize = 32;
+// Parent link used to refit structures allowing updates
+const uint64_t kParentLinkSize = 4;
+// Copy of a triangle, with its geometry and primitive indices, and its primitive index in the
+// leaves
+const uint64_t kTriangleSize = 48;
+// Copy of an instance descriptor and its primitive index in the leaves
+const uint64_t kInstanceSize = sizeof(D3D12_RAYTRACING_INSTANCE_DESC) + 4;
+// Scratch memory per primitive: bounds and centroid, and sort key and index double-buffered for
+// the partitioning
+const uint64_t kPrimitiveScratchSize = 24 + 12 + 2 * 8;
+// Scratch memory per node: task queue entry of the top-down build, or visit counter and parent of
+// the bottom-up linear build
+const uint64_t kTraceNodeScratchSize = 16;
+const uint64_t kBuildNodeScratchSize = 8;
+// Scratch memory per node for a refit: visit counter and refitted bounds
+const uint64_t kUpdateNodeScratchSize = 4 + 24;
+
+// The estimate has to bound the size of the CPU hierarchy
+static_assert(sizeof(BVHImageHeader) + kSectionSlack <= kHeaderSize,
+              "The header estimate is smaller than the CPU hierarchy header");
+static_assert(sizeof(BVHNode) <= kNodeSize, "The node estimate is smaller than the CPU nodes");
+static_assert(sizeof(BVHTriangle) + sizeof(uint32_t) <= kTriangleSize,
+              "The triangle estimate is smaller than the CPU triangles");
+
+// Estimate the sizes of a hierarchy over primitives of the given size
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO
+EstimatePrebuildInfo(uint64_t primitiveCount, uint64_t primitiveSize, uint64_t fixedSize,
+                     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags)
+{
+  // Worst case of one primitive per leaf
+  uint64_t nodeCount = primitiveCount > 1 ? 2 * primitiveCount - 1 : 1;
+  bool allowUpdate = (flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) != 0;
+  bool fastBuild =
+      (flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD) != 0;
+
+  uint64_t nodeSize = kNodeSize + (allowUpdate ? kParentLinkSize : 0);
+  uint64_t resultSize = kHeaderSize + fixedSize + nodeCount * nodeSize +
+                        primitiveCount * primitiveSize;
+
+  uint64_t nodeScratchSize = fastBuild ? kBuildNodeScratchSize : kTraceNodeScratchSize;
+  uint64_t scratchSize =
+      kHeaderSize + primitiveCount * kPrimitiveScratchSize + nodeCount * nodeScratchSize;
+
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info = {};
+  info.ResultDataMaxSizeInBytes =
+      ROUND_UP(resultSize, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+  info.ScratchDataSizeInBytes =
+      ROUND_UP(scratchSize, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+  info.UpdateScratchDataSizeInBytes =
+      allowUpdate ? ROUND_UP(kHeaderSize + nodeCount * kUpdateNodeScratchSize,
+                             D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT)
+                  : 0;
+  return info;
+}
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Estimate the sizes of a bottom-level acceleration structure over the given number of triangles
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO
+EstimateBottomLevelASPrebuildInfo(uint64_t triangleCount, uint32_t geometryCount,
+                                  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags)
+{
+  return EstimatePrebuildInfo(triangleCount, kTriangleSize, geometryCount * kGeometrySize, flags);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Estimate the sizes of a top-level acceleration structure over the given number of instances
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO
+EstimateTopLevelASPrebuildInfo(uint64_t instanceCount,
+                               D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags)
+{
+  return EstimatePrebuildInfo(instanceCount, kInstanceSize, 0, flags);
+}
+} // namespace nv_helpers_dx12
@@ -0,0 +1,82 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Analytical estimate of the prebuild sizes of acceleration structures, for
+memory budgeting and streaming planning without a device, for instance in
+offline tools or on machines without raytracing support.
+
+The estimate models a binary hierarchy in the worst case of one primitive per
+leaf, that is 2N-1 nodes for N primitives. The result holds the nodes, a copy
+of each triangle or instance descriptor along with its primitive index, and the
+per-geometry data. Structures allowing updates also keep a parent link per node
+for the refit. The scratch memory holds the bounds, centroids and sort keys of
+the primitives, double-buffered for the partitioning, and per-node work items.
+PREFER_FAST_BUILD models a linear BVH, which needs per-node visit counters
+rather than a task queue. The per-element sizes are at least the ones of the
+CPU builder (BVHBuilder, BVHImage), so that the result estimate bounds the size
+of the CPU hierarchy, see Benchmarks/ASSizeEstimatorValidation.cpp.
+
+Drivers use their own layouts, so the estimates are meant for budgeting: the
+buffers of a GPU build are still sized using the device. The generators fall
+back to the estimates when ComputeASBufferSizes is called without a device.
+
+Example:
+
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info =
+    nv_helpers_dx12::EstimateBottomLevelASPrebuildInfo(
+        triangleCount, geometryCount,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE);
+budget += info.ResultDataMaxSizeInBytes;
+
+*/
+
+#pragma once
+
+#include "d3d12.h"
+
+#include <cstdint>
+
+namespace nv_helpers_dx12
+{
+
+/// Estimate the sizes of a bottom-level acceleration structure over the given number of
+/// triangles, as GetRaytracingAccelerationStructurePrebuildInfo would. The sizes are 256-byte
+/// aligned.
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO
+EstimateBottomLevelASPrebuildInfo(uint64_t triangleCount, /// Number of triangles of all geometries
+                                  uint32_t geometryCount, /// Number of geometry descriptors
+                                  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags
+                                  /// Build flags: update, build preference and compaction
+);
+
+/// Estimate the sizes of a top-level acceleration structure over the given number of instances,
+/// as GetRaytracingAccelerationStructurePrebuildInfo would. The sizes are 256-byte aligned.
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO
+EstimateTopLevelASPrebuildInfo(uint64_t instanceCount, /// Number of instances
+                               D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags
+                               /// Build flags: update, build preference and compaction
+);
+} // namespace nv_helpers_dx12
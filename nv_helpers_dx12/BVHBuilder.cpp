@@ -0,0 +1,1596 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The BVH builder constructs bounding volume hierarchies over triangles on the CPU,
+using either binned surface area heuristic splits, or a parallel linear BVH
+construction over Morton codes, and refits them when the triangles move. See
+BVHBuilder.h for details.
+*/
+
+#include "BVHBuilder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace nv_helpers_dx12
+{
+
+namespace
+{
+// Bin into which a primitive centroid falls, given the lower bound of the
+// centroid bounds along the split axis and the scale mapping the centroid
+// extent to the bins
+inline uint32_t BinIndex(float centroid, float centroidMin, float scale, uint32_t binCount)
+{
+  auto bin = static_cast<uint32_t>((centroid - centroidMin) * scale);
+  return bin < binCount ? bin : binCount - 1;
+}
+
+// Ray/box slab test, returning the entry distance along the ray, or infinity if
+// the box is missed within [tMin, tMax]
+inline float IntersectAABB(const AABB& box, const float origin[3], const float invDir[3],
+                           float tMin, float tMax)
+{
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float t0 = (box.min[axis] - origin[axis]) * invDir[axis];
+    float t1 = (box.max[axis] - origin[axis]) * invDir[axis];
+    if (t0 > t1)
+    {
+      std::swap(t0, t1);
+    }
+    tMin = t0 > tMin ? t0 : tMin;
+    tMax = t1 < tMax ? t1 : tMax;
+    if (tMin > tMax)
+    {
+      return std::numeric_limits<float>::infinity();
+    }
+  }
+  return tMin;
+}
+
+// Minimum number of items processed by a worker thread, below which spawning
+// threads costs more than it saves
+const uint32_t kMinItemsPerThread = 4096;
+
+// Number of chunks into which a loop over count items is split when running on
+// at most threadCount threads. The chunking only depends on those two values,
+// so that successive loops over the same items see the same chunks
+inline uint32_t ChunkCount(uint32_t count, uint32_t threadCount)
+{
+  uint32_t maxChunks = (count + kMinItemsPerThread - 1) / kMinItemsPerThread;
+  uint32_t chunks = threadCount < maxChunks ? threadCount : maxChunks;
+  return chunks > 0 ? chunks : 1;
+}
+
+// Run func(chunkIndex, begin, end) over the chunks of [0, count), each chunk on
+// its own thread. The calling thread processes the first chunk.
+template <typename Func>
+void ParallelFor(uint32_t count, uint32_t threadCount, const Func& func)
+{
+  uint32_t chunkCount = ChunkCount(count, threadCount);
+  uint32_t chunkSize = (count + chunkCount - 1) / chunkCount;
+  std::vector<std::thread> workers;
+  workers.reserve(chunkCount - 1);
+  for (uint32_t chunk = 1; chunk < chunkCount; chunk++)
+  {
+    uint32_t begin = chunk * chunkSize;
+    uint32_t end = begin + chunkSize < count ? begin + chunkSize : count;
+    workers.emplace_back([&func, chunk, begin, end]() { func(chunk, begin, end); });
+  }
+  func(0, 0, chunkSize < count ? chunkSize : count);
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+}
+
+// Run func(item) for each item of [0, count) on up to threadCount threads, each
+// thread fetching the next item when done with the previous one. Unlike
+// ParallelFor, there is no minimum number of items per thread: this is meant
+// for a few costly items of uneven cost, such as the subtrees of a refit. The
+// calling thread takes part in the loop.
+template <typename Func>
+void ParallelForEachItem(uint32_t count, uint32_t threadCount, const Func& func)
+{
+  std::atomic<uint32_t> nextItem(0);
+  auto loop = [&nextItem, &func, count]() {
+    for (uint32_t item = nextItem++; item < count; item = nextItem++)
+    {
+      func(item);
+    }
+  };
+  uint32_t usedThreads = threadCount < count ? threadCount : count;
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < usedThreads; i++)
+  {
+    workers.emplace_back(loop);
+  }
+  loop();
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+}
+
+// Minimum overlap between the children of an object split, relative to the
+// surface area of the root, for which spatial splits are considered. This
+// restricts the spatial split search to the nodes where it may pay off, as
+// proposed by Stich et al., "Spatial Splits in Bounding Volume Hierarchies"
+// (HPG 2009).
+const float kSpatialSplitAlpha = 1e-5f;
+
+// Compute the bounds of the parts of a triangle on each side of an axis-aligned
+// plane, restricted to the bounds of the reference being split. A side which
+// does not contain any part of the triangle is left empty.
+void SplitReference(const BVHTriangle& tri, const AABB& refBounds, int axis, float position,
+                    AABB* left, AABB* right)
+{
+  left->Reset();
+  right->Reset();
+  const float* vertices[3] = {tri.v0, tri.v1, tri.v2};
+  for (int i = 0; i < 3; i++)
+  {
+    const float* a = vertices[i];
+    const float* b = vertices[(i + 1) % 3];
+    if (a[axis] <= position)
+    {
+      left->Grow(a);
+    }
+    if (a[axis] >= position)
+    {
+      right->Grow(a);
+    }
+    // The edges crossing the plane add their intersection to both sides
+    if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position))
+    {
+      float t = (position - a[axis]) / (b[axis] - a[axis]);
+      float point[3];
+      for (int k = 0; k < 3; k++)
+      {
+        point[k] = a[k] + t * (b[k] - a[k]);
+      }
+      point[axis] = position;
+      left->Grow(point);
+      right->Grow(point);
+    }
+  }
+
+  for (int k = 0; k < 3; k++)
+  {
+    left->min[k] = left->min[k] > refBounds.min[k] ? left->min[k] : refBounds.min[k];
+    left->max[k] = left->max[k] < refBounds.max[k] ? left->max[k] : refBounds.max[k];
+    right->min[k] = right->min[k] > refBounds.min[k] ? right->min[k] : refBounds.min[k];
+    right->max[k] = right->max[k] < refBounds.max[k] ? right->max[k] : refBounds.max[k];
+  }
+  left->max[axis] = left->max[axis] < position ? left->max[axis] : position;
+  right->min[axis] = right->min[axis] > position ? right->min[axis] : position;
+}
+
+// Number of leading zero bits of a 32-bit value, 32 for 0
+inline int CountLeadingZeros(uint32_t value)
+{
+  if (value == 0)
+  {
+    return 32;
+  }
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse(&index, value);
+  return 31 - static_cast<int>(index);
+#else
+  return __builtin_clz(value);
+#endif
+}
+
+// Spread the 10 lowest bits of a value so that two zero bits separate each of
+// them, to interleave the coordinates into a Morton code
+inline uint32_t ExpandBits(uint32_t v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// 30-bit Morton code of a point, given in [0,1]^3
+inline uint32_t MortonCode(float x, float y, float z)
+{
+  auto quantize = [](float f) {
+    float scaled = f * 1024.f;
+    scaled = scaled < 0.f ? 0.f : (scaled > 1023.f ? 1023.f : scaled);
+    return static_cast<uint32_t>(scaled);
+  };
+  return (ExpandBits(quantize(x)) << 2) | (ExpandBits(quantize(y)) << 1) |
+         ExpandBits(quantize(z));
+}
+
+// Sort the Morton codes along with the primitive indices using a least
+// significant digit radix sort. Each pass builds per-chunk histograms in
+// parallel, turns them into per-chunk output offsets, and scatters each chunk in
+// parallel. Scattering a chunk in order keeps the sort stable across passes.
+void RadixSort(std::vector<uint32_t>& codes, std::vector<uint32_t>& indices, uint32_t threadCount)
+{
+  const uint32_t kRadixBits = 8;
+  const uint32_t kRadixSize = 1 << kRadixBits;
+  // Morton codes only use 30 bits
+  const uint32_t kKeyBits = 30;
+
+  auto count = static_cast<uint32_t>(codes.size());
+  uint32_t chunkCount = ChunkCount(count, threadCount);
+  std::vector<uint32_t> histograms(chunkCount * kRadixSize);
+  std::vector<uint32_t> codesTmp(count);
+  std::vector<uint32_t> indicesTmp(count);
+
+  for (uint32_t shift = 0; shift < kKeyBits; shift += kRadixBits)
+  {
+    std::fill(histograms.begin(), histograms.end(), 0);
+    ParallelFor(count, threadCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+      uint32_t* histogram = histograms.data() + chunk * kRadixSize;
+      for (uint32_t i = begin; i < end; i++)
+      {
+        histogram[(codes[i] >> shift) & (kRadixSize - 1)]++;
+      }
+    });
+
+    // Exclusive prefix sum, digit-major so that the chunks of a digit are
+    // written one after the other
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < kRadixSize; digit++)
+    {
+      for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+      {
+        uint32_t digitCount = histograms[chunk * kRadixSize + digit];
+        histograms[chunk * kRadixSize + digit] = offset;
+        offset += digitCount;
+      }
+    }
+
+    ParallelFor(count, threadCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+      uint32_t* offsets = histograms.data() + chunk * kRadixSize;
+      for (uint32_t i = begin; i < end; i++)
+      {
+        uint32_t destination = offsets[(codes[i] >> shift) & (kRadixSize - 1)]++;
+        codesTmp[destination] = codes[i];
+        indicesTmp[destination] = indices[i];
+      }
+    });
+    codes.swap(codesTmp);
+    indices.swap(indicesTmp);
+  }
+}
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Set the box to an inverted, empty state, so that growing it by any point or box yields that
+// point or box
+void AABB::Reset()
+{
+  for (int axis = 0; axis < 3; axis++)
+  {
+    min[axis] = FLT_MAX;
+    max[axis] = -FLT_MAX;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Enlarge the box so that it contains the point
+void AABB::Grow(const float point[3])
+{
+  for (int axis = 0; axis < 3; axis++)
+  {
+    min[axis] = point[axis] < min[axis] ? point[axis] : min[axis];
+    max[axis] = point[axis] > max[axis] ? point[axis] : max[axis];
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Enlarge the box so that it contains the other box
+void AABB::Grow(const AABB& box)
+{
+  for (int axis = 0; axis < 3; axis++)
+  {
+    min[axis] = box.min[axis] < min[axis] ? box.min[axis] : min[axis];
+    max[axis] = box.max[axis] > max[axis] ? box.max[axis] : max[axis];
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Surface area of the box, or 0 if the box is empty
+float AABB::SurfaceArea() const
+{
+  if (IsEmpty())
+  {
+    return 0.f;
+  }
+  float dx = max[0] - min[0];
+  float dy = max[1] - min[1];
+  float dz = max[2] - min[2];
+  return 2.f * (dx * dy + dy * dz + dz * dx);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Bounding box of the triangle
+AABB BVHTriangle::Bounds() const
+{
+  AABB box;
+  box.Reset();
+  box.Grow(v0);
+  box.Grow(v1);
+  box.Grow(v2);
+  return box;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Intersect the triangle with a ray using the Moller-Trumbore algorithm. Triangles are considered
+// double-sided, as for instances without the culling flags.
+bool BVHTriangle::Intersect(const BVHRay& ray, float* t, float* u, float* v) const
+{
+  const float kEpsilon = 1e-9f;
+  float e1[3], e2[3], s[3], p[3], q[3];
+  for (int i = 0; i < 3; i++)
+  {
+    e1[i] = v1[i] - v0[i];
+    e2[i] = v2[i] - v0[i];
+    s[i] = ray.origin[i] - v0[i];
+  }
+  p[0] = ray.direction[1] * e2[2] - ray.direction[2] * e2[1];
+  p[1] = ray.direction[2] * e2[0] - ray.direction[0] * e2[2];
+  p[2] = ray.direction[0] * e2[1] - ray.direction[1] * e2[0];
+  float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+  if (std::fabs(det) < kEpsilon)
+  {
+    return false;
+  }
+  float invDet = 1.f / det;
+  *u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+  if (*u < 0.f || *u > 1.f)
+  {
+    return false;
+  }
+  q[0] = s[1] * e1[2] - s[2] * e1[1];
+  q[1] = s[2] * e1[0] - s[0] * e1[2];
+  q[2] = s[0] * e1[1] - s[1] * e1[0];
+  *v = (ray.direction[0] * q[0] + ray.direction[1] * q[1] + ray.direction[2] * q[2]) * invDet;
+  if (*v < 0.f || *u + *v > 1.f)
+  {
+    return false;
+  }
+  *t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+  return *t >= ray.tMin && *t <= ray.tMax;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Compute the SAH cost of the hierarchy, given the relative costs of traversing a node and
+// intersecting a triangle. Each node contributes its cost weighted by the probability of a random
+// ray hitting it, which is the ratio between its surface area and the one of the root
+float BVH::ComputeSAHCost(float traversalCost /*= 1.f*/, float intersectionCost /*= 1.f*/) const
+{
+  if (nodes.empty())
+  {
+    return 0.f;
+  }
+  float rootArea = nodes[0].bounds.SurfaceArea();
+  if (rootArea <= 0.f)
+  {
+    return intersectionCost * static_cast<float>(nodes[0].primCount);
+  }
+
+  double cost = 0.0;
+  for (const auto& node : nodes)
+  {
+    double probability = node.bounds.SurfaceArea() / rootArea;
+    if (node.IsLeaf())
+    {
+      cost += probability * intersectionCost * node.primCount;
+    }
+    else
+    {
+      cost += probability * traversalCost;
+    }
+  }
+  return static_cast<float>(cost);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Ratio between the current SAH cost and the one right after the last full build
+float BVH::GetSAHDegradation() const
+{
+  return referenceSAHCost > 0.f ? stats.sahCost / referenceSAHCost : 1.f;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the closest intersection of the ray with the triangles of the hierarchy. The traversal
+// visits the closest child first, so that the ray interval shrinks as early as possible
+bool BVH::Intersect(const BVHRay& ray, BVHHit* hit,
+                    BVHTraversalStats* traversalStats /*= nullptr*/) const
+{
+  if (nodes.empty())
+  {
+    return false;
+  }
+
+  float invDir[3];
+  for (int axis = 0; axis < 3; axis++)
+  {
+    invDir[axis] = 1.f / ray.direction[axis];
+  }
+
+  BVHRay current = ray;
+  bool found = false;
+  BVHTraversalStats counters;
+
+  // The stack holds at most one entry per level of the hierarchy, and only
+  // spills to the heap for degenerate hierarchies deeper than 256 levels
+  BVHTraversalStack<uint32_t, 256> stack;
+  counters.boxTests++;
+  if (IntersectAABB(nodes[0].bounds, ray.origin, invDir, ray.tMin, ray.tMax) !=
+      std::numeric_limits<float>::infinity())
+  {
+    stack.Push(0);
+  }
+
+  while (!stack.IsEmpty())
+  {
+    const BVHNode& node = nodes[stack.Pop()];
+    if (node.IsLeaf())
+    {
+      counters.triangleTests += node.primCount;
+      for (uint32_t i = 0; i < node.primCount; i++)
+      {
+        const BVHTriangle& tri = triangles[primIndices[node.leftFirst + i]];
+        float t, u, v;
+        if (tri.Intersect(current, &t, &u, &v))
+        {
+          current.tMax = t;
+          hit->t = t;
+          hit->u = u;
+          hit->v = v;
+          hit->geometryIndex = tri.geometryIndex;
+          hit->primitiveIndex = tri.primitiveIndex;
+          found = true;
+        }
+      }
+      continue;
+    }
+
+    counters.boxTests += 2;
+    uint32_t near = node.leftFirst;
+    uint32_t far = node.leftFirst + 1;
+    float tNear =
+        IntersectAABB(nodes[near].bounds, current.origin, invDir, current.tMin, current.tMax);
+    float tFar =
+        IntersectAABB(nodes[far].bounds, current.origin, invDir, current.tMin, current.tMax);
+    if (tFar < tNear)
+    {
+      std::swap(near, far);
+      std::swap(tNear, tFar);
+    }
+    // Push the farthest child first so that the nearest one is popped next
+    if (tFar != std::numeric_limits<float>::infinity())
+    {
+      stack.Push(far);
+    }
+    if (tNear != std::numeric_limits<float>::infinity())
+    {
+      stack.Push(near);
+    }
+  }
+  if (traversalStats)
+  {
+    traversalStats->boxTests += counters.boxTests;
+    traversalStats->triangleTests += counters.triangleTests;
+  }
+  return found;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Number of bins used along each axis to evaluate the candidate splits
+void BVHBuilder::SetBinCount(uint32_t binCount)
+{
+  if (binCount < 2 || binCount > kMaxBinCount)
+  {
+    throw std::logic_error("The BVH bin count must be between 2 and 64");
+  }
+  m_binCount = binCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Number of triangles under which a node is always turned into a leaf, and above which a node is
+// always split
+void BVHBuilder::SetMaxLeafSize(uint32_t maxLeafSize)
+{
+  if (maxLeafSize == 0)
+  {
+    throw std::logic_error("The BVH leaves must be able to contain at least one triangle");
+  }
+  m_maxLeafSize = maxLeafSize;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Relative costs of traversing a node and intersecting a triangle
+void BVHBuilder::SetCosts(float traversalCost, float intersectionCost)
+{
+  m_traversalCost = traversalCost;
+  m_intersectionCost = intersectionCost;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Memory used by the nodes, primitive indices and triangles
+uint64_t BVH::GetSizeInBytes() const
+{
+  return nodes.size() * sizeof(BVHNode) + primIndices.size() * sizeof(uint32_t) +
+         triangles.size() * sizeof(BVHTriangle);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Number of worker threads used by the parallel builders. 0 uses all the hardware threads
+void BVHBuilder::SetThreadCount(uint32_t threadCount)
+{
+  m_threadCount = threadCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Maximum number of references added by the spatial split builder, relative to the number of
+// splittable triangles
+void BVHBuilder::SetSpatialSplitBudget(float duplicationBudget)
+{
+  if (duplicationBudget < 0.f)
+  {
+    throw std::logic_error("The spatial split budget cannot be negative");
+  }
+  m_spatialSplitBudget = duplicationBudget;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build a hierarchy over the triangles using binned SAH splits
+void BVHBuilder::BuildSAH(std::vector<BVHTriangle> triangles, BVH* result) const
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  result->triangles = std::move(triangles);
+
+  // The bounds of the triangles are used many times during the build, hence
+  // computed once upfront
+  std::vector<AABB> primBounds(result->triangles.size());
+  for (size_t i = 0; i < primBounds.size(); i++)
+  {
+    primBounds[i] = result->triangles[i].Bounds();
+  }
+  BuildSAHNodes(primBounds, result);
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::high_resolution_clock::now() - start;
+  result->stats.buildTimeMs = elapsed.count();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build a hierarchy over arbitrary primitives given by their bounds, such as the instances of a
+// top-level hierarchy. The triangle list of the result is left empty.
+void BVHBuilder::BuildSAH(const std::vector<AABB>& primBounds, BVH* result) const
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  result->triangles.clear();
+  BuildSAHNodes(primBounds, result);
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::high_resolution_clock::now() - start;
+  result->stats.buildTimeMs = elapsed.count();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build the nodes of a hierarchy using binned SAH splits. The nodes are split top-down using an
+// explicit stack, each split appending the two children at the end of the node list
+void BVHBuilder::BuildSAHNodes(const std::vector<AABB>& primBounds, BVH* result) const
+{
+  BVH& bvh = *result;
+  bvh.nodes.clear();
+  bvh.primIndices.clear();
+
+  auto primCount = static_cast<uint32_t>(primBounds.size());
+  if (primCount == 0)
+  {
+    bvh.stats = BVHBuildStats();
+    bvh.referenceSAHCost = 0.f;
+    return;
+  }
+
+  bvh.primIndices.resize(primCount);
+  for (uint32_t i = 0; i < primCount; i++)
+  {
+    bvh.primIndices[i] = i;
+  }
+
+  // A binary tree with N leaves has 2N-1 nodes, which bounds the node count
+  bvh.nodes.reserve(2 * primCount - 1);
+  BVHNode root;
+  root.bounds.Reset();
+  for (const auto& box : primBounds)
+  {
+    root.bounds.Grow(box);
+  }
+  root.leftFirst = 0;
+  root.primCount = primCount;
+  bvh.nodes.push_back(root);
+
+  std::vector<uint32_t> stack = {0};
+  while (!stack.empty())
+  {
+    uint32_t nodeIndex = stack.back();
+    stack.pop_back();
+    BVHNode node = bvh.nodes[nodeIndex];
+
+    if (node.primCount == 1)
+    {
+      continue;
+    }
+
+    AABB centroidBounds;
+    centroidBounds.Reset();
+    for (uint32_t i = 0; i < node.primCount; i++)
+    {
+      const AABB& box = primBounds[bvh.primIndices[node.leftFirst + i]];
+      float centroid[3] = {box.Center(0), box.Center(1), box.Center(2)};
+      centroidBounds.Grow(centroid);
+    }
+
+    int axis = -1;
+    uint32_t splitBin = 0;
+    float splitCost =
+        FindBestSplit(bvh.primIndices.data() + node.leftFirst, node.primCount, primBounds,
+                      node.bounds.SurfaceArea(), centroidBounds, &axis, &splitBin);
+    float leafCost = m_intersectionCost * static_cast<float>(node.primCount);
+
+    uint32_t* first = bvh.primIndices.data() + node.leftFirst;
+    uint32_t* last = first + node.primCount;
+    uint32_t* middle = nullptr;
+    if (splitCost >= 0.f && (splitCost < leafCost || node.primCount > m_maxLeafSize))
+    {
+      float scale = static_cast<float>(m_binCount) /
+                    (centroidBounds.max[axis] - centroidBounds.min[axis]);
+      middle = std::partition(first, last, [&](uint32_t prim) {
+        return BinIndex(primBounds[prim].Center(axis), centroidBounds.min[axis], scale,
+                        m_binCount) < splitBin;
+      });
+    }
+    else if (splitCost < 0.f && node.primCount > m_maxLeafSize)
+    {
+      // All centroids coincide, or the node has no area, so no spatial
+      // criterion can separate the primitives: split the list in half to honor
+      // the leaf size
+      middle = first + node.primCount / 2;
+    }
+
+    if (middle == nullptr)
+    {
+      continue;
+    }
+
+    BVHNode left, right;
+    left.leftFirst = node.leftFirst;
+    left.primCount = static_cast<uint32_t>(middle - first);
+    right.leftFirst = left.leftFirst + left.primCount;
+    right.primCount = node.primCount - left.primCount;
+    left.bounds.Reset();
+    right.bounds.Reset();
+    for (uint32_t i = 0; i < left.primCount; i++)
+    {
+      left.bounds.Grow(primBounds[bvh.primIndices[left.leftFirst + i]]);
+    }
+    for (uint32_t i = 0; i < right.primCount; i++)
+    {
+      right.bounds.Grow(primBounds[bvh.primIndices[right.leftFirst + i]]);
+    }
+
+    auto leftIndex = static_cast<uint32_t>(bvh.nodes.size());
+    bvh.nodes.push_back(left);
+    bvh.nodes.push_back(right);
+    bvh.nodes[nodeIndex].leftFirst = leftIndex;
+    bvh.nodes[nodeIndex].primCount = 0;
+
+    stack.push_back(leftIndex + 1);
+    stack.push_back(leftIndex);
+  }
+
+  ComputeStats(result);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build a hierarchy using both object and spatial splits, following Stich et al., "Spatial Splits
+// in Bounding Volume Hierarchies" (HPG 2009). The nodes work on references, which are either whole
+// triangles or the part of a triangle within some bounds. A spatial split clips the references
+// straddling the split plane, the left part keeping the index of the reference while the right part
+// is appended to the reference list. The leaves then store the triangle index of each reference,
+// hence a triangle may be referenced by several leaves.
+void BVHBuilder::BuildSBVH(std::vector<BVHTriangle> triangles, BVH* result,
+                           const std::vector<bool>& splittableGeometries) const
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  BVH& bvh = *result;
+  bvh.triangles = std::move(triangles);
+  bvh.nodes.clear();
+  bvh.primIndices.clear();
+
+  auto primCount = static_cast<uint32_t>(bvh.triangles.size());
+  if (primCount == 0)
+  {
+    bvh.stats = BVHBuildStats();
+    bvh.referenceSAHCost = 0.f;
+    return;
+  }
+
+  std::vector<AABB> refBounds(primCount);
+  std::vector<uint32_t> refPrims(primCount);
+  std::vector<bool> splittable(primCount);
+  uint32_t splittableCount = 0;
+  for (uint32_t i = 0; i < primCount; i++)
+  {
+    refBounds[i] = bvh.triangles[i].Bounds();
+    refPrims[i] = i;
+    uint32_t geometryIndex = bvh.triangles[i].geometryIndex;
+    splittable[i] = splittableGeometries.empty() ||
+                    (geometryIndex < splittableGeometries.size() &&
+                     splittableGeometries[geometryIndex]);
+    splittableCount += splittable[i] ? 1 : 0;
+  }
+
+  // Number of references the spatial splits can still add
+  auto budget = static_cast<uint32_t>(m_spatialSplitBudget * static_cast<float>(splittableCount));
+  uint32_t maxRefCount = primCount + budget;
+  bvh.nodes.reserve(2 * maxRefCount - 1);
+  bvh.primIndices.reserve(maxRefCount);
+
+  BVHNode root;
+  root.bounds.Reset();
+  for (const auto& box : refBounds)
+  {
+    root.bounds.Grow(box);
+  }
+  root.leftFirst = 0;
+  root.primCount = 0;
+  bvh.nodes.push_back(root);
+  float rootArea = root.bounds.SurfaceArea();
+
+  struct WorkItem
+  {
+    uint32_t nodeIndex;
+    std::vector<uint32_t> refs;
+  };
+  std::vector<WorkItem> stack(1);
+  stack[0].nodeIndex = 0;
+  stack[0].refs.resize(primCount);
+  for (uint32_t i = 0; i < primCount; i++)
+  {
+    stack[0].refs[i] = i;
+  }
+
+  while (!stack.empty())
+  {
+    WorkItem item = std::move(stack.back());
+    stack.pop_back();
+    const std::vector<uint32_t>& refs = item.refs;
+    auto refCount = static_cast<uint32_t>(refs.size());
+    AABB nodeBounds = bvh.nodes[item.nodeIndex].bounds;
+    float nodeArea = nodeBounds.SurfaceArea();
+
+    std::vector<uint32_t> left, right;
+    if (refCount > 1)
+    {
+      AABB centroidBounds;
+      centroidBounds.Reset();
+      for (uint32_t ref : refs)
+      {
+        float centroid[3] = {refBounds[ref].Center(0), refBounds[ref].Center(1),
+                             refBounds[ref].Center(2)};
+        centroidBounds.Grow(centroid);
+      }
+
+      int axis = -1;
+      uint32_t splitBin = 0;
+      float objectCost = FindBestSplit(refs.data(), refCount, refBounds, nodeArea, centroidBounds,
+                                       &axis, &splitBin);
+      float scale = objectCost >= 0.f ? static_cast<float>(m_binCount) /
+                                            (centroidBounds.max[axis] - centroidBounds.min[axis])
+                                      : 0.f;
+      auto goesLeft = [&](uint32_t ref) {
+        return BinIndex(refBounds[ref].Center(axis), centroidBounds.min[axis], scale,
+                        m_binCount) < splitBin;
+      };
+
+      // Spatial splits are only searched for when the children of the object
+      // split overlap significantly. If the centroids cannot be separated, the
+      // children would overlap entirely.
+      SpatialSplit spatial;
+      if (budget > 0)
+      {
+        float overlapArea = nodeArea;
+        if (objectCost >= 0.f)
+        {
+          AABB leftBounds, rightBounds;
+          leftBounds.Reset();
+          rightBounds.Reset();
+          for (uint32_t ref : refs)
+          {
+            (goesLeft(ref) ? leftBounds : rightBounds).Grow(refBounds[ref]);
+          }
+          AABB overlap;
+          for (int k = 0; k < 3; k++)
+          {
+            overlap.min[k] = leftBounds.min[k] > rightBounds.min[k] ? leftBounds.min[k]
+                                                                    : rightBounds.min[k];
+            overlap.max[k] = leftBounds.max[k] < rightBounds.max[k] ? leftBounds.max[k]
+                                                                    : rightBounds.max[k];
+          }
+          overlapArea = overlap.SurfaceArea();
+        }
+        if (overlapArea > kSpatialSplitAlpha * rootArea)
+        {
+          spatial = FindSpatialSplit(refs, refBounds, refPrims, bvh.triangles, splittable,
+                                     nodeBounds);
+          if (spatial.cost >= 0.f && spatial.leftCount + spatial.rightCount - refCount > budget)
+          {
+            spatial.cost = -1.f;
+          }
+        }
+      }
+
+      bool useSpatial = spatial.cost >= 0.f && (objectCost < 0.f || spatial.cost < objectCost);
+      float splitCost = useSpatial ? spatial.cost : objectCost;
+      float leafCost = m_intersectionCost * static_cast<float>(refCount);
+      if (splitCost >= 0.f && (splitCost < leafCost || refCount > m_maxLeafSize))
+      {
+        if (useSpatial)
+        {
+          // The straddling references are either split, or kept whole on the
+          // side where they increase the cost the least, as the bounds of the
+          // children are tighter than the bin boundaries
+          float binScale = static_cast<float>(m_binCount) /
+                           (nodeBounds.max[spatial.axis] - nodeBounds.min[spatial.axis]);
+          float nodeMin = nodeBounds.min[spatial.axis];
+          AABB leftBounds = spatial.leftBounds;
+          AABB rightBounds = spatial.rightBounds;
+          auto leftCount = static_cast<float>(spatial.leftCount);
+          auto rightCount = static_cast<float>(spatial.rightCount);
+          for (uint32_t ref : refs)
+          {
+            AABB box = refBounds[ref];
+            uint32_t prim = refPrims[ref];
+            if (!splittable[prim])
+            {
+              (BinIndex(box.Center(spatial.axis), nodeMin, binScale, m_binCount) < spatial.bin
+                   ? left
+                   : right)
+                  .push_back(ref);
+              continue;
+            }
+            uint32_t first = BinIndex(box.min[spatial.axis], nodeMin, binScale, m_binCount);
+            uint32_t last = BinIndex(box.max[spatial.axis], nodeMin, binScale, m_binCount);
+            if (last < spatial.bin)
+            {
+              left.push_back(ref);
+              continue;
+            }
+            if (first >= spatial.bin)
+            {
+              right.push_back(ref);
+              continue;
+            }
+
+            AABB leftPart, rightPart;
+            SplitReference(bvh.triangles[prim], box, spatial.axis, spatial.position, &leftPart,
+                           &rightPart);
+            AABB leftWithRef = leftBounds;
+            leftWithRef.Grow(box);
+            AABB rightWithRef = rightBounds;
+            rightWithRef.Grow(box);
+            float duplicateCost =
+                leftBounds.SurfaceArea() * leftCount + rightBounds.SurfaceArea() * rightCount;
+            float leftOnlyCost = leftWithRef.SurfaceArea() * leftCount +
+                                 rightBounds.SurfaceArea() * (rightCount - 1.f);
+            float rightOnlyCost = leftBounds.SurfaceArea() * (leftCount - 1.f) +
+                                  rightWithRef.SurfaceArea() * rightCount;
+            if (rightPart.IsEmpty() ||
+                (leftOnlyCost <= duplicateCost && leftOnlyCost <= rightOnlyCost))
+            {
+              left.push_back(ref);
+              leftBounds = leftWithRef;
+              rightCount -= 1.f;
+            }
+            else if (leftPart.IsEmpty() || rightOnlyCost <= duplicateCost)
+            {
+              right.push_back(ref);
+              rightBounds = rightWithRef;
+              leftCount -= 1.f;
+            }
+            else
+            {
+              refBounds[ref] = leftPart;
+              left.push_back(ref);
+              right.push_back(static_cast<uint32_t>(refBounds.size()));
+              refBounds.push_back(rightPart);
+              refPrims.push_back(prim);
+            }
+          }
+        }
+        else
+        {
+          for (uint32_t ref : refs)
+          {
+            (goesLeft(ref) ? left : right).push_back(ref);
+          }
+        }
+      }
+
+      // All centroids coincide, the node has no area, or the spatial split
+      // ended up keeping all the references on one side: split the list in half
+      // to honor the leaf size
+      if (left.empty() || right.empty())
+      {
+        left.clear();
+        right.clear();
+        if (refCount > m_maxLeafSize)
+        {
+          left.assign(refs.begin(), refs.begin() + refCount / 2);
+          right.assign(refs.begin() + refCount / 2, refs.end());
+        }
+      }
+    }
+
+    if (left.empty())
+    {
+      BVHNode& leaf = bvh.nodes[item.nodeIndex];
+      leaf.leftFirst = static_cast<uint32_t>(bvh.primIndices.size());
+      leaf.primCount = refCount;
+      for (uint32_t ref : refs)
+      {
+        bvh.primIndices.push_back(refPrims[ref]);
+      }
+      continue;
+    }
+
+    budget -= static_cast<uint32_t>(left.size() + right.size()) - refCount;
+
+    BVHNode children[2];
+    std::vector<uint32_t>* childRefs[2] = {&left, &right};
+    for (int c = 0; c < 2; c++)
+    {
+      children[c].bounds.Reset();
+      for (uint32_t ref : *childRefs[c])
+      {
+        children[c].bounds.Grow(refBounds[ref]);
+      }
+      children[c].leftFirst = 0;
+      children[c].primCount = 0;
+    }
+
+    auto leftIndex = static_cast<uint32_t>(bvh.nodes.size());
+    bvh.nodes.push_back(children[0]);
+    bvh.nodes.push_back(children[1]);
+    bvh.nodes[item.nodeIndex].leftFirst = leftIndex;
+    bvh.nodes[item.nodeIndex].primCount = 0;
+
+    stack.push_back({leftIndex + 1, std::move(right)});
+    stack.push_back({leftIndex, std::move(left)});
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::high_resolution_clock::now() - start;
+  ComputeStats(result);
+  bvh.stats.buildTimeMs = elapsed.count();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build a linear hierarchy over the triangles sorted by the Morton code of their centroid. The
+// topology is derived from the sorted codes following Karras, "Maximizing Parallelism in the
+// Construction of BVHs, Octrees, and k-d Trees" (HPG 2012): each internal node is computed
+// independently from the others, which makes every step of the build parallel.
+//
+// In that radix tree, each of the N-1 internal nodes splits its range of codes at a distinct
+// position. Storing the children of the node splitting at position s in the slots 2s+1 and 2s+2
+// hence yields the sibling-adjacent layout of BVHNode without any sequential pass.
+void BVHBuilder::BuildLBVH(std::vector<BVHTriangle> triangles, BVH* result) const
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  BVH& bvh = *result;
+  bvh.triangles = std::move(triangles);
+  bvh.nodes.clear();
+  bvh.primIndices.clear();
+
+  auto primCount = static_cast<uint32_t>(bvh.triangles.size());
+  if (primCount == 0)
+  {
+    bvh.stats = BVHBuildStats();
+    bvh.referenceSAHCost = 0.f;
+    return;
+  }
+  uint32_t threadCount = GetThreadCount();
+
+  // Bounds of the centroids, used to normalize the positions before encoding
+  std::vector<AABB> chunkBounds(ChunkCount(primCount, threadCount));
+  ParallelFor(primCount, threadCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+    AABB& bounds = chunkBounds[chunk];
+    bounds.Reset();
+    for (uint32_t i = begin; i < end; i++)
+    {
+      AABB box = bvh.triangles[i].Bounds();
+      float centroid[3] = {box.Center(0), box.Center(1), box.Center(2)};
+      bounds.Grow(centroid);
+    }
+  });
+  AABB centroidBounds;
+  centroidBounds.Reset();
+  for (const auto& bounds : chunkBounds)
+  {
+    centroidBounds.Grow(bounds);
+  }
+  float scale[3];
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+    scale[axis] = extent > 0.f ? 1.f / extent : 0.f;
+  }
+
+  // Encode and sort the centroids along the Morton curve
+  std::vector<uint32_t> codes(primCount);
+  bvh.primIndices.resize(primCount);
+  ParallelFor(primCount, threadCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; i++)
+    {
+      AABB box = bvh.triangles[i].Bounds();
+      codes[i] = MortonCode((box.Center(0) - centroidBounds.min[0]) * scale[0],
+                            (box.Center(1) - centroidBounds.min[1]) * scale[1],
+                            (box.Center(2) - centroidBounds.min[2]) * scale[2]);
+      bvh.primIndices[i] = i;
+    }
+  });
+  RadixSort(codes, bvh.primIndices, threadCount);
+
+  bvh.nodes.resize(2 * primCount - 1);
+  if (primCount == 1)
+  {
+    bvh.nodes[0].bounds = bvh.triangles[bvh.primIndices[0]].Bounds();
+    bvh.nodes[0].leftFirst = 0;
+    bvh.nodes[0].primCount = 1;
+    ComputeStats(result);
+    bvh.stats.buildTimeMs =
+        std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start)
+            .count();
+    return;
+  }
+
+  // Length of the common prefix of the codes of two sorted primitives, or -1
+  // if j is out of range. Duplicate codes are disambiguated using the indices.
+  auto delta = [&](int64_t i, int64_t j) -> int {
+    if (j < 0 || j >= static_cast<int64_t>(primCount))
+    {
+      return -1;
+    }
+    uint32_t a = codes[static_cast<size_t>(i)];
+    uint32_t b = codes[static_cast<size_t>(j)];
+    if (a == b)
+    {
+      return 32 + CountLeadingZeros(static_cast<uint32_t>(i ^ j));
+    }
+    return CountLeadingZeros(a ^ b);
+  };
+
+  // Determine the split position of each internal node, and the slot of each
+  // of its children in the node list. The root is stored in slot 0.
+  uint32_t internalCount = primCount - 1;
+  std::vector<uint32_t> splits(internalCount);
+  std::vector<uint32_t> internalSlots(internalCount);
+  std::vector<uint32_t> leafSlots(primCount);
+  internalSlots[0] = 0;
+  ParallelFor(internalCount, threadCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+    for (uint32_t node = begin; node < end; node++)
+    {
+      int64_t i = node;
+      // Direction of the range covered by the node
+      int d = delta(i, i + 1) - delta(i, i - 1) > 0 ? 1 : -1;
+      // Upper bound of the range length, then exact length by binary search
+      int deltaMin = delta(i, i - d);
+      int64_t lengthMax = 2;
+      while (delta(i, i + lengthMax * d) > deltaMin)
+      {
+        lengthMax *= 2;
+      }
+      int64_t length = 0;
+      for (int64_t t = lengthMax / 2; t >= 1; t /= 2)
+      {
+        if (delta(i, i + (length + t) * d) > deltaMin)
+        {
+          length += t;
+        }
+      }
+      int64_t j = i + length * d;
+
+      // Find the split position by binary search on the common prefix
+      int deltaNode = delta(i, j);
+      int64_t split = 0;
+      for (int64_t divider = 2;; divider *= 2)
+      {
+        int64_t t = (length + divider - 1) / divider;
+        if (delta(i, i + (split + t) * d) > deltaNode)
+        {
+          split += t;
+        }
+        if (t <= 1)
+        {
+          break;
+        }
+      }
+      auto gamma = static_cast<uint32_t>(i + split * d + (d < 0 ? -1 : 0));
+      splits[node] = gamma;
+
+      // Children covering a single primitive are leaves, others are the
+      // internal nodes with the same index as the split bound
+      uint32_t first = static_cast<uint32_t>(i < j ? i : j);
+      uint32_t last = static_cast<uint32_t>(i < j ? j : i);
+      (first == gamma ? leafSlots[gamma] : internalSlots[gamma]) = 2 * gamma + 1;
+      (last == gamma + 1 ? leafSlots[gamma + 1] : internalSlots[gamma + 1]) = 2 * gamma + 2;
+    }
+  });
+
+  // Emit the internal nodes now that their slots are known, along with the
+  // parent links used to propagate the bounds
+  std::vector<uint32_t> parents(2 * primCount - 1);
+  std::vector<std::atomic<uint32_t>> visits(2 * primCount - 1);
+  ParallelFor(internalCount, threadCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+    for (uint32_t node = begin; node < end; node++)
+    {
+      uint32_t slot = internalSlots[node];
+      uint32_t left = 2 * splits[node] + 1;
+      bvh.nodes[slot].leftFirst = left;
+      bvh.nodes[slot].primCount = 0;
+      parents[left] = slot;
+      parents[left + 1] = slot;
+      visits[slot].store(0, std::memory_order_relaxed);
+    }
+  });
+
+  // Emit the leaves, and propagate the bounds towards the root. The first
+  // thread reaching an internal node stops there, the second one, which knows
+  // both children are complete, computes the node bounds and carries on.
+  ParallelFor(primCount, threadCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+    for (uint32_t leaf = begin; leaf < end; leaf++)
+    {
+      uint32_t slot = leafSlots[leaf];
+      bvh.nodes[slot].bounds = bvh.triangles[bvh.primIndices[leaf]].Bounds();
+      bvh.nodes[slot].leftFirst = leaf;
+      bvh.nodes[slot].primCount = 1;
+      while (slot != 0)
+      {
+        slot = parents[slot];
+        if (visits[slot].fetch_add(1, std::memory_order_acq_rel) == 0)
+        {
+          break;
+        }
+        BVHNode& node = bvh.nodes[slot];
+        node.bounds = bvh.nodes[node.leftFirst].bounds;
+        node.bounds.Grow(bvh.nodes[node.leftFirst + 1].bounds);
+      }
+    }
+  });
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::high_resolution_clock::now() - start;
+  ComputeStats(result);
+  bvh.stats.buildTimeMs = elapsed.count();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Update the bounds of a previously built hierarchy from new triangles, keeping its topology. The
+// top of the tree is cut into independent subtrees, which are refitted in parallel, before the
+// few nodes above them are refitted on the calling thread
+float BVHBuilder::Refit(std::vector<BVHTriangle> triangles, BVH* bvh) const
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  if (triangles.size() != bvh->triangles.size())
+  {
+    throw std::logic_error("Refitting a BVH requires the same triangles as its original build");
+  }
+  bvh->triangles = std::move(triangles);
+  if (bvh->nodes.empty())
+  {
+    return 1.f;
+  }
+
+  // Expand the top of the tree breadth-first until there are enough subtrees
+  // to keep all the threads busy. Leaves cannot be expanded and are kept in the
+  // frontier as single-node subtrees.
+  uint32_t threadCount = GetThreadCount();
+  uint32_t targetSubtrees = threadCount > 1 ? 4 * threadCount : 1;
+  std::vector<uint32_t> topNodes;
+  std::vector<uint32_t> frontier = {0};
+  while (frontier.size() < targetSubtrees)
+  {
+    std::vector<uint32_t> next;
+    bool expanded = false;
+    for (uint32_t index : frontier)
+    {
+      const BVHNode& node = bvh->nodes[index];
+      if (node.IsLeaf())
+      {
+        next.push_back(index);
+      }
+      else
+      {
+        topNodes.push_back(index);
+        next.push_back(node.leftFirst);
+        next.push_back(node.leftFirst + 1);
+        expanded = true;
+      }
+    }
+    frontier.swap(next);
+    if (!expanded)
+    {
+      break;
+    }
+  }
+
+  // There are only a few subtrees of uneven sizes, so each is a task on its own
+  ParallelForEachItem(static_cast<uint32_t>(frontier.size()), threadCount,
+                      [&](uint32_t i) { RefitSubtree(bvh, frontier[i]); });
+
+  // The top nodes were gathered breadth-first, so walking them backwards
+  // always visits the children before their parent
+  for (auto it = topNodes.rbegin(); it != topNodes.rend(); ++it)
+  {
+    BVHNode& node = bvh->nodes[*it];
+    node.bounds = bvh->nodes[node.leftFirst].bounds;
+    node.bounds.Grow(bvh->nodes[node.leftFirst + 1].bounds);
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::high_resolution_clock::now() - start;
+  bvh->stats.sahCost = bvh->ComputeSAHCost(m_traversalCost, m_intersectionCost);
+  bvh->stats.buildTimeMs = elapsed.count();
+  return bvh->GetSAHDegradation();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Recompute the bounds of the subtree rooted at the given node, bottom-up. The traversal is done
+// in post-order using an explicit stack, as the builders give no guarantee on the relative order of
+// parents and children in the node list
+void BVHBuilder::RefitSubtree(BVH* bvh, uint32_t rootIndex)
+{
+  // Each entry stores a node index, with the highest bit set once the children
+  // of the node have been refitted
+  const uint32_t kChildrenDone = 0x80000000u;
+  std::vector<uint32_t> stack = {rootIndex};
+  while (!stack.empty())
+  {
+    uint32_t entry = stack.back();
+    BVHNode& node = bvh->nodes[entry & ~kChildrenDone];
+    if (node.IsLeaf())
+    {
+      node.bounds.Reset();
+      for (uint32_t i = 0; i < node.primCount; i++)
+      {
+        node.bounds.Grow(bvh->triangles[bvh->primIndices[node.leftFirst + i]].Bounds());
+      }
+      stack.pop_back();
+    }
+    else if (entry & kChildrenDone)
+    {
+      node.bounds = bvh->nodes[node.leftFirst].bounds;
+      node.bounds.Grow(bvh->nodes[node.leftFirst + 1].bounds);
+      stack.pop_back();
+    }
+    else
+    {
+      stack.back() |= kChildrenDone;
+      stack.push_back(node.leftFirst);
+      stack.push_back(node.leftFirst + 1);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the best SAH split of a node. The primitives are first binned according to their centroid
+// along each axis, then the bins are swept from both sides to evaluate every split candidate in
+// linear time
+float BVHBuilder::FindBestSplit(const uint32_t* prims, uint32_t primCount,
+                                const std::vector<AABB>& primBounds, float nodeArea,
+                                const AABB& centroidBounds, int* splitAxis,
+                                uint32_t* splitBin) const
+{
+  float bestCost = -1.f;
+  // The costs are relative to the area of the node, and cannot be compared for
+  // a node made of collinear or degenerate triangles
+  if (nodeArea <= 0.f)
+  {
+    return bestCost;
+  }
+
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+    if (extent <= 0.f)
+    {
+      continue;
+    }
+
+    AABB binBounds[kMaxBinCount];
+    uint32_t binCounts[kMaxBinCount] = {};
+    for (uint32_t b = 0; b < m_binCount; b++)
+    {
+      binBounds[b].Reset();
+    }
+
+    float scale = static_cast<float>(m_binCount) / extent;
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+      const AABB& box = primBounds[prims[i]];
+      uint32_t b = BinIndex(box.Center(axis), centroidBounds.min[axis], scale, m_binCount);
+      binCounts[b]++;
+      binBounds[b].Grow(box);
+    }
+
+    // Sweep from the right to accumulate the area and count of the right side
+    // of each split plane
+    float rightAreas[kMaxBinCount];
+    uint32_t rightCounts[kMaxBinCount];
+    AABB accumulated;
+    accumulated.Reset();
+    uint32_t count = 0;
+    for (uint32_t b = m_binCount - 1; b > 0; b--)
+    {
+      accumulated.Grow(binBounds[b]);
+      count += binCounts[b];
+      rightAreas[b] = accumulated.SurfaceArea();
+      rightCounts[b] = count;
+    }
+
+    // Sweep from the left, evaluating the split located before bin b
+    accumulated.Reset();
+    count = 0;
+    for (uint32_t b = 1; b < m_binCount; b++)
+    {
+      accumulated.Grow(binBounds[b - 1]);
+      count += binCounts[b - 1];
+      if (count == 0 || rightCounts[b] == 0)
+      {
+        continue;
+      }
+      float cost = m_traversalCost +
+                   m_intersectionCost *
+                       (accumulated.SurfaceArea() * count + rightAreas[b] * rightCounts[b]) /
+                       nodeArea;
+      if (bestCost < 0.f || cost < bestCost)
+      {
+        bestCost = cost;
+        *splitAxis = axis;
+        *splitBin = b;
+      }
+    }
+  }
+  return bestCost;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the best spatial split of the references of a node. Along each axis, the node bounds are
+// divided into bins of equal size, and each reference is clipped against the boundaries of the bins
+// it overlaps. A reference enters the bin containing its lower bound and exits the one containing
+// its upper bound, so that the number of references on each side of a plane is known after the
+// sweep.
+BVHBuilder::SpatialSplit BVHBuilder::FindSpatialSplit(const std::vector<uint32_t>& refs,
+                                                      const std::vector<AABB>& refBounds,
+                                                      const std::vector<uint32_t>& refPrims,
+                                                      const std::vector<BVHTriangle>& triangles,
+                                                      const std::vector<bool>& splittable,
+                                                      const AABB& nodeBounds) const
+{
+  SpatialSplit best;
+  float nodeArea = nodeBounds.SurfaceArea();
+  if (nodeArea <= 0.f)
+  {
+    return best;
+  }
+
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float extent = nodeBounds.max[axis] - nodeBounds.min[axis];
+    if (extent <= 0.f)
+    {
+      continue;
+    }
+
+    AABB binBounds[kMaxBinCount];
+    uint32_t entries[kMaxBinCount] = {};
+    uint32_t exits[kMaxBinCount] = {};
+    for (uint32_t b = 0; b < m_binCount; b++)
+    {
+      binBounds[b].Reset();
+    }
+
+    float scale = static_cast<float>(m_binCount) / extent;
+    float binWidth = extent / static_cast<float>(m_binCount);
+    for (uint32_t ref : refs)
+    {
+      const AABB& box = refBounds[ref];
+      uint32_t prim = refPrims[ref];
+
+      // References which cannot be split are binned by their centroid, as for
+      // object splits
+      if (!splittable[prim])
+      {
+        uint32_t b = BinIndex(box.Center(axis), nodeBounds.min[axis], scale, m_binCount);
+        entries[b]++;
+        exits[b]++;
+        binBounds[b].Grow(box);
+        continue;
+      }
+
+      uint32_t first = BinIndex(box.min[axis], nodeBounds.min[axis], scale, m_binCount);
+      uint32_t last = BinIndex(box.max[axis], nodeBounds.min[axis], scale, m_binCount);
+      entries[first]++;
+      exits[last]++;
+      AABB remaining = box;
+      for (uint32_t b = first; b < last; b++)
+      {
+        float plane = nodeBounds.min[axis] + static_cast<float>(b + 1) * binWidth;
+        AABB leftPart, rightPart;
+        SplitReference(triangles[prim], remaining, axis, plane, &leftPart, &rightPart);
+        binBounds[b].Grow(leftPart);
+        remaining = rightPart;
+      }
+      binBounds[last].Grow(remaining);
+    }
+
+    // Sweep from the right to accumulate the bounds and count of the right
+    // side of each split plane
+    AABB rightBounds[kMaxBinCount];
+    uint32_t rightCounts[kMaxBinCount];
+    AABB accumulated;
+    accumulated.Reset();
+    uint32_t count = 0;
+    for (uint32_t b = m_binCount - 1; b > 0; b--)
+    {
+      accumulated.Grow(binBounds[b]);
+      count += exits[b];
+      rightBounds[b] = accumulated;
+      rightCounts[b] = count;
+    }
+
+    // Sweep from the left, evaluating the split located before bin b
+    accumulated.Reset();
+    count = 0;
+    for (uint32_t b = 1; b < m_binCount; b++)
+    {
+      accumulated.Grow(binBounds[b - 1]);
+      count += entries[b - 1];
+      if (count == 0 || rightCounts[b] == 0)
+      {
+        continue;
+      }
+      float cost = m_traversalCost + m_intersectionCost *
+                                         (accumulated.SurfaceArea() * count +
+                                          rightBounds[b].SurfaceArea() * rightCounts[b]) /
+                                         nodeArea;
+      if (best.cost < 0.f || cost < best.cost)
+      {
+        best.cost = cost;
+        best.axis = axis;
+        best.bin = b;
+        best.position = nodeBounds.min[axis] + static_cast<float>(b) * binWidth;
+        best.leftCount = count;
+        best.rightCount = rightCounts[b];
+        best.leftBounds = accumulated;
+        best.rightBounds = rightBounds[b];
+      }
+    }
+  }
+  return best;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Fill the statistics of a freshly built hierarchy: node and leaf counts, depth, and SAH cost
+void BVHBuilder::ComputeStats(BVH* bvh) const
+{
+  BVHBuildStats& stats = bvh->stats;
+  stats = BVHBuildStats();
+  stats.nodeCount = static_cast<uint32_t>(bvh->nodes.size());
+  if (bvh->nodes.empty())
+  {
+    return;
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 1}};
+  while (!stack.empty())
+  {
+    auto entry = stack.back();
+    stack.pop_back();
+    const BVHNode& node = bvh->nodes[entry.first];
+    stats.maxDepth = entry.second > stats.maxDepth ? entry.second : stats.maxDepth;
+    if (node.IsLeaf())
+    {
+      stats.leafCount++;
+      stats.maxLeafSize = node.primCount > stats.maxLeafSize ? node.primCount : stats.maxLeafSize;
+    }
+    else
+    {
+      stack.push_back({node.leftFirst, entry.second + 1});
+      stack.push_back({node.leftFirst + 1, entry.second + 1});
+    }
+  }
+  stats.sahCost = bvh->ComputeSAHCost(m_traversalCost, m_intersectionCost);
+  bvh->referenceSAHCost = stats.sahCost;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Number of threads actually used by the parallel builders
+uint32_t BVHBuilder::GetThreadCount() const
+{
+  if (m_threadCount != 0)
+  {
+    return m_threadCount;
+  }
+  unsigned int hardwareThreads = std::thread::hardware_concurrency();
+  return hardwareThreads > 0 ? hardwareThreads : 1;
+}
+} // namespace nv_helpers_dx12
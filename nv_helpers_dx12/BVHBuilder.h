@@ -0,0 +1,382 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The BVH builder constructs bounding volume hierarchies over triangles on the CPU.
+It mirrors what the driver does when building a bottom-level acceleration
+structure, but keeps the result in host memory so that it can be inspected,
+profiled and traversed without a GPU.
+
+The hierarchy is a binary tree of 32-byte nodes. The two children of an interior
+node are always stored next to each other, so that a node only needs to store
+the index of its left child. Leaves reference a contiguous range of the
+primitive index list, which itself references the triangle list.
+
+The builder splits the nodes using the surface area heuristic (SAH), evaluated
+on a fixed number of bins along each axis. The number of bins and the leaf size
+can be tuned to trade build time against traversal performance.
+
+For geometry rebuilt every frame, a linear BVH (LBVH) can be built instead: the
+triangles are sorted along a Morton curve using a parallel radix sort, and the
+hierarchy is emitted from the sorted codes in parallel over all the cores. The
+resulting tree is of lower quality, but is typically built an order of
+magnitude faster than with SAH splits.
+
+Meshes made of long thin triangles, as often found in architectural models,
+produce nodes with large overlaps when each triangle is referenced by a single
+leaf. The spatial split builder (SBVH) may instead split a triangle reference
+across a plane, so that the triangle is referenced by the leaves on both sides.
+The number of added references is bounded by a duplication budget, and the
+geometries whose triangles can be split are selected individually.
+
+When only the vertex positions change, a hierarchy can be refitted: its topology
+is kept, and only the node bounds are recomputed from the new triangles. The
+quality of the tree degrades as the triangles move away from their original
+configuration, which is tracked by the ratio between the current SAH cost and
+the one right after the last full build. A full rebuild typically pays off once
+that ratio exceeds 1.5 to 2. Refitting recomputes the leaves from whole
+triangles, and hence also discards the benefit of spatial splits.
+
+Example:
+
+nv_helpers_dx12::BVHBuilder builder;
+builder.SetBinCount(16);
+builder.SetMaxLeafSize(4);
+
+nv_helpers_dx12::BVH bvh;
+builder.BuildSAH(triangles, &bvh);
+
+printf("%u nodes, SAH cost %f, built in %f ms\n", bvh.stats.nodeCount,
+bvh.stats.sahCost, bvh.stats.buildTimeMs);
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace nv_helpers_dx12
+{
+
+/// Axis-aligned bounding box
+struct AABB
+{
+  float min[3];
+  float max[3];
+
+  /// Set the box to an inverted, empty state, so that growing it by any point
+  /// or box yields that point or box
+  void Reset();
+  /// Enlarge the box so that it contains the point
+  void Grow(const float point[3]);
+  /// Enlarge the box so that it contains the other box
+  void Grow(const AABB& box);
+  /// Surface area of the box, or 0 if the box is empty
+  float SurfaceArea() const;
+  /// Center of the box along the given axis
+  float Center(int axis) const { return 0.5f * (min[axis] + max[axis]); }
+  /// True if the box does not contain any point
+  bool IsEmpty() const { return min[0] > max[0] || min[1] > max[1] || min[2] > max[2]; }
+};
+
+struct BVHRay;
+
+/// Triangle fetched from a geometry, with its vertices in the space of the
+/// acceleration structure
+struct BVHTriangle
+{
+  float v0[3];
+  float v1[3];
+  float v2[3];
+  /// Index of the geometry in the order it was added to the generator
+  uint32_t geometryIndex;
+  /// Index of the triangle within its geometry, as seen by PrimitiveIndex()
+  uint32_t primitiveIndex;
+
+  /// Bounding box of the triangle
+  AABB Bounds() const;
+  /// Intersect the triangle with a ray, returning the distance and barycentric
+  /// coordinates of the hit if it lies within the ray interval. Triangles are
+  /// considered double-sided.
+  bool Intersect(const BVHRay& ray, float* t, float* u, float* v) const;
+};
+
+/// Node of the binary hierarchy. An interior node stores the index of its left
+/// child, the right child immediately following it. A leaf stores the index of
+/// its first primitive and the number of primitives it contains.
+struct BVHNode
+{
+  AABB bounds;
+  uint32_t leftFirst;
+  uint32_t primCount;
+
+  bool IsLeaf() const { return primCount != 0; }
+};
+static_assert(sizeof(BVHNode) == 32, "BVH nodes are expected to be 32 bytes");
+
+/// Ray used for the CPU traversal. Hits are only reported within [tMin, tMax]
+struct BVHRay
+{
+  float origin[3];
+  float direction[3];
+  float tMin;
+  float tMax;
+  /// Time of the ray within the shutter interval, from 0 to 1, at which the
+  /// transforms of the instances with motion are interpolated
+  float time = 0.f;
+};
+
+/// Closest intersection found by the CPU traversal, using the same conventions
+/// as the built-in triangle intersector
+struct BVHHit
+{
+  /// Distance along the ray, as returned by RayTCurrent()
+  float t;
+  /// Barycentric coordinates of the hit point, as in BuiltInTriangleIntersectionAttributes
+  float u;
+  float v;
+  uint32_t geometryIndex;
+  uint32_t primitiveIndex;
+};
+
+/// Work done by the CPU traversal, accumulated over any number of rays, used to
+/// compare the quality of hierarchies independently of the machine
+struct BVHTraversalStats
+{
+  /// Number of ray/box tests
+  uint64_t boxTests = 0;
+  /// Number of ray/triangle tests
+  uint64_t triangleTests = 0;
+};
+
+/// Stack of the nodes left to visit by the CPU traversals. The entries are kept
+/// in a fixed-size array, and only spill to the heap once the array is full, so
+/// that degenerate hierarchies deeper than the array are still traversed safely.
+template <typename T, uint32_t Capacity>
+class BVHTraversalStack
+{
+public:
+  bool IsEmpty() const { return m_size == 0; }
+
+  void Push(const T& entry)
+  {
+    if (m_size < Capacity)
+    {
+      m_entries[m_size] = entry;
+    }
+    else
+    {
+      m_overflow.push_back(entry);
+    }
+    m_size++;
+  }
+
+  T Pop()
+  {
+    m_size--;
+    if (m_size < Capacity)
+    {
+      return m_entries[m_size];
+    }
+    T entry = m_overflow.back();
+    m_overflow.pop_back();
+    return entry;
+  }
+
+private:
+  T m_entries[Capacity];
+  std::vector<T> m_overflow;
+  uint32_t m_size = 0;
+};
+
+/// Statistics gathered while building a hierarchy, used to compare builders and
+/// settings on a per-mesh basis
+struct BVHBuildStats
+{
+  /// Wall-clock time spent in the builder
+  double buildTimeMs = 0.0;
+  uint32_t nodeCount = 0;
+  uint32_t leafCount = 0;
+  uint32_t maxDepth = 0;
+  uint32_t maxLeafSize = 0;
+  /// Expected cost of tracing a random ray through the hierarchy, relative to
+  /// the cost of a single ray/triangle intersection
+  float sahCost = 0.f;
+};
+
+/// Hierarchy built on the CPU, along with the triangles it references
+struct BVH
+{
+  /// Nodes of the hierarchy, the root being the first one
+  std::vector<BVHNode> nodes;
+  /// Indices of the triangles referenced by the leaves
+  std::vector<uint32_t> primIndices;
+  /// Triangles of all the geometries contained in the hierarchy
+  std::vector<BVHTriangle> triangles;
+  /// Statistics on the last build or refit
+  BVHBuildStats stats;
+  /// SAH cost of the hierarchy right after its last full build, used as a
+  /// reference to measure the degradation caused by refits
+  float referenceSAHCost = 0.f;
+
+  /// Ratio between the current SAH cost and the one right after the last full
+  /// build. A value of 1 means refitting did not degrade the hierarchy.
+  float GetSAHDegradation() const;
+
+  /// Compute the SAH cost of the hierarchy, given the relative costs of
+  /// traversing a node and intersecting a triangle
+  float ComputeSAHCost(float traversalCost = 1.f, float intersectionCost = 1.f) const;
+
+  /// Find the closest intersection of the ray with the triangles of the
+  /// hierarchy. Returns false if the ray does not hit anything. The work done
+  /// by the traversal is added to the optional statistics.
+  bool Intersect(const BVHRay& ray, BVHHit* hit,
+                 BVHTraversalStats* traversalStats = nullptr) const;
+
+  /// Memory used by the nodes, primitive indices and triangles
+  uint64_t GetSizeInBytes() const;
+};
+
+/// Helper class to build bounding volume hierarchies over triangles on the CPU
+class BVHBuilder
+{
+public:
+  /// Number of bins used along each axis to evaluate the candidate splits. More
+  /// bins find better splits at the expense of build time.
+  void SetBinCount(uint32_t binCount);
+
+  /// Number of triangles above which a node is always split. Smaller nodes are
+  /// also split whenever the SAH estimates it cheaper than a leaf.
+  void SetMaxLeafSize(uint32_t maxLeafSize);
+  uint32_t GetMaxLeafSize() const { return m_maxLeafSize; }
+
+  /// Relative costs of traversing a node and intersecting a triangle, used to
+  /// decide when splitting a node is worth it
+  void SetCosts(float traversalCost, float intersectionCost);
+
+  /// Number of worker threads used by the parallel builders. 0 uses all the
+  /// hardware threads.
+  void SetThreadCount(uint32_t threadCount);
+
+  /// Maximum number of triangle references the spatial split builder may add,
+  /// relative to the number of splittable triangles. For instance, a budget of
+  /// 0.25 lets the hierarchy reference 25% more triangles than the mesh has.
+  void SetSpatialSplitBudget(float duplicationBudget);
+  float GetSpatialSplitBudget() const { return m_spatialSplitBudget; }
+
+  /// Build a hierarchy over the triangles using binned SAH splits. The
+  /// triangles are moved into the result.
+  void BuildSAH(std::vector<BVHTriangle> triangles, BVH* result) const;
+
+  /// Build a hierarchy over arbitrary primitives given by their bounds, such as
+  /// the instances of a top-level hierarchy. The leaves reference the index of
+  /// the primitives in primBounds, and the triangle list of the result is left
+  /// empty.
+  void BuildSAH(const std::vector<AABB>& primBounds, BVH* result) const;
+
+  /// Build a hierarchy over the triangles using binned SAH splits, as well as
+  /// spatial splits which reference a triangle in both children when this
+  /// reduces the overlap between them. This reduces the number of nodes visited
+  /// by rays in meshes made of long thin triangles. Only the triangles of the
+  /// geometries flagged in splittableGeometries can be split, all of them if
+  /// the vector is empty. The triangles are moved into the result.
+  void BuildSBVH(std::vector<BVHTriangle> triangles, BVH* result,
+                 const std::vector<bool>& splittableGeometries = std::vector<bool>()) const;
+
+  /// Build a linear hierarchy over the triangles sorted by the Morton code of
+  /// their centroid. Each leaf contains a single triangle. The triangles are
+  /// moved into the result.
+  void BuildLBVH(std::vector<BVHTriangle> triangles, BVH* result) const;
+
+  /// Update the bounds of a previously built hierarchy from new triangles,
+  /// keeping its topology. The triangles must be given in the same order as
+  /// for the original build. Returns the SAH degradation of the refitted
+  /// hierarchy.
+  /// The leaves are refitted to whole triangles: the references clipped by the
+  /// spatial splits of BuildSBVH lose their clipped bounds, so that the leaves
+  /// sharing a split triangle overlap again. Hierarchies built with spatial
+  /// splits should be rebuilt rather than refitted.
+  float Refit(std::vector<BVHTriangle> triangles, BVH* bvh) const;
+
+private:
+  /// Maximum number of bins, bounding the size of the per-node bin arrays
+  static const uint32_t kMaxBinCount = 64;
+
+  /// Find the best SAH split of the primitives of a node and return its cost, or
+  /// a negative value if the primitive centroids cannot be separated. The split
+  /// is given as an axis and a bin index, the primitives whose centroid falls
+  /// in a bin lower than splitBin going to the left child.
+  float FindBestSplit(const uint32_t* prims, uint32_t primCount,
+                      const std::vector<AABB>& primBounds, float nodeArea,
+                      const AABB& centroidBounds, int* splitAxis, uint32_t* splitBin) const;
+
+  /// Candidate spatial split of a node. The references whose bounds lie in bins
+  /// lower than the split bin go to the left child, those straddling the split
+  /// plane being split in two.
+  struct SpatialSplit
+  {
+    /// SAH cost of the split, or a negative value if no plane separates the references
+    float cost = -1.f;
+    int axis = -1;
+    uint32_t bin = 0;
+    float position = 0.f;
+    /// Number of references and bounds of each child once the straddling references are split
+    uint32_t leftCount = 0;
+    uint32_t rightCount = 0;
+    AABB leftBounds;
+    AABB rightBounds;
+  };
+
+  /// Find the best spatial split of the references of a node, clipping the
+  /// triangles against the bin boundaries
+  SpatialSplit FindSpatialSplit(const std::vector<uint32_t>& refs,
+                                const std::vector<AABB>& refBounds,
+                                const std::vector<uint32_t>& refPrims,
+                                const std::vector<BVHTriangle>& triangles,
+                                const std::vector<bool>& splittable,
+                                const AABB& nodeBounds) const;
+
+  /// Build the nodes and primitive indices of a hierarchy over the primitive
+  /// bounds using binned SAH splits, and fill its statistics
+  void BuildSAHNodes(const std::vector<AABB>& primBounds, BVH* result) const;
+
+  /// Fill the statistics of a freshly built hierarchy
+  void ComputeStats(BVH* bvh) const;
+
+  /// Recompute the bounds of the subtree rooted at the given node, bottom-up
+  static void RefitSubtree(BVH* bvh, uint32_t rootIndex);
+
+  /// Number of threads actually used by the parallel builders
+  uint32_t GetThreadCount() const;
+
+  uint32_t m_binCount = 16;
+  uint32_t m_maxLeafSize = 4;
+  float m_traversalCost = 1.f;
+  float m_intersectionCost = 1.f;
+  uint32_t m_threadCount = 0;
+  float m_spatialSplitBudget = 0.25f;
+};
+} // namespace nv_helpers_dx12
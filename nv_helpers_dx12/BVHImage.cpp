@@ -0,0 +1,175 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Byte image of a hierarchy, stored in a plain arena and compacted the same way
+as the GPU acceleration structures. See BVHImage.h for details.
+*/
+
+#include "BVHImage.h"
+
+#include <cstring>
+#include <stdexcept>
+
+// Helper to compute aligned buffer sizes
+#ifndef ROUND_UP
+#define ROUND_UP(v, powerOf2Alignment) (((v) + (powerOf2Alignment)-1) & ~((powerOf2Alignment)-1))
+#endif
+
+namespace nv_helpers_dx12
+{
+
+namespace
+{
+// Alignment of each section of an image
+const uint64_t kSectionAlignment = 16;
+
+// A binary hierarchy has at most one leaf per triangle reference, hence 2n-1
+// nodes
+uint64_t GetMaxNodeCount(uint64_t referenceCount)
+{
+  return referenceCount == 0 ? 0 : 2 * referenceCount - 1;
+}
+
+// Compute the offsets of the sections and the size of an image
+void ComputeLayout(BVHImageHeader* header, uint64_t nodeCount, uint64_t primIndexCount,
+                   uint64_t triangleCount)
+{
+  header->nodeOffset = ROUND_UP(sizeof(BVHImageHeader), kSectionAlignment);
+  header->primIndexOffset =
+      ROUND_UP(header->nodeOffset + nodeCount * sizeof(BVHNode), kSectionAlignment);
+  header->triangleOffset =
+      ROUND_UP(header->primIndexOffset + primIndexCount * sizeof(uint32_t), kSectionAlignment);
+  header->sizeInBytes =
+      ROUND_UP(header->triangleOffset + triangleCount * sizeof(BVHTriangle), kSectionAlignment);
+}
+
+// The arenas are not required to be aligned, hence the header is always
+// accessed through a copy
+BVHImageHeader ReadHeader(const uint8_t* image)
+{
+  BVHImageHeader header;
+  memcpy(&header, image, sizeof(header));
+  return header;
+}
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Worst-case size of the image of a hierarchy over the given number of triangles and references
+uint64_t GetBVHImageMaxSize(uint32_t triangleCount, uint32_t referenceCount /*= 0*/)
+{
+  referenceCount = referenceCount > triangleCount ? referenceCount : triangleCount;
+  BVHImageHeader header;
+  ComputeLayout(&header, GetMaxNodeCount(referenceCount), referenceCount, triangleCount);
+  return header.sizeInBytes;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Store a hierarchy in an arena using the worst-case layout, recording the size of the compacted
+// image in the header so that it can be queried afterwards
+void StoreBVHImage(const BVH& bvh, uint8_t* arena, uint64_t arenaSizeInBytes)
+{
+  auto triangleCount = static_cast<uint32_t>(bvh.triangles.size());
+  auto referenceCount = static_cast<uint32_t>(bvh.primIndices.size());
+  referenceCount = referenceCount > triangleCount ? referenceCount : triangleCount;
+  if (bvh.nodes.size() > GetMaxNodeCount(referenceCount))
+  {
+    throw std::logic_error("The hierarchy does not fit in the worst-case image layout");
+  }
+
+  BVHImageHeader header = {};
+  header.nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+  header.primIndexCount = static_cast<uint32_t>(bvh.primIndices.size());
+  header.triangleCount = triangleCount;
+  header.referenceSAHCost = bvh.referenceSAHCost;
+  header.stats = bvh.stats;
+
+  BVHImageHeader compacted = header;
+  ComputeLayout(&compacted, header.nodeCount, header.primIndexCount, header.triangleCount);
+  header.compactedSizeInBytes = compacted.sizeInBytes;
+
+  ComputeLayout(&header, GetMaxNodeCount(referenceCount), referenceCount, triangleCount);
+  if (arenaSizeInBytes < header.sizeInBytes)
+  {
+    throw std::logic_error("The arena is too small to store the hierarchy - use "
+                           "GetBVHImageMaxSize to compute its size");
+  }
+
+  memcpy(arena, &header, sizeof(header));
+  memcpy(arena + header.nodeOffset, bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode));
+  memcpy(arena + header.primIndexOffset, bvh.primIndices.data(),
+         bvh.primIndices.size() * sizeof(uint32_t));
+  memcpy(arena + header.triangleOffset, bvh.triangles.data(),
+         bvh.triangles.size() * sizeof(BVHTriangle));
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Size actually used by the image stored in an arena
+uint64_t GetBVHImageCompactedSize(const uint8_t* image)
+{
+  return ReadHeader(image).compactedSizeInBytes;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Copy an image into a tightly sized arena, packing its sections
+void CompactBVHImage(const uint8_t* source, uint8_t* destination)
+{
+  BVHImageHeader header = ReadHeader(source);
+  BVHImageHeader compacted = header;
+  ComputeLayout(&compacted, header.nodeCount, header.primIndexCount, header.triangleCount);
+
+  // The sections are moved rather than copied, so that an image can be
+  // compacted in place
+  memmove(destination + compacted.nodeOffset, source + header.nodeOffset,
+          header.nodeCount * sizeof(BVHNode));
+  memmove(destination + compacted.primIndexOffset, source + header.primIndexOffset,
+          header.primIndexCount * sizeof(uint32_t));
+  memmove(destination + compacted.triangleOffset, source + header.triangleOffset,
+          header.triangleCount * sizeof(BVHTriangle));
+  memcpy(destination, &compacted, sizeof(compacted));
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Rebuild a hierarchy from its image
+void LoadBVHImage(const uint8_t* image, BVH* bvh)
+{
+  BVHImageHeader header = ReadHeader(image);
+  bvh->nodes.resize(header.nodeCount);
+  bvh->primIndices.resize(header.primIndexCount);
+  bvh->triangles.resize(header.triangleCount);
+  memcpy(bvh->nodes.data(), image + header.nodeOffset, header.nodeCount * sizeof(BVHNode));
+  memcpy(bvh->primIndices.data(), image + header.primIndexOffset,
+         header.primIndexCount * sizeof(uint32_t));
+  memcpy(bvh->triangles.data(), image + header.triangleOffset,
+         header.triangleCount * sizeof(BVHTriangle));
+  bvh->referenceSAHCost = header.referenceSAHCost;
+  bvh->stats = header.stats;
+}
+} // namespace nv_helpers_dx12
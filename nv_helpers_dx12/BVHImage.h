@@ -0,0 +1,97 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The byte image of a hierarchy is the CPU counterpart of the result buffer of
+the GPU builder: a hierarchy is stored in a plain byte arena sized for the worst
+case, after which the space it actually uses can be queried, and the image
+copied into a tightly sized arena.
+
+As for the GPU builder, the worst-case size only depends on the number of
+triangles, and on the number of references added by spatial splits. The nodes,
+primitive indices and triangles are stored at the offsets of the worst-case
+layout, so that the slack left by the builder ends up between the sections. The
+compaction packs the sections and updates their offsets.
+
+Example:
+
+std::vector<uint8_t> arena(nv_helpers_dx12::GetBVHImageMaxSize(triangleCount));
+nv_helpers_dx12::StoreBVHImage(bvh, arena.data(), arena.size());
+
+std::vector<uint8_t> compacted(nv_helpers_dx12::GetBVHImageCompactedSize(arena.data()));
+nv_helpers_dx12::CompactBVHImage(arena.data(), compacted.data());
+arena = std::vector<uint8_t>();
+
+nv_helpers_dx12::BVH loaded;
+nv_helpers_dx12::LoadBVHImage(compacted.data(), &loaded);
+
+*/
+
+#pragma once
+
+#include "BVHBuilder.h"
+
+namespace nv_helpers_dx12
+{
+
+/// Header at the start of the byte image of a hierarchy. The offsets are
+/// relative to the start of the image.
+struct BVHImageHeader
+{
+  /// Size of the image, including the slack between the sections
+  uint64_t sizeInBytes;
+  /// Size of the image once compacted
+  uint64_t compactedSizeInBytes;
+  uint64_t nodeOffset;
+  uint64_t primIndexOffset;
+  uint64_t triangleOffset;
+  uint32_t nodeCount;
+  uint32_t primIndexCount;
+  uint32_t triangleCount;
+  float referenceSAHCost;
+  BVHBuildStats stats;
+};
+
+/// Worst-case size of the image of a hierarchy over the given number of
+/// triangles, that is the size of the arena to pass to StoreBVHImage. The
+/// hierarchies built with spatial splits may reference the triangles more than
+/// once, up to referenceCount references in total.
+uint64_t GetBVHImageMaxSize(uint32_t triangleCount, uint32_t referenceCount = 0);
+
+/// Store a hierarchy in an arena of at least GetBVHImageMaxSize bytes, using
+/// the worst-case layout
+void StoreBVHImage(const BVH& bvh, uint8_t* arena, uint64_t arenaSizeInBytes);
+
+/// Size actually used by the image stored in an arena, that is the size of the
+/// arena to pass to CompactBVHImage
+uint64_t GetBVHImageCompactedSize(const uint8_t* image);
+
+/// Copy an image into an arena of GetBVHImageCompactedSize bytes, packing its
+/// sections. The source arena can then be released.
+void CompactBVHImage(const uint8_t* source, uint8_t* destination);
+
+/// Rebuild a hierarchy from its image, compacted or not
+void LoadBVHImage(const uint8_t* image, BVH* bvh);
+} // namespace nv_helpers_dx12
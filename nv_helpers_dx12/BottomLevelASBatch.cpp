@@ -0,0 +1,228 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Batched construction of bottom-level acceleration structures in shared scratch
+and result buffers. See BottomLevelASBatch.h for details.
+*/
+
+#include "BottomLevelASBatch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Helper to compute aligned buffer sizes
+#ifndef ROUND_UP
+#define ROUND_UP(v, powerOf2Alignment) (((v) + (powerOf2Alignment)-1) & ~((powerOf2Alignment)-1))
+#endif
+
+namespace nv_helpers_dx12
+{
+
+namespace
+{
+// Alignment of the CPU images in the shared arena, matching the alignment of their sections
+const UINT64 kCPUImageAlignment = 16;
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add a bottom-level AS to the batch, returning its index
+uint32_t BottomLevelASBatch::AddBottomLevelAS(const BottomLevelASGenerator& generator)
+{
+  Structure structure;
+  structure.generator = generator;
+  m_structures.push_back(structure);
+  return static_cast<uint32_t>(m_structures.size() - 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Query the sizes of all the structures in parallel, pack their results in a single arena, and
+// group the builds into waves whose scratch memory fits within the budget
+void BottomLevelASBatch::ComputeASBufferSizes(
+    ThreadPool& threadPool,     // Pool on which the sizes are queried
+    ID3D12Device5* device,      // Device on which the builds will be performed
+    UINT64* scratchSizeInBytes, // Size of the scratch pool, that is of the largest wave
+    UINT64* resultSizeInBytes,  // Size of the arena receiving all the structures
+    UINT64 scratchBudgetInBytes, // Scratch memory that concurrent builds may use
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS
+        buildPreference,     // NONE, PREFER_FAST_TRACE or PREFER_FAST_BUILD
+    bool allowCompaction     // If true, the compacted sizes can be emitted by Generate
+)
+{
+  // The prebuild queries are free-threaded, and each task only touches its own generator
+  for (auto& structure : m_structures)
+  {
+    Structure* s = &structure;
+    threadPool.Submit([s, device, buildPreference, allowCompaction]() {
+      s->generator.ComputeASBufferSizes(device, false, &s->scratchSizeInBytes,
+                                        &s->resultSizeInBytes, buildPreference, allowCompaction);
+    });
+  }
+  threadPool.Wait();
+
+  // The structures are packed in the order they were added, the sizes given by the generators
+  // being already aligned on 256 bytes, as required for acceleration structures
+  UINT64 resultOffset = 0;
+  for (auto& structure : m_structures)
+  {
+    structure.resultOffset = resultOffset;
+    resultOffset += structure.resultSizeInBytes;
+  }
+  *resultSizeInBytes = resultOffset;
+
+  // Form the waves by decreasing scratch size, so that each wave gathers builds of similar cost
+  // and the large builds do not leave most of the pool unused
+  std::vector<uint32_t> order(m_structures.size());
+  for (uint32_t i = 0; i < static_cast<uint32_t>(order.size()); i++)
+  {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return m_structures[a].scratchSizeInBytes > m_structures[b].scratchSizeInBytes;
+  });
+
+  m_waves.clear();
+  UINT64 waveSize = 0;
+  UINT64 peakSize = 0;
+  for (uint32_t index : order)
+  {
+    Structure& structure = m_structures[index];
+    if (m_waves.empty() || waveSize + structure.scratchSizeInBytes > scratchBudgetInBytes)
+    {
+      m_waves.emplace_back();
+      waveSize = 0;
+    }
+    structure.scratchOffset = waveSize;
+    waveSize += structure.scratchSizeInBytes;
+    m_waves.back().push_back(index);
+    peakSize = (std::max)(peakSize, waveSize);
+  }
+  *scratchSizeInBytes = peakSize;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Enqueue the builds of all the structures wave by wave. The builds of a wave run concurrently in
+// disjoint ranges of the scratch pool, and a barrier is set before the next wave reuses it.
+void BottomLevelASBatch::Generate(
+    ID3D12GraphicsCommandList4* commandList, // Command list on which the builds are enqueued
+    ID3D12Resource* scratchPool,             // Scratch buffer shared by the builds of a wave
+    ID3D12Resource* resultArena,             // Result buffer receiving all the structures
+    D3D12_GPU_VIRTUAL_ADDRESS compactedSizesAddress // Optional array of compacted sizes
+)
+{
+  if (m_waves.empty() && !m_structures.empty())
+  {
+    throw std::logic_error("ComputeASBufferSizes needs to be called before Generate");
+  }
+
+  D3D12_GPU_VIRTUAL_ADDRESS scratchAddress = scratchPool->GetGPUVirtualAddress();
+  D3D12_GPU_VIRTUAL_ADDRESS resultAddress = resultArena->GetGPUVirtualAddress();
+
+  D3D12_RESOURCE_BARRIER uavBarriers[2];
+  uavBarriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+  uavBarriers[0].UAV.pResource = scratchPool;
+  uavBarriers[0].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+  uavBarriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+  uavBarriers[1].UAV.pResource = resultArena;
+  uavBarriers[1].Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+
+  for (size_t w = 0; w < m_waves.size(); w++)
+  {
+    for (uint32_t index : m_waves[w])
+    {
+      Structure& structure = m_structures[index];
+      structure.generator.Build(
+          commandList, scratchAddress + structure.scratchOffset,
+          resultAddress + structure.resultOffset, false, 0,
+          compactedSizesAddress != 0 ? compactedSizesAddress + index * sizeof(UINT64) : 0);
+    }
+    // The scratch pool is reused by the next wave, while the result arena has to be complete
+    // before a top-level AS references it
+    bool lastWave = w + 1 == m_waves.size();
+    commandList->ResourceBarrier(lastWave ? 1 : 2, lastWave ? &uavBarriers[1] : uavBarriers);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Size of the byte arena receiving the CPU hierarchies of all the structures, each image being
+// placed at its worst-case offset before packing
+UINT64 BottomLevelASBatch::ComputeCPUResultMaxSize(const BVHBuilder& builder)
+{
+  UINT64 offset = 0;
+  for (auto& structure : m_structures)
+  {
+    structure.cpuResultMaxSize = structure.generator.ComputeCPUResultMaxSize(builder);
+    structure.cpuResultOffset = offset;
+    offset += ROUND_UP(structure.cpuResultMaxSize, kCPUImageAlignment);
+  }
+  return offset;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build all the structures on the CPU in parallel, each at its worst-case offset, then move the
+// compacted images towards the beginning of the arena. Since each image is moved to an offset no
+// larger than its original one, the images can be packed in place in increasing order.
+UINT64 BottomLevelASBatch::GenerateOnCPU(ThreadPool& threadPool, uint8_t* resultArena,
+                                         UINT64 resultSizeInBytes, const BVHBuilder& builder)
+{
+  if (ComputeCPUResultMaxSize(builder) > resultSizeInBytes)
+  {
+    throw std::logic_error("The arena is too small for the CPU hierarchies of the batch");
+  }
+
+  // Nested parallelism would only oversubscribe the cores
+  BVHBuilder taskBuilder = builder;
+  taskBuilder.SetThreadCount(1);
+
+  std::vector<UINT64> compactedSizes(m_structures.size());
+  for (size_t i = 0; i < m_structures.size(); i++)
+  {
+    Structure* s = &m_structures[i];
+    UINT64* compactedSize = &compactedSizes[i];
+    const BVHBuilder* b = &taskBuilder;
+    threadPool.Submit([s, compactedSize, b, resultArena]() {
+      s->generator.GenerateOnCPU(resultArena + s->cpuResultOffset, s->cpuResultMaxSize,
+                                 compactedSize, *b);
+    });
+  }
+  threadPool.Wait();
+
+  UINT64 packedOffset = 0;
+  for (size_t i = 0; i < m_structures.size(); i++)
+  {
+    Structure& structure = m_structures[i];
+    CompactBVHImage(resultArena + structure.cpuResultOffset, resultArena + packedOffset);
+    structure.cpuResultOffset = packedOffset;
+    packedOffset += ROUND_UP(compactedSizes[i], kCPUImageAlignment);
+  }
+  return packedOffset;
+}
+} // namespace nv_helpers_dx12
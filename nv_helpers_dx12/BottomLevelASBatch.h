@@ -0,0 +1,160 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Batch of bottom-level acceleration structures built together, typically when
+loading a scene made of many meshes. Instead of allocating a scratch and a
+result buffer per structure and serializing the builds with barriers, the batch
+uses:
+- a single result arena, in which each structure occupies a 256-byte aligned
+range,
+- a single scratch pool, shared by waves of concurrent builds. The builds of a
+wave use disjoint ranges of the pool and are only followed by one barrier, after
+which the next wave reuses the pool. The waves are formed so that their scratch
+memory fits within a budget, and the pool is sized for the largest wave.
+The sizes of the structures are queried in parallel on a thread pool, as are the
+builds of the batch on the CPU, whose images are then packed into a single byte
+arena.
+
+Example:
+
+nv_helpers_dx12::ThreadPool threadPool;
+nv_helpers_dx12::BottomLevelASBatch batch;
+for (auto& mesh : meshes)
+{
+  nv_helpers_dx12::BottomLevelASGenerator generator;
+  generator.AddVertexBuffer(mesh.vertexBuffer, 0, mesh.vertexCount, sizeof(Vertex), nullptr, 0);
+  batch.AddBottomLevelAS(generator);
+}
+
+UINT64 scratchSizeInBytes = 0;
+UINT64 resultSizeInBytes = 0;
+batch.ComputeASBufferSizes(threadPool, GetRTDevice(), &scratchSizeInBytes, &resultSizeInBytes);
+scratchPool = nv_helpers_dx12::CreateBuffer(..., scratchSizeInBytes, ...);
+resultArena = nv_helpers_dx12::CreateBuffer(..., resultSizeInBytes, ...);
+batch.Generate(m_commandList.Get(), scratchPool.Get(), resultArena.Get());
+
+topLevelAS.AddInstance(resultArena->GetGPUVirtualAddress() + batch.GetResultOffset(i), ...);
+
+*/
+
+#pragma once
+
+#include "BottomLevelASGenerator.h"
+#include "ThreadPool.h"
+
+#include <vector>
+
+namespace nv_helpers_dx12
+{
+
+/// Builds many bottom-level acceleration structures into shared scratch and result buffers
+class BottomLevelASBatch
+{
+public:
+  /// Default amount of scratch memory shared by concurrent builds
+  static const UINT64 kDefaultScratchBudget = 64ull * 1024 * 1024;
+
+  /// Add a bottom-level AS to the batch, returning its index. The generator is copied, but the
+  /// geometry it references must remain valid until the build.
+  uint32_t AddBottomLevelAS(const BottomLevelASGenerator& generator);
+
+  /// Number of bottom-level AS in the batch
+  uint32_t GetCount() const { return static_cast<uint32_t>(m_structures.size()); }
+
+  /// Query the sizes of all the structures in parallel, pack their results in a single arena, and
+  /// group the builds into waves whose scratch memory fits within the budget. A structure
+  /// requiring more scratch memory than the budget is built in a wave of its own.
+  void ComputeASBufferSizes(
+      ThreadPool& threadPool,     /// Pool on which the sizes are queried
+      ID3D12Device5* device,      /// Device on which the builds will be performed
+      UINT64* scratchSizeInBytes, /// Size of the scratch pool, that is of the largest wave
+      UINT64* resultSizeInBytes,  /// Size of the arena receiving all the structures
+      UINT64 scratchBudgetInBytes = kDefaultScratchBudget, /// Scratch memory that concurrent
+                                                           /// builds may use
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildPreference =
+          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE,
+      /// NONE, PREFER_FAST_TRACE or PREFER_FAST_BUILD
+      bool allowCompaction = false /// If true, the compacted sizes can be emitted by Generate
+  );
+
+  /// Enqueue the builds of all the structures, wave by wave, with a UAV barrier between waves so
+  /// that the scratch pool can be reused. A barrier on the result arena is set after the last
+  /// wave, so that a top-level AS can be built right afterwards.
+  void Generate(
+      ID3D12GraphicsCommandList4* commandList, /// Command list on which the builds are enqueued
+      ID3D12Resource* scratchPool, /// Scratch buffer of the size given by ComputeASBufferSizes
+      ID3D12Resource* resultArena, /// Result buffer of the size given by ComputeASBufferSizes
+      D3D12_GPU_VIRTUAL_ADDRESS compactedSizesAddress = 0 /// Optional address of an array of
+                                                          /// 8 bytes per structure, receiving
+                                                          /// their compacted sizes
+  );
+
+  /// Offset of a structure in the result arena
+  UINT64 GetResultOffset(uint32_t index) const { return m_structures[index].resultOffset; }
+
+  /// Worst-case size of a structure, as given by the device
+  UINT64 GetResultSize(uint32_t index) const { return m_structures[index].resultSizeInBytes; }
+
+  /// Number of waves of concurrent builds enqueued by Generate
+  uint32_t GetWaveCount() const { return static_cast<uint32_t>(m_waves.size()); }
+
+  /// Size of the byte arena receiving the CPU hierarchies of all the structures, before packing
+  UINT64 ComputeCPUResultMaxSize(const BVHBuilder& builder = BVHBuilder());
+
+  /// Build all the structures on the CPU in parallel, and pack their compacted images at the
+  /// beginning of the arena. The builder runs single-threaded within each task, the parallelism
+  /// coming from the pool. Returns the size of the packed images.
+  UINT64 GenerateOnCPU(ThreadPool& threadPool, /// Pool on which the builds are run
+                       uint8_t* resultArena,   /// Arena receiving the images
+                       UINT64 resultSizeInBytes, /// Size of the arena, at least
+                                                 /// ComputeCPUResultMaxSize
+                       const BVHBuilder& builder = BVHBuilder() /// Builder and its settings
+  );
+
+  /// Offset of the packed image of a structure in the CPU arena, see LoadBVHImage
+  UINT64 GetCPUResultOffset(uint32_t index) const { return m_structures[index].cpuResultOffset; }
+
+private:
+  /// Structure of the batch and its location in the shared buffers
+  struct Structure
+  {
+    BottomLevelASGenerator generator;
+    UINT64 scratchSizeInBytes = 0;
+    UINT64 resultSizeInBytes = 0;
+    /// Offset of the structure in the result arena
+    UINT64 resultOffset = 0;
+    /// Offset of the scratch memory of the structure in the pool, within its wave
+    UINT64 scratchOffset = 0;
+    /// Worst-case size and offset of the CPU image, then offset once packed
+    UINT64 cpuResultMaxSize = 0;
+    UINT64 cpuResultOffset = 0;
+  };
+
+  std::vector<Structure> m_structures;
+  /// Indices of the structures built concurrently, wave by wave
+  std::vector<std::vector<uint32_t>> m_waves;
+};
+} // namespace nv_helpers_dx12
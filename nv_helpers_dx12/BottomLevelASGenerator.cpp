@@ -31,6 +31,11 @@ Contacts for feedback:
 
 #include "BottomLevelASGenerator.h"
 
+#include "ASSizeEstimator.h"
+
+#include <cstring>
+#include <stdexcept>
+
 // Helper to compute aligned buffer sizes
 #ifndef ROUND_UP
 #define ROUND_UP(v, powerOf2Alignment)                                         \
@@ -39,9 +44,130 @@ Contacts for feedback:
 
 namespace nv_helpers_dx12 {
 
+namespace {
+// Convert an IEEE 754 half-precision value to a float
+float HalfToFloat(uint16_t value) {
+  uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1F;
+  uint32_t mantissa = value & 0x3FF;
+  uint32_t bits;
+  if (exponent == 0x1F) {
+    // Infinity or NaN
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    // Denormalized half, normalized as a float
+    exponent = 113;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+  }
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// Decode a vertex position stored in one of the formats accepted by
+// GetVertexFormatSize. The data is read byte-wise, as interleaved vertices
+// only guarantee the alignment of a component
+void DecodePosition(const uint8_t *vertex, DXGI_FORMAT format,
+                    float position[3]) {
+  position[2] = 0.f;
+  switch (format) {
+  case DXGI_FORMAT_R32G32B32_FLOAT:
+    std::memcpy(position, vertex, 3 * sizeof(float));
+    break;
+  case DXGI_FORMAT_R32G32_FLOAT:
+    std::memcpy(position, vertex, 2 * sizeof(float));
+    break;
+  case DXGI_FORMAT_R16G16B16A16_FLOAT:
+  case DXGI_FORMAT_R16G16_FLOAT: {
+    int componentCount = format == DXGI_FORMAT_R16G16_FLOAT ? 2 : 3;
+    for (int c = 0; c < componentCount; c++) {
+      uint16_t half;
+      std::memcpy(&half, vertex + c * sizeof(half), sizeof(half));
+      position[c] = HalfToFloat(half);
+    }
+    break;
+  }
+  case DXGI_FORMAT_R16G16B16A16_SNORM:
+  case DXGI_FORMAT_R16G16_SNORM: {
+    int componentCount = format == DXGI_FORMAT_R16G16_SNORM ? 2 : 3;
+    for (int c = 0; c < componentCount; c++) {
+      int16_t snorm;
+      std::memcpy(&snorm, vertex + c * sizeof(snorm), sizeof(snorm));
+      // -32768 and -32767 both map to -1, as specified by D3D
+      float value = static_cast<float>(snorm) / 32767.f;
+      position[c] = value < -1.f ? -1.f : value;
+    }
+    break;
+  }
+  default:
+    throw std::logic_error("Unsupported vertex format");
+  }
+}
+
+// Read an index stored as a 16- or 32-bit unsigned int
+uint32_t ReadIndex(const uint8_t *indices, DXGI_FORMAT format, uint32_t i) {
+  if (format == DXGI_FORMAT_R16_UINT) {
+    uint16_t index;
+    std::memcpy(&index, indices + i * sizeof(index), sizeof(index));
+    return index;
+  }
+  uint32_t index;
+  std::memcpy(&index, indices + i * sizeof(index), sizeof(index));
+  return index;
+}
+
+// Transform a position by a 3x4 row-major matrix, as in Transform3x4
+void TransformPosition(const float *transform, const float position[3],
+                       float *result) {
+  for (int axis = 0; axis < 3; axis++) {
+    result[axis] = transform ? transform[4 * axis + 0] * position[0] +
+                                   transform[4 * axis + 1] * position[1] +
+                                   transform[4 * axis + 2] * position[2] +
+                                   transform[4 * axis + 3]
+                             : position[axis];
+  }
+}
+
+// Hash a block of memory 8 bytes at a time, mixing each word with the
+// multiply and rotate steps of MurmurHash64A
+uint64_t HashBytes(const void *data, size_t sizeInBytes, uint64_t seed) {
+  const uint64_t m = 0xC6A4A7935BD1E995ull;
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = seed ^ (sizeInBytes * m);
+  size_t i = 0;
+  for (; i + 8 <= sizeInBytes; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    word *= m;
+    word ^= word >> 47;
+    word *= m;
+    hash ^= word;
+    hash *= m;
+  }
+  if (i < sizeInBytes) {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes + i, sizeInBytes - i);
+    hash ^= word;
+    hash *= m;
+  }
+  hash ^= hash >> 47;
+  hash *= m;
+  hash ^= hash >> 47;
+  return hash;
+}
+} // namespace
+
 //--------------------------------------------------------------------------------------------------
 // Add a vertex buffer in GPU memory into the acceleration structure. The
-// vertices are supposed to be represented by 3 float32 value
+// vertices are represented by 3 float32 values unless specified otherwise
 void BottomLevelASGenerator::AddVertexBuffer(
     ID3D12Resource *vertexBuffer, // Buffer containing the vertex coordinates,
                                   // possibly interleaved with other vertex data
@@ -55,22 +181,28 @@ void BottomLevelASGenerator::AddVertexBuffer(
                                      // vertices. This buffer cannot be nullptr
     UINT64 transformOffsetInBytes,   // Offset of the transform matrix in the
                                      // transform buffer
-    bool isOpaque /* = true */ // If true, the geometry is considered opaque,
-                               // optimizing the search for a closest hit
+    bool isOpaque /* = true */, // If true, the geometry is considered opaque,
+                                // optimizing the search for a closest hit
+    bool allowSpatialSplits /* = false */, // If true, the CPU builder may
+                                           // split the triangles of this
+                                           // geometry across leaves
+    DXGI_FORMAT vertexFormat /* = DXGI_FORMAT_R32G32B32_FLOAT */ // Format of
+                                                                 // the vertex
+                                                                 // positions
 ) {
   AddVertexBuffer(vertexBuffer, vertexOffsetInBytes, vertexCount,
                   vertexSizeInBytes, nullptr, 0, 0, transformBuffer,
-                  transformOffsetInBytes, isOpaque);
+                  transformOffsetInBytes, isOpaque, allowSpatialSplits,
+                  vertexFormat, DXGI_FORMAT_R32_UINT);
 }
 
 //--------------------------------------------------------------------------------------------------
 // Add a vertex buffer along with its index buffer in GPU memory into the
-// acceleration structure. The vertices are supposed to be represented by 3
-// float32 value. This implementation limits the original flexibility of the
-// API:
+// acceleration structure. This implementation limits the original flexibility
+// of the API:
 //   - triangles (no custom intersector support)
-//   - 3xfloat32 format
-//   - 32-bit indices
+//   - float32, float16 and snorm16 positions, see GetVertexFormatSize
+//   - 16- and 32-bit indices
 void BottomLevelASGenerator::AddVertexBuffer(
     ID3D12Resource *vertexBuffer, // Buffer containing the vertex coordinates,
                                   // possibly interleaved with other vertex data
@@ -88,23 +220,33 @@ void BottomLevelASGenerator::AddVertexBuffer(
                                      // vertices. This buffer cannot be nullptr
     UINT64 transformOffsetInBytes,   // Offset of the transform matrix in the
                                      // transform buffer
-    bool isOpaque /* = true */ // If true, the geometry is considered opaque,
-                               // optimizing the search for a closest hit
+    bool isOpaque /* = true */, // If true, the geometry is considered opaque,
+                                // optimizing the search for a closest hit
+    bool allowSpatialSplits /* = false */, // If true, the CPU builder may
+                                           // split the triangles of this
+                                           // geometry across leaves
+    DXGI_FORMAT vertexFormat /* = DXGI_FORMAT_R32G32B32_FLOAT */, // Format of
+                                                                  // the vertex
+                                                                  // positions
+    DXGI_FORMAT indexFormat /* = DXGI_FORMAT_R32_UINT */ // Either R32_UINT or
+                                                         // R16_UINT
 ) {
+  ValidateFormats(vertexFormat, vertexSizeInBytes, indexFormat);
+
   // Create the DX12 descriptor representing the input data, assumed to be
-  // opaque triangles, with 3xf32 vertex coordinates and 32-bit indices
+  // triangles
   D3D12_RAYTRACING_GEOMETRY_DESC descriptor = {};
   descriptor.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
   descriptor.Triangles.VertexBuffer.StartAddress =
       vertexBuffer->GetGPUVirtualAddress() + vertexOffsetInBytes;
   descriptor.Triangles.VertexBuffer.StrideInBytes = vertexSizeInBytes;
   descriptor.Triangles.VertexCount = vertexCount;
-  descriptor.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+  descriptor.Triangles.VertexFormat = vertexFormat;
   descriptor.Triangles.IndexBuffer =
       indexBuffer ? (indexBuffer->GetGPUVirtualAddress() + indexOffsetInBytes)
                   : 0;
   descriptor.Triangles.IndexFormat =
-      indexBuffer ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_UNKNOWN;
+      indexBuffer ? indexFormat : DXGI_FORMAT_UNKNOWN;
   descriptor.Triangles.IndexCount = indexCount;
   descriptor.Triangles.Transform3x4 =
       transformBuffer
@@ -114,6 +256,123 @@ void BottomLevelASGenerator::AddVertexBuffer(
                               : D3D12_RAYTRACING_GEOMETRY_FLAG_NONE;
 
   m_vertexBuffers.push_back(descriptor);
+
+  // Keep track of the resources so that the CPU builders can map them
+  GeometrySource source;
+  source.vertexBuffer = vertexBuffer;
+  source.vertexOffsetInBytes = vertexOffsetInBytes;
+  source.indexBuffer = indexBuffer;
+  source.indexOffsetInBytes = indexOffsetInBytes;
+  source.transformBuffer = transformBuffer;
+  source.transformOffsetInBytes = transformOffsetInBytes;
+  source.allowSpatialSplits = allowSpatialSplits;
+  m_geometrySources.push_back(source);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Add a vertex buffer in CPU memory, along with its optional index buffer. The
+// descriptor is recorded with null GPU addresses, so that the prebuild sizes
+// can still be queried, but such geometry can only be built on the CPU
+void BottomLevelASGenerator::AddVertexBuffer(
+    const void *vertexData, // Vertex coordinates, possibly interleaved with
+                            // other vertex data
+    uint32_t vertexCount,   // Number of vertices to consider in the buffer
+    UINT vertexSizeInBytes, // Size of a vertex including all its other data,
+                            // used to stride in the buffer
+    const void *indexData,  // Vertex indices describing the triangles, or
+                            // nullptr for non-indexed geometry
+    uint32_t indexCount,    // Number of indices to consider in the buffer
+    const float *transform /* = nullptr */, // Optional 3x4 row-major
+                                            // transform matrix
+    bool isOpaque /* = true */, // If true, the geometry is considered opaque,
+                                // optimizing the search for a closest hit
+    bool allowSpatialSplits /* = false */, // If true, the CPU builder may
+                                           // split the triangles of this
+                                           // geometry across leaves
+    DXGI_FORMAT vertexFormat /* = DXGI_FORMAT_R32G32B32_FLOAT */, // Format of
+                                                                  // the vertex
+                                                                  // positions
+    DXGI_FORMAT indexFormat /* = DXGI_FORMAT_R32_UINT */ // Either R32_UINT or
+                                                         // R16_UINT
+) {
+  ValidateFormats(vertexFormat, vertexSizeInBytes, indexFormat);
+
+  D3D12_RAYTRACING_GEOMETRY_DESC descriptor = {};
+  descriptor.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+  descriptor.Triangles.VertexBuffer.StrideInBytes = vertexSizeInBytes;
+  descriptor.Triangles.VertexCount = vertexCount;
+  descriptor.Triangles.VertexFormat = vertexFormat;
+  descriptor.Triangles.IndexFormat =
+      indexData ? indexFormat : DXGI_FORMAT_UNKNOWN;
+  descriptor.Triangles.IndexCount = indexData ? indexCount : 0;
+  descriptor.Flags = isOpaque ? D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE
+                              : D3D12_RAYTRACING_GEOMETRY_FLAG_NONE;
+
+  m_vertexBuffers.push_back(descriptor);
+
+  GeometrySource source;
+  source.vertexData = vertexData;
+  source.indexData = indexData;
+  source.transform = transform;
+  source.allowSpatialSplits = allowSpatialSplits;
+  m_geometrySources.push_back(source);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Size in bytes of a vertex position stored in the given format. Only the
+// formats that can be decoded by the CPU builder are accepted
+UINT BottomLevelASGenerator::GetVertexFormatSize(
+    DXGI_FORMAT vertexFormat,   // Format of the vertex positions
+    UINT *componentSizeInBytes // Optional size of one component
+) {
+  UINT componentSize = 0;
+  UINT componentCount = 0;
+  switch (vertexFormat) {
+  case DXGI_FORMAT_R32G32B32_FLOAT:
+    componentSize = 4;
+    componentCount = 3;
+    break;
+  case DXGI_FORMAT_R32G32_FLOAT:
+    componentSize = 4;
+    componentCount = 2;
+    break;
+  case DXGI_FORMAT_R16G16B16A16_FLOAT:
+  case DXGI_FORMAT_R16G16B16A16_SNORM:
+    componentSize = 2;
+    componentCount = 4;
+    break;
+  case DXGI_FORMAT_R16G16_FLOAT:
+  case DXGI_FORMAT_R16G16_SNORM:
+    componentSize = 2;
+    componentCount = 2;
+    break;
+  default:
+    throw std::logic_error("Unsupported vertex format");
+  }
+  if (componentSizeInBytes) {
+    *componentSizeInBytes = componentSize;
+  }
+  return componentSize * componentCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Check the formats and stride of a geometry before recording it. The stride
+// must hold at least one position, and keep the components aligned as
+// required by the API
+void BottomLevelASGenerator::ValidateFormats(DXGI_FORMAT vertexFormat,
+                                             UINT vertexSizeInBytes,
+                                             DXGI_FORMAT indexFormat) {
+  UINT componentSize = 0;
+  UINT positionSize = GetVertexFormatSize(vertexFormat, &componentSize);
+  if (vertexSizeInBytes < positionSize ||
+      vertexSizeInBytes % componentSize != 0) {
+    throw std::logic_error("The vertex stride must hold a position and be a "
+                           "multiple of the size of its components");
+  }
+  if (indexFormat != DXGI_FORMAT_R32_UINT &&
+      indexFormat != DXGI_FORMAT_R16_UINT) {
+    throw std::logic_error("Unsupported index format");
+  }
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -126,16 +385,38 @@ void BottomLevelASGenerator::ComputeASBufferSizes(
                           // allow iterative updates
     UINT64 *scratchSizeInBytes, // Required scratch memory on the GPU to build
                                 // the acceleration structure
-    UINT64 *resultSizeInBytes   // Required GPU memory to store the acceleration
+    UINT64 *resultSizeInBytes,  // Required GPU memory to store the acceleration
                                 // structure
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS
+        buildPreference,   // NONE, PREFER_FAST_TRACE or PREFER_FAST_BUILD
+    bool allowCompaction // If true, the resulting acceleration structure can
+                         // be compacted after the build
 ) {
+  // NONE leaves the trade-off to the driver, and selects the SAH builder on the
+  // CPU side as PREFER_FAST_TRACE does
+  if (buildPreference !=
+          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE &&
+      buildPreference !=
+          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE &&
+      buildPreference !=
+          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD) {
+    throw std::logic_error("The build preference of a bottom-level AS must be "
+                           "NONE, PREFER_FAST_TRACE or PREFER_FAST_BUILD");
+  }
+
   // The generated AS can support iterative updates. This may change the final
   // size of the AS as well as the temporary memory requirements, and hence has
-  // to be set before the actual build
+  // to be set before the actual build. The same goes for the trade-off between
+  // build and trace performance.
   m_flags =
       allowUpdate
           ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
           : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+  m_flags |= buildPreference;
+  if (allowCompaction) {
+    m_flags |=
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+  }
 
   // Describe the work being requested, in this case the construction of a
   // (possibly dynamic) bottom-level hierarchy, with the given vertex buffers
@@ -154,8 +435,15 @@ void BottomLevelASGenerator::ComputeASBufferSizes(
   // Building the acceleration structure (AS) requires some scratch space, as
   // well as space to store the resulting structure This function computes a
   // conservative estimate of the memory requirements for both, based on the
-  // geometry size.
-  device->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildDesc, &info);
+  // geometry size. Without a device, the sizes are estimated from the same
+  // inputs
+  if (device) {
+    device->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildDesc, &info);
+  } else {
+    info = EstimateBottomLevelASPrebuildInfo(
+        GetTriangleCount(), static_cast<uint32_t>(m_vertexBuffers.size()),
+        m_flags);
+  }
 
   // Buffer sizes need to be 256-byte-aligned
   *scratchSizeInBytes =
@@ -183,29 +471,66 @@ void BottomLevelASGenerator::Generate(
         *resultBuffer, // Result buffer storing the acceleration structure
     bool updateOnly,   // If true, simply refit the existing
                        // acceleration structure
-    ID3D12Resource *previousResult // Optional previous acceleration
-                                   // structure, used if an iterative update
-                                   // is requested
+    ID3D12Resource *previousResult, // Optional previous acceleration
+                                    // structure, used if an iterative update
+                                    // is requested
+    D3D12_GPU_VIRTUAL_ADDRESS
+        compactedSizeAddress // Optional address receiving the compacted size
+                             // of the acceleration structure
 ) {
+  Build(commandList, scratchBuffer->GetGPUVirtualAddress(),
+        resultBuffer->GetGPUVirtualAddress(), updateOnly,
+        previousResult ? previousResult->GetGPUVirtualAddress() : 0,
+        compactedSizeAddress);
+
+  // Wait for the builder to complete by setting a barrier on the resulting
+  // buffer. This is particularly important as the construction of the top-level
+  // hierarchy may be called right afterwards, before executing the command
+  // list.
+  D3D12_RESOURCE_BARRIER uavBarrier;
+  uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+  uavBarrier.UAV.pResource = resultBuffer;
+  uavBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+  commandList->ResourceBarrier(1, &uavBarrier);
+}
 
+//--------------------------------------------------------------------------------------------------
+// Enqueue the construction of the acceleration structure at the given
+// addresses, without any barrier. Builds using disjoint scratch and result
+// ranges can then run concurrently, the application being responsible for
+// synchronizing them
+void BottomLevelASGenerator::Build(
+    ID3D12GraphicsCommandList4
+        *commandList, // Command list on which the build will be enqueued
+    D3D12_GPU_VIRTUAL_ADDRESS scratchAddress, // Address of the scratch memory
+    D3D12_GPU_VIRTUAL_ADDRESS resultAddress,  // Address of the resulting
+                                              // acceleration structure
+    bool updateOnly, // If true, simply refit the existing acceleration
+                     // structure
+    D3D12_GPU_VIRTUAL_ADDRESS previousResult, // Optional address of the
+                                              // previous acceleration
+                                              // structure
+    D3D12_GPU_VIRTUAL_ADDRESS
+        compactedSizeAddress // Optional address receiving the compacted size
+                             // of the acceleration structure
+) {
   D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = m_flags;
+  bool allowUpdate =
+      (m_flags &
+       D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) != 0;
   // The stored flags represent whether the AS has been built for updates or
   // not. If yes and an update is requested, the builder is told to only update
   // the AS instead of fully rebuilding it
-  if (flags ==
-          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE &&
-      updateOnly) {
-    flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+  if (allowUpdate && updateOnly) {
+    flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
   }
 
   // Sanity checks
-  if (m_flags !=
-          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE &&
-      updateOnly) {
+  if (!allowUpdate && updateOnly) {
     throw std::logic_error(
         "Cannot update a bottom-level AS not originally built for updates");
   }
-  if (updateOnly && previousResult == nullptr) {
+  if (updateOnly && previousResult == 0) {
     throw std::logic_error(
         "Bottom-level hierarchy update requires the previous hierarchy");
   }
@@ -215,6 +540,19 @@ void BottomLevelASGenerator::Generate(
         "Invalid scratch and result buffer sizes - ComputeASBufferSizes needs "
         "to be called before Build");
   }
+  if (compactedSizeAddress != 0 &&
+      (m_flags &
+       D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION) ==
+          0) {
+    throw std::logic_error("Cannot query the compacted size of a bottom-level "
+                           "AS not built with compaction allowed");
+  }
+  for (const auto &source : m_geometrySources) {
+    if (source.vertexBuffer == nullptr) {
+      throw std::logic_error("Geometry added from CPU memory can only be "
+                             "built using GenerateOnCPU");
+    }
+  }
   // Create a descriptor of the requested builder work, to generate a
   // bottom-level AS from the input parameters
   D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc;
@@ -222,25 +560,301 @@ void BottomLevelASGenerator::Generate(
   buildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
   buildDesc.Inputs.NumDescs = static_cast<UINT>(m_vertexBuffers.size());
   buildDesc.Inputs.pGeometryDescs = m_vertexBuffers.data();
-  buildDesc.DestAccelerationStructureData = {
-      resultBuffer->GetGPUVirtualAddress()};
-  buildDesc.ScratchAccelerationStructureData = {
-      scratchBuffer->GetGPUVirtualAddress()};
-  buildDesc.SourceAccelerationStructureData =
-      previousResult ? previousResult->GetGPUVirtualAddress() : 0;
+  buildDesc.DestAccelerationStructureData = {resultAddress};
+  buildDesc.ScratchAccelerationStructureData = {scratchAddress};
+  buildDesc.SourceAccelerationStructureData = previousResult;
   buildDesc.Inputs.Flags = flags;
 
+  // The compacted size is only known once the build is complete, and is
+  // written by the GPU to the application-provided address
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc;
+  postbuildDesc.DestBuffer = compactedSizeAddress;
+  postbuildDesc.InfoType =
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+
   // Build the AS
-  commandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
+  commandList->BuildRaytracingAccelerationStructure(
+      &buildDesc, compactedSizeAddress != 0 ? 1 : 0,
+      compactedSizeAddress != 0 ? &postbuildDesc : nullptr);
+}
 
-  // Wait for the builder to complete by setting a barrier on the resulting
-  // buffer. This is particularly important as the construction of the top-level
-  // hierarchy may be called right afterwards, before executing the command
-  // list.
+//--------------------------------------------------------------------------------------------------
+// Enqueue the copy of an acceleration structure built with compaction allowed
+// into a buffer of the size emitted by Generate. The copy only contains the
+// data actually used by the structure, so that the oversized source buffer can
+// be released once the command list is executed.
+void BottomLevelASGenerator::Compact(
+    ID3D12GraphicsCommandList4
+        *commandList,             // Command list on which the copy will be enqueued
+    ID3D12Resource *sourceBuffer, // Buffer storing the acceleration structure
+    ID3D12Resource
+        *compactedBuffer // Buffer of the compacted size, receiving the
+                         // structure
+) {
+  commandList->CopyRaytracingAccelerationStructure(
+      compactedBuffer->GetGPUVirtualAddress(),
+      sourceBuffer->GetGPUVirtualAddress(),
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+
+  // As for the build, the compacted structure may be referenced by a
+  // top-level AS built right afterwards
   D3D12_RESOURCE_BARRIER uavBarrier;
   uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-  uavBarrier.UAV.pResource = resultBuffer;
+  uavBarrier.UAV.pResource = compactedBuffer;
   uavBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
   commandList->ResourceBarrier(1, &uavBarrier);
 }
+
+//--------------------------------------------------------------------------------------------------
+// Build the acceleration structure on the CPU, using the same geometry as the
+// GPU build. The triangles are first fetched into a flat list, which is then
+// handed over to the builder matching the build preference, or used to refit
+// the previous hierarchy
+void BottomLevelASGenerator::GenerateOnCPU(
+    BVH *result,              // Hierarchy built from the geometry, or the
+                              // previous hierarchy to refit in place
+    bool updateOnly,          // If true, simply refit the existing hierarchy
+    const BVHBuilder &builder // Builder and its settings
+) {
+  if (updateOnly && result->nodes.empty()) {
+    throw std::logic_error(
+        "Bottom-level hierarchy update requires the previous hierarchy");
+  }
+
+  // Spatial splits are selected per geometry, and only used by the SAH builder
+  std::vector<bool> splittableGeometries(m_geometrySources.size());
+  bool allowSpatialSplits = false;
+  for (size_t g = 0; g < m_geometrySources.size(); g++) {
+    splittableGeometries[g] = m_geometrySources[g].allowSpatialSplits;
+    allowSpatialSplits |= splittableGeometries[g];
+  }
+
+  std::vector<BVHTriangle> triangles;
+  GatherTriangles(&triangles);
+  if (updateOnly) {
+    builder.Refit(std::move(triangles), result);
+  } else if (m_flags &
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD) {
+    builder.BuildLBVH(std::move(triangles), result);
+  } else if (allowSpatialSplits) {
+    builder.BuildSBVH(std::move(triangles), result, splittableGeometries);
+  } else {
+    builder.BuildSAH(std::move(triangles), result);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Worst-case size of the CPU hierarchy, which only depends on the number of
+// triangles, as for the GPU builder, and on the number of references the
+// spatial splits may add
+UINT64 BottomLevelASGenerator::ComputeCPUResultMaxSize(
+    const BVHBuilder &builder // Builder and its settings
+) const {
+  uint32_t triangleCount = GetTriangleCount();
+  uint32_t splittableCount = 0;
+  for (size_t g = 0; g < m_vertexBuffers.size(); g++) {
+    if (m_geometrySources[g].allowSpatialSplits) {
+      const D3D12_RAYTRACING_GEOMETRY_TRIANGLES_DESC &desc =
+          m_vertexBuffers[g].Triangles;
+      splittableCount +=
+          (desc.IndexCount != 0 ? desc.IndexCount : desc.VertexCount) / 3;
+    }
+  }
+  auto addedRefCount = static_cast<uint32_t>(
+      builder.GetSpatialSplitBudget() * static_cast<float>(splittableCount));
+  return GetBVHImageMaxSize(triangleCount, triangleCount + addedRefCount);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Build the acceleration structure on the CPU, and store its image in an arena
+// sized for the worst case. The size of the compacted image is returned, as
+// the GPU builder emits it after the build
+void BottomLevelASGenerator::GenerateOnCPU(
+    uint8_t *resultArena,         // Arena receiving the image of the hierarchy
+    UINT64 resultSizeInBytes,     // Size of the arena
+    UINT64 *compactedSizeInBytes, // Size of the compacted image
+    const BVHBuilder &builder     // Builder and its settings
+) {
+  BVH bvh;
+  GenerateOnCPU(&bvh, false, builder);
+  StoreBVHImage(bvh, resultArena, resultSizeInBytes);
+  *compactedSizeInBytes = GetBVHImageCompactedSize(resultArena);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Build the acceleration structure on the CPU, and encode it as a compressed
+// 8-wide hierarchy. The intermediate binary and wide hierarchies are discarded.
+// The triangles are not compressed, and are reported separately so that the
+// node compression is not hidden by their size
+void BottomLevelASGenerator::GenerateCompressedOnCPU(
+    CompressedBVH *result,         // Compressed hierarchy built from the geometry
+    UINT64 *compressedSizeInBytes, // Memory used by the compressed nodes and
+                                   // primitive indices
+    UINT64 *triangleSizeInBytes,   // Memory used by the uncompressed triangles
+    const BVHBuilder &builder      // Builder and its settings
+) {
+  // Larger leaves may overflow the 5-bit triangle offsets of the compressed
+  // nodes, which would only be detected after the whole build
+  if (builder.GetMaxLeafSize() > CompressedBVH::kMaxSourceLeafSize) {
+    throw std::logic_error("The maximum leaf size of the builder must be at "
+                           "most 4 triangles to compress the hierarchy");
+  }
+
+  BVH bvh;
+  GenerateOnCPU(&bvh, false, builder);
+
+  WideBVH<8> wideBvh;
+  wideBvh.Collapse(bvh);
+  result->Compress(wideBvh);
+  *compressedSizeInBytes = result->GetHierarchySizeInBytes();
+  *triangleSizeInBytes = result->GetTriangleSizeInBytes();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Fetch the triangles of all the geometries in CPU memory, decoding their
+// vertex and index formats and applying their transforms. Geometry added from
+// GPU resources is read by mapping the resources, which requires them to be in
+// the upload heap
+void BottomLevelASGenerator::GatherTriangles(
+    std::vector<BVHTriangle> *triangles) {
+  triangles->clear();
+
+  // Map a resource for reading, returning a pointer to the requested offset
+  auto mapResource = [](ID3D12Resource *resource, UINT64 offsetInBytes) {
+    uint8_t *data = nullptr;
+    HRESULT hr = resource->Map(0, nullptr, reinterpret_cast<void **>(&data));
+    if (FAILED(hr) || data == nullptr) {
+      throw std::logic_error("Cannot map the geometry for the CPU build - is "
+                             "it in the upload heap?");
+    }
+    return data + offsetInBytes;
+  };
+  // Nothing is written by the CPU, hence the empty range when unmapping
+  D3D12_RANGE writtenRange = {0, 0};
+  // Decoded and transformed vertices of the current indexed geometry
+  std::vector<float> positions;
+
+  for (size_t g = 0; g < m_vertexBuffers.size(); g++) {
+    const D3D12_RAYTRACING_GEOMETRY_TRIANGLES_DESC &desc =
+        m_vertexBuffers[g].Triangles;
+    const GeometrySource &source = m_geometrySources[g];
+
+    const uint8_t *vertices =
+        source.vertexBuffer
+            ? mapResource(source.vertexBuffer, source.vertexOffsetInBytes)
+            : static_cast<const uint8_t *>(source.vertexData);
+    const uint8_t *indices =
+        source.indexBuffer
+            ? mapResource(source.indexBuffer, source.indexOffsetInBytes)
+            : static_cast<const uint8_t *>(source.indexData);
+    const float *transform =
+        source.transformBuffer
+            ? reinterpret_cast<const float *>(mapResource(
+                  source.transformBuffer, source.transformOffsetInBytes))
+            : source.transform;
+
+    uint32_t triangleCount =
+        (indices ? desc.IndexCount : desc.VertexCount) / 3;
+    triangles->reserve(triangles->size() + triangleCount);
+
+    if (indices) {
+      // Indexed geometry: each vertex is shared by several triangles, so all
+      // the vertices are decoded and transformed once, and the triangles are
+      // then assembled from the indices
+      positions.resize(3 * static_cast<size_t>(desc.VertexCount));
+      for (uint32_t v = 0; v < desc.VertexCount; v++) {
+        float position[3];
+        DecodePosition(vertices + v * desc.VertexBuffer.StrideInBytes,
+                       desc.VertexFormat, position);
+        TransformPosition(transform, position, &positions[3 * v]);
+      }
+      for (uint32_t i = 0; i < triangleCount; i++) {
+        BVHTriangle tri;
+        float *corners[3] = {tri.v0, tri.v1, tri.v2};
+        for (uint32_t c = 0; c < 3; c++) {
+          uint32_t vertexIndex =
+              ReadIndex(indices, desc.IndexFormat, 3 * i + c);
+          if (vertexIndex >= desc.VertexCount) {
+            throw std::logic_error("Vertex index out of range");
+          }
+          std::memcpy(corners[c], &positions[3 * vertexIndex],
+                      3 * sizeof(float));
+        }
+        tri.geometryIndex = static_cast<uint32_t>(g);
+        tri.primitiveIndex = i;
+        triangles->push_back(tri);
+      }
+    } else {
+      for (uint32_t i = 0; i < triangleCount; i++) {
+        BVHTriangle tri;
+        float *corners[3] = {tri.v0, tri.v1, tri.v2};
+        for (uint32_t c = 0; c < 3; c++) {
+          float position[3];
+          DecodePosition(vertices +
+                             (3 * i + c) * desc.VertexBuffer.StrideInBytes,
+                         desc.VertexFormat, position);
+          TransformPosition(transform, position, corners[c]);
+        }
+        tri.geometryIndex = static_cast<uint32_t>(g);
+        tri.primitiveIndex = i;
+        triangles->push_back(tri);
+      }
+    }
+
+    if (source.vertexBuffer) {
+      source.vertexBuffer->Unmap(0, &writtenRange);
+    }
+    if (source.indexBuffer) {
+      source.indexBuffer->Unmap(0, &writtenRange);
+    }
+    if (source.transformBuffer) {
+      source.transformBuffer->Unmap(0, &writtenRange);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Key of the content of the geometry and of the build flags. The triangles
+// are hashed once decoded and transformed, as the resulting structure only
+// depends on them, along with the flags of each geometry. The data is hashed
+// twice with different seeds, so that a collision of the lookup hash is caught
+// by the check hash
+BottomLevelASContentKey BottomLevelASGenerator::ComputeContentKey(
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS
+        flags // Flags the structure is built with
+) {
+  static_assert(sizeof(BVHTriangle) == 44,
+                "Triangles are expected to have no padding to be hashed");
+  std::vector<BVHTriangle> triangles;
+  GatherTriangles(&triangles);
+
+  auto hashContent = [&](uint64_t seed) {
+    uint64_t hash = HashBytes(&flags, sizeof(flags), seed);
+    for (const auto &geometry : m_vertexBuffers) {
+      hash = HashBytes(&geometry.Flags, sizeof(geometry.Flags), hash);
+    }
+    return HashBytes(triangles.data(), triangles.size() * sizeof(BVHTriangle),
+                     hash);
+  };
+
+  BottomLevelASContentKey key;
+  key.hash = hashContent(m_vertexBuffers.size());
+  key.checkHash = hashContent(0x9E3779B97F4A7C15ull ^ m_vertexBuffers.size());
+  key.geometryCount = static_cast<UINT>(m_vertexBuffers.size());
+  key.triangleCount = static_cast<UINT>(triangles.size());
+  return key;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Number of triangles of all the geometries, either given by the index count
+// or by the vertex count for non-indexed geometry
+uint32_t BottomLevelASGenerator::GetTriangleCount() const {
+  uint32_t triangleCount = 0;
+  for (const auto &geometry : m_vertexBuffers) {
+    const D3D12_RAYTRACING_GEOMETRY_TRIANGLES_DESC &desc = geometry.Triangles;
+    triangleCount +=
+        (desc.IndexCount != 0 ? desc.IndexCount : desc.VertexCount) / 3;
+  }
+  return triangleCount;
+}
 } // namespace nv_helpers_dx12
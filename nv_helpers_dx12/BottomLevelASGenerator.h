@@ -63,24 +63,95 @@ buffers.pResult.Get(), false, nullptr);
 
 return buffers;
 
+
+The same geometry can also be built on the CPU, for instance to profile the
+hierarchy or to use it on machines without raytracing support. In that case
+the vertex and index data must be readable by the CPU, either because they were
+added from host memory, or because their buffers live in the upload heap:
+
+BottomLevelASGenerator bottomLevelAS;
+bottomLevelAS.AddVertexBuffer(vertices.data(), vertexCount, sizeof(Vertex),
+indices.data(), indexCount);
+nv_helpers_dx12::BVH bvh;
+bottomLevelAS.GenerateOnCPU(&bvh);
+
+The acceleration structures can also be compacted once built, reclaiming the
+difference between the worst-case size given by ComputeASBufferSizes and the
+size actually used. The compacted size is written by the GPU during the build,
+and read back by the application to allocate the final buffer:
+
+bottomLevelAS.ComputeASBufferSizes(GetRTDevice(), false, &scratchSizeInBytes,
+&resultSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE,
+true);
+bottomLevelAS.Generate(m_commandList.Get(), buffers.pScratch.Get(),
+buffers.pResult.Get(), false, nullptr, sizeBuffer->GetGPUVirtualAddress());
+... copy sizeBuffer to a readback buffer, execute the command list and read
+compactedSizeInBytes ...
+compactedResult = nv_helpers_dx12::CreateBuffer(..., compactedSizeInBytes, ...);
+BottomLevelASGenerator::Compact(m_commandList.Get(), buffers.pResult.Get(),
+compactedResult.Get());
+
+Positions can also be stored as half floats or 16-bit normalized integers, and
+indices as 16-bit unsigned ints, at any stride that is a multiple of the size of
+a position component. Both the GPU and the CPU builders decode them:
+
+bottomLevelAS.AddVertexBuffer(vertexBuffer, 0, vertexCount, sizeof(PackedVertex),
+indexBuffer, 0, indexCount, nullptr, 0, true, false,
+DXGI_FORMAT_R16G16B16A16_FLOAT, DXGI_FORMAT_R16_UINT);
+
+The CPU hierarchy can also be stored in a compressed form, with child bounds
+quantized to 8 bits. The memory used by its nodes and primitive indices is
+reported separately from the one used by its uncompressed triangles, and can be
+compared to the result size required by the driver:
+
+bottomLevelAS.ComputeASBufferSizes(GetRTDevice(), false, &scratchSizeInBytes,
+&resultSizeInBytes);
+nv_helpers_dx12::CompressedBVH compressedBvh;
+UINT64 compressedSizeInBytes = 0;
+UINT64 triangleSizeInBytes = 0;
+bottomLevelAS.GenerateCompressedOnCPU(&compressedBvh, &compressedSizeInBytes,
+&triangleSizeInBytes);
+
 */
 
 #pragma once
 
 #include "d3d12.h"
 
+#include "BVHImage.h"
+#include "CompressedBVH.h"
+
 #include <vector>
 
 namespace nv_helpers_dx12
 {
 
+/// Identification of the content of a bottom-level AS, see ComputeContentKey. Two generators with
+/// equal keys produce the same structure.
+struct BottomLevelASContentKey
+{
+  /// Hash of the triangles and of the flags, used for lookups
+  UINT64 hash = 0;
+  /// Hash of the same data with an independent seed, checked when the lookup hash matches
+  UINT64 checkHash = 0;
+  UINT geometryCount = 0;
+  UINT triangleCount = 0;
+
+  bool operator==(const BottomLevelASContentKey& other) const
+  {
+    return hash == other.hash && checkHash == other.checkHash &&
+           geometryCount == other.geometryCount && triangleCount == other.triangleCount;
+  }
+  bool operator!=(const BottomLevelASContentKey& other) const { return !(*this == other); }
+};
+
 /// Helper class to generate bottom-level acceleration structures for raytracing
 class BottomLevelASGenerator
 {
 public:
   /// Add a vertex buffer in GPU memory into the acceleration structure. The
-  /// vertices are supposed to be represented by 3 float32 value. Indices are
-  /// implicit.
+  /// vertices are represented by 3 float32 values by default, or by any of the
+  /// formats accepted by GetVertexFormatSize. Indices are implicit.
   void AddVertexBuffer(ID3D12Resource* vertexBuffer, /// Buffer containing the vertex coordinates,
                                                      /// possibly interleaved with other vertex data
                        UINT64 vertexOffsetInBytes,   /// Offset of the first vertex in the vertex
@@ -96,13 +167,21 @@ public:
                                                         /// be nullptr
                        UINT64 transformOffsetInBytes,   /// Offset of the transform matrix in the
                                                         /// transform buffer
-                       bool isOpaque = true /// If true, the geometry is considered opaque,
-                                            /// optimizing the search for a closest hit
+                       bool isOpaque = true, /// If true, the geometry is considered opaque,
+                                             /// optimizing the search for a closest hit
+                       bool allowSpatialSplits = false, /// If true, the CPU builder may reference
+                                                        /// the triangles of this geometry in
+                                                        /// several leaves, see BuildSBVH
+                       DXGI_FORMAT vertexFormat = DXGI_FORMAT_R32G32B32_FLOAT /// Format of the
+                                                       /// vertex positions, see
+                                                       /// GetVertexFormatSize
   );
 
   /// Add a vertex buffer along with its index buffer in GPU memory into the acceleration structure.
-  /// The vertices are supposed to be represented by 3 float32 value, and the indices are 32-bit
-  /// unsigned ints
+  /// The vertices are represented by 3 float32 values and the indices are 32-bit unsigned ints by
+  /// default. Smaller vertex and index formats reduce the memory read by the builder, and
+  /// vertices can be interleaved with other data using any stride that is a multiple of the size
+  /// of a position component
   void AddVertexBuffer(ID3D12Resource* vertexBuffer, /// Buffer containing the vertex coordinates,
                                                      /// possibly interleaved with other vertex data
                        UINT64 vertexOffsetInBytes,   /// Offset of the first vertex in the vertex
@@ -123,21 +202,74 @@ public:
                                                         /// be nullptr
                        UINT64 transformOffsetInBytes,   /// Offset of the transform matrix in the
                                                         /// transform buffer
-                       bool isOpaque = true /// If true, the geometry is considered opaque,
-                                            /// optimizing the search for a closest hit
+                       bool isOpaque = true, /// If true, the geometry is considered opaque,
+                                             /// optimizing the search for a closest hit
+                       bool allowSpatialSplits = false, /// If true, the CPU builder may reference
+                                                        /// the triangles of this geometry in
+                                                        /// several leaves, see BuildSBVH
+                       DXGI_FORMAT vertexFormat = DXGI_FORMAT_R32G32B32_FLOAT, /// Format of the
+                                                       /// vertex positions, see
+                                                       /// GetVertexFormatSize
+                       DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT /// Either R32_UINT or
+                                                                      /// R16_UINT
+  );
+
+  /// Add a vertex buffer in CPU memory, along with its optional index buffer, using the same
+  /// vertex and index formats as the GPU overloads. Such geometry can only be built on the CPU,
+  /// and the memory must remain valid until the build
+  void AddVertexBuffer(const void* vertexData,      /// Vertex coordinates, possibly interleaved
+                                                    /// with other vertex data
+                       uint32_t vertexCount,        /// Number of vertices to consider
+                                                    /// in the buffer
+                       UINT vertexSizeInBytes,      /// Size of a vertex including all
+                                                    /// its other data, used to stride
+                                                    /// in the buffer
+                       const void* indexData,       /// Vertex indices describing the triangles,
+                                                    /// or nullptr for non-indexed geometry
+                       uint32_t indexCount,         /// Number of indices to consider in the buffer
+                       const float* transform = nullptr, /// Optional 3x4 row-major transform matrix
+                                                         /// to apply to the vertices
+                       bool isOpaque = true, /// If true, the geometry is considered opaque,
+                                             /// optimizing the search for a closest hit
+                       bool allowSpatialSplits = false, /// If true, the CPU builder may reference
+                                                        /// the triangles of this geometry in
+                                                        /// several leaves, see BuildSBVH
+                       DXGI_FORMAT vertexFormat = DXGI_FORMAT_R32G32B32_FLOAT, /// Format of the
+                                                       /// vertex positions, see
+                                                       /// GetVertexFormatSize
+                       DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT /// Either R32_UINT or
+                                                                      /// R16_UINT
+  );
+
+  /// Size in bytes of a vertex position stored in the given format, which must be one of
+  /// R32G32B32_FLOAT, R32G32_FLOAT, R16G16B16A16_FLOAT, R16G16_FLOAT, R16G16B16A16_SNORM or
+  /// R16G16_SNORM. Two-component formats describe positions in the z=0 plane, and the fourth
+  /// component of the 4-component formats is ignored.
+  static UINT GetVertexFormatSize(DXGI_FORMAT vertexFormat, /// Format of the vertex positions
+                                  UINT* componentSizeInBytes = nullptr /// Optional size of
+                                                                       /// one component
   );
 
   /// Compute the size of the scratch space required to build the acceleration structure, as well as
   /// the size of the resulting structure. The allocation of the buffers is then left to the
-  /// application
+  /// application. Without a device, the sizes are estimated by EstimateBottomLevelASPrebuildInfo,
+  /// which is enough for budgeting and for the CPU builds, but not for a GPU build.
   void ComputeASBufferSizes(
-      ID3D12Device5* device, /// Device on which the build will be performed
+      ID3D12Device5* device, /// Device on which the build will be performed, or nullptr
       bool allowUpdate,           /// If true, the resulting acceleration structure will
                                   /// allow iterative updates
       UINT64* scratchSizeInBytes, /// Required scratch memory on the GPU to
                                   /// build the acceleration structure
-      UINT64* resultSizeInBytes   /// Required GPU memory to store the
+      UINT64* resultSizeInBytes,  /// Required GPU memory to store the
                                   /// acceleration structure
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildPreference =
+          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE,
+      /// PREFER_FAST_TRACE, for static geometry, PREFER_FAST_BUILD, for geometry
+      /// rebuilt every frame, or NONE to let the driver choose. This also selects
+      /// the CPU builder, NONE using the same SAH builder as PREFER_FAST_TRACE.
+      bool allowCompaction = false /// If true, the size of the compacted acceleration structure
+                                   /// can be emitted by Generate, and the structure then
+                                   /// copied into a tightly sized buffer using Compact
   );
 
   /// Enqueue the construction of the acceleration structure on a command list, using
@@ -150,14 +282,120 @@ public:
                                      /// store temporary data
       ID3D12Resource* resultBuffer,  /// Result buffer storing the acceleration structure
       bool updateOnly = false,       /// If true, simply refit the existing acceleration structure
-      ID3D12Resource* previousResult = nullptr /// Optional previous acceleration structure, used
-                                               /// if an iterative update is requested
+      ID3D12Resource* previousResult = nullptr, /// Optional previous acceleration structure, used
+                                                /// if an iterative update is requested
+      D3D12_GPU_VIRTUAL_ADDRESS compactedSizeAddress = 0 /// Optional address of 8 bytes in a
+                                                         /// buffer in the UAV state, receiving
+                                                         /// the compacted size of the structure
+  );
+
+  /// Enqueue the construction of the acceleration structure at the given GPU addresses, as in
+  /// Generate but without any barrier. This allows several structures to be built concurrently in
+  /// disjoint ranges of shared buffers, see BottomLevelASBatch.
+  void Build(ID3D12GraphicsCommandList4* commandList, /// Command list on which the build will be
+                                                      /// enqueued
+             D3D12_GPU_VIRTUAL_ADDRESS scratchAddress, /// Address of the scratch memory
+             D3D12_GPU_VIRTUAL_ADDRESS resultAddress,  /// Address of the resulting structure
+             bool updateOnly = false, /// If true, simply refit the existing acceleration structure
+             D3D12_GPU_VIRTUAL_ADDRESS previousResult = 0, /// Optional address of the previous
+                                                           /// acceleration structure
+             D3D12_GPU_VIRTUAL_ADDRESS compactedSizeAddress = 0 /// Optional address of 8 bytes
+                                                                /// receiving the compacted size
+  );
+
+  /// Enqueue the copy of an acceleration structure built with compaction allowed into a buffer of
+  /// the size emitted by Generate. Once the command list is executed, the source buffer can be
+  /// released.
+  static void Compact(
+      ID3D12GraphicsCommandList4* commandList, /// Command list on which the copy will be enqueued
+      ID3D12Resource* sourceBuffer,            /// Buffer storing the acceleration structure
+      ID3D12Resource* compactedBuffer /// Buffer of the compacted size, receiving the structure
+  );
+
+  /// Build the acceleration structure on the CPU, using the same geometry as the GPU build. The
+  /// vertex, index and transform data must be readable by the CPU: either added from host memory,
+  /// or stored in buffers located in the upload heap. The build statistics are stored in the
+  /// resulting hierarchy. If the sizes were computed with PREFER_FAST_BUILD, a linear BVH is
+  /// built, otherwise the hierarchy is built using SAH splits, along with spatial splits if any
+  /// geometry allows them. An update keeps the topology of the previous hierarchy and only
+  /// refits its bounds to the current vertex positions, the resulting quality loss being given
+  /// by BVH::GetSAHDegradation. As the leaves are refitted to whole triangles, an update also
+  /// undoes the spatial splits, see BVHBuilder::Refit.
+  void GenerateOnCPU(BVH* result,             /// Hierarchy built from the geometry, or the
+                                              /// previous hierarchy to refit in place
+                     bool updateOnly = false, /// If true, simply refit the existing hierarchy
+                     const BVHBuilder& builder = BVHBuilder() /// Builder and its settings
   );
 
+  /// Worst-case size of the CPU hierarchy, that is the size of the arena to pass to the arena
+  /// version of GenerateOnCPU. This is the CPU counterpart of the result size given by
+  /// ComputeASBufferSizes. The builder gives the spatial split budget, if any geometry allows
+  /// spatial splits.
+  UINT64 ComputeCPUResultMaxSize(const BVHBuilder& builder = BVHBuilder()) const;
+
+  /// Build the acceleration structure on the CPU as in GenerateOnCPU, and store its image in a
+  /// plain byte arena. As on the GPU, the arena is sized for the worst case, and the size of the
+  /// compacted image is returned so that it can be copied into a tightly sized arena with
+  /// CompactBVHImage.
+  void GenerateOnCPU(uint8_t* resultArena,      /// Arena receiving the image of the hierarchy
+                     UINT64 resultSizeInBytes,  /// Size of the arena, at least
+                                                /// ComputeCPUResultMaxSize
+                     UINT64* compactedSizeInBytes, /// Size of the compacted image
+                     const BVHBuilder& builder = BVHBuilder() /// Builder and its settings
+  );
+
+  /// Build the acceleration structure on the CPU as in GenerateOnCPU, and encode it as an 8-wide
+  /// hierarchy with quantized child bounds and compacted primitive indices. The builder must use
+  /// a maximum leaf size of at most 4 triangles, see CompressedBVH::kMaxSourceLeafSize.
+  void GenerateCompressedOnCPU(
+      CompressedBVH* result,            /// Compressed hierarchy built from the geometry
+      UINT64* compressedSizeInBytes,    /// Memory used by the compressed nodes and primitive
+                                        /// indices
+      UINT64* triangleSizeInBytes,      /// Memory used by the uncompressed triangles
+      const BVHBuilder& builder = BVHBuilder() /// Builder and its settings
+  );
+
+  /// Key identifying the triangles of all the geometries, as seen by the builder, the geometry
+  /// flags and the build flags. Two generators with the same key produce the same structure,
+  /// which can then be shared, see BottomLevelASRegistry. As for GenerateOnCPU, geometry given as
+  /// GPU resources is read by mapping them, and hence has to be in the upload heap.
+  BottomLevelASContentKey
+  ComputeContentKey(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags);
+
 private:
+  /// Location of the data of a geometry as seen from the CPU, either host pointers or the
+  /// resources to map in order to read it
+  struct GeometrySource
+  {
+    ID3D12Resource* vertexBuffer = nullptr;
+    UINT64 vertexOffsetInBytes = 0;
+    ID3D12Resource* indexBuffer = nullptr;
+    UINT64 indexOffsetInBytes = 0;
+    ID3D12Resource* transformBuffer = nullptr;
+    UINT64 transformOffsetInBytes = 0;
+    const void* vertexData = nullptr;
+    const void* indexData = nullptr;
+    const float* transform = nullptr;
+    bool allowSpatialSplits = false;
+  };
+
+  /// Check the formats and stride of a geometry before recording it
+  static void ValidateFormats(DXGI_FORMAT vertexFormat, UINT vertexSizeInBytes,
+                              DXGI_FORMAT indexFormat);
+
+  /// Fetch the triangles of all the geometries in CPU memory, decoding their vertex and index
+  /// formats and applying their transforms
+  void GatherTriangles(std::vector<BVHTriangle>* triangles);
+
+  /// Number of triangles of all the geometries
+  uint32_t GetTriangleCount() const;
+
   /// Vertex buffer descriptors used to generate the AS
   std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> m_vertexBuffers = {};
 
+  /// CPU-side location of the data of each geometry in m_vertexBuffers, used by the CPU builders
+  std::vector<GeometrySource> m_geometrySources = {};
+
   /// Amount of temporary memory required by the builder
   UINT64 m_scratchSizeInBytes = 0;
 
@@ -165,7 +403,8 @@ private:
   UINT64 m_resultSizeInBytes = 0;
 
   /// Flags for the builder, specifying whether to allow iterative updates, or
-  /// when to perform an update
-  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags;
+  /// when to perform an update, and whether to favor build or trace performance
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags =
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
 };
 } // namespace nv_helpers_dx12
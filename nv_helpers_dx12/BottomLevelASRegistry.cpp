@@ -0,0 +1,160 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Reference-counted registry of bottom-level acceleration structures keyed by
+their content. See BottomLevelASRegistry.h for details.
+*/
+
+#include "BottomLevelASRegistry.h"
+
+#include <stdexcept>
+
+namespace nv_helpers_dx12
+{
+
+//--------------------------------------------------------------------------------------------------
+//
+// Release the references held by the registry on all the structures
+BottomLevelASRegistry::~BottomLevelASRegistry()
+{
+  for (auto& entry : m_entries)
+  {
+    entry.second.bottomLevelAS->Release();
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the entry of a key. Entries with the same lookup hash are told apart by the rest of their
+// key
+std::unordered_multimap<UINT64, BottomLevelASRegistry::Entry>::iterator
+BottomLevelASRegistry::Find(const BottomLevelASContentKey& contentKey, bool* collided)
+{
+  if (collided)
+  {
+    *collided = false;
+  }
+  auto candidates = m_entries.equal_range(contentKey.hash);
+  for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+  {
+    if (candidate->second.contentKey == contentKey)
+    {
+      return candidate;
+    }
+    if (collided)
+    {
+      *collided = true;
+    }
+  }
+  return m_entries.end();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Look up the structure built from the content with the given key, incrementing its reference
+// count if found
+ID3D12Resource* BottomLevelASRegistry::Acquire(const BottomLevelASContentKey& contentKey)
+{
+  // Only the lookups of the application are counted, not the ones done to register and release
+  // the structures
+  bool collided = false;
+  auto entry = Find(contentKey, &collided);
+  if (collided)
+  {
+    m_collisionCount++;
+  }
+  if (entry == m_entries.end())
+  {
+    m_missCount++;
+    return nullptr;
+  }
+  m_hitCount++;
+  entry->second.referenceCount++;
+  return entry->second.bottomLevelAS;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Register a freshly built structure, on which the registry takes a reference
+void BottomLevelASRegistry::Register(const BottomLevelASContentKey& contentKey,
+                                     ID3D12Resource* bottomLevelAS)
+{
+  if (bottomLevelAS == nullptr)
+  {
+    throw std::logic_error("Cannot register a null bottom-level AS");
+  }
+  if (Find(contentKey) != m_entries.end() || m_keys.count(bottomLevelAS) != 0)
+  {
+    throw std::logic_error("Bottom-level AS already registered");
+  }
+  bottomLevelAS->AddRef();
+  m_entries.emplace(contentKey.hash, Entry{contentKey, bottomLevelAS, 1});
+  m_keys[bottomLevelAS] = contentKey;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Decrement the reference count of a structure, removing it from the registry and releasing the
+// reference of the registry on the resource once unused
+bool BottomLevelASRegistry::Release(ID3D12Resource* bottomLevelAS)
+{
+  auto key = m_keys.find(bottomLevelAS);
+  if (key == m_keys.end())
+  {
+    throw std::logic_error("Releasing a bottom-level AS which is not registered");
+  }
+  auto entry = Find(key->second);
+  if (--entry->second.referenceCount > 0)
+  {
+    return false;
+  }
+  m_entries.erase(entry);
+  m_keys.erase(key);
+  bottomLevelAS->Release();
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Reference count of a structure, or 0 if it is not registered
+uint32_t BottomLevelASRegistry::GetReferenceCount(ID3D12Resource* bottomLevelAS) const
+{
+  auto key = m_keys.find(bottomLevelAS);
+  if (key == m_keys.end())
+  {
+    return 0;
+  }
+  auto candidates = m_entries.equal_range(key->second.hash);
+  for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+  {
+    if (candidate->second.bottomLevelAS == bottomLevelAS)
+    {
+      return candidate->second.referenceCount;
+    }
+  }
+  return 0;
+}
+} // namespace nv_helpers_dx12
@@ -0,0 +1,125 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The registry shares bottom-level acceleration structures between meshes with
+identical content. Scenes assembled from a library of props reference the same
+geometry many times, often through separate vertex buffers: building a
+structure for each copy wastes build time and memory, while the instances of a
+top-level AS can all reference a single structure.
+
+The structures are identified by BottomLevelASGenerator::ComputeContentKey,
+which hashes the triangles of the geometry along with the geometry and build
+flags. Before building a structure, the application looks its key up in the
+registry. The structures are found by the first hash of the key, and the rest
+of the key is compared to rule out hash collisions. On a hit, the existing
+structure is returned and its reference count is incremented. On a miss, the
+application builds the structure and registers it. Each user of a structure
+releases it once done, and the registry releases its own reference to the
+resource when the count drops to zero.
+
+Example:
+
+nv_helpers_dx12::BottomLevelASContentKey key = generator.ComputeContentKey(buildFlags);
+ID3D12Resource* bottomLevelAS = registry.Acquire(key);
+if (bottomLevelAS == nullptr)
+{
+  ... build the structure into bottomLevelAS ...
+  registry.Register(key, bottomLevelAS);
+}
+...
+registry.Release(bottomLevelAS);
+
+*/
+
+#pragma once
+
+#include "d3d12.h"
+
+#include "BottomLevelASGenerator.h"
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace nv_helpers_dx12
+{
+
+/// Reference-counted bottom-level acceleration structures, keyed by their content
+class BottomLevelASRegistry
+{
+public:
+  BottomLevelASRegistry() = default;
+  BottomLevelASRegistry(const BottomLevelASRegistry&) = delete;
+  BottomLevelASRegistry& operator=(const BottomLevelASRegistry&) = delete;
+
+  /// Release the references held by the registry on all the structures
+  ~BottomLevelASRegistry();
+
+  /// Look up the structure built from the content with the given key. If found, its reference
+  /// count is incremented and the structure is returned, otherwise nullptr is returned.
+  ID3D12Resource* Acquire(const BottomLevelASContentKey& contentKey);
+
+  /// Register a structure built from the content with the given key, with a reference count of
+  /// 1. The registry holds a reference on the resource until the count drops to zero.
+  void Register(const BottomLevelASContentKey& contentKey, ID3D12Resource* bottomLevelAS);
+
+  /// Decrement the reference count of a structure. Returns true if the count dropped to zero, in
+  /// which case the structure is removed from the registry.
+  bool Release(ID3D12Resource* bottomLevelAS);
+
+  /// Reference count of a structure, or 0 if it is not registered
+  uint32_t GetReferenceCount(ID3D12Resource* bottomLevelAS) const;
+
+  /// Number of distinct structures in the registry
+  size_t GetCount() const { return m_entries.size(); }
+  /// Number of lookups which returned an existing structure
+  uint64_t GetHitCount() const { return m_hitCount; }
+  /// Number of lookups which did not find any structure
+  uint64_t GetMissCount() const { return m_missCount; }
+  /// Number of lookups whose hash matched a structure built from different content
+  uint64_t GetCollisionCount() const { return m_collisionCount; }
+
+private:
+  struct Entry
+  {
+    BottomLevelASContentKey contentKey;
+    ID3D12Resource* bottomLevelAS;
+    uint32_t referenceCount;
+  };
+
+  /// Find the entry of a key, comparing the whole key of the entries with the same hash. The
+  /// optional flag tells whether an entry with the same hash but a different key was met.
+  std::unordered_multimap<UINT64, Entry>::iterator Find(const BottomLevelASContentKey& contentKey,
+                                                        bool* collided = nullptr);
+
+  /// Structures by lookup hash, which can be shared by different contents
+  std::unordered_multimap<UINT64, Entry> m_entries;
+  /// Content key of each structure, used to release them
+  std::unordered_map<ID3D12Resource*, BottomLevelASContentKey> m_keys;
+  uint64_t m_hitCount = 0;
+  uint64_t m_missCount = 0;
+  uint64_t m_collisionCount = 0;
+};
+} // namespace nv_helpers_dx12
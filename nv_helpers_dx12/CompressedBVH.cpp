@@ -0,0 +1,363 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+8-wide hierarchy with child bounds quantized to 8 bits per plane and compacted
+primitive indices. See CompressedBVH.h for details.
+*/
+
+#include "CompressedBVH.h"
+
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+namespace nv_helpers_dx12
+{
+
+static_assert(sizeof(CompressedBVHNode) == 80, "Compressed BVH nodes are expected to be 80 bytes");
+
+namespace
+{
+// Number of bits storing the primitive offset of a leaf child in the meta byte
+const uint32_t kPrimOffsetBits = 5;
+const uint32_t kMaxPrimOffset = (1u << kPrimOffsetBits) - 1;
+const uint32_t kMaxLeafSize = 7;
+
+// Position of a quantized plane in world space. Both the encoder and the
+// traversal use this exact expression, so that the conservativeness checked
+// during the encoding holds during the traversal.
+inline float Dequantize(float origin, float scale, uint8_t q)
+{
+  return origin + static_cast<float>(q) * scale;
+}
+
+// Quantize the bounds of the children of a node along one axis, within the
+// frame starting at origin. Returns false if the bounds cannot be
+// represented conservatively with the given scale.
+bool QuantizeAxis(const float* childMin, const float* childMax, const uint32_t* children,
+                  float origin, float scale, uint8_t* qMin, uint8_t* qMax)
+{
+  for (int slot = 0; slot < 8; slot++)
+  {
+    if (children[slot] == WideBVH<8>::kInvalidChild)
+    {
+      // Inverted bounds, so that the slot is never hit even if the meta data
+      // was ignored
+      qMin[slot] = 255;
+      qMax[slot] = 0;
+      continue;
+    }
+    float lo = std::floor((childMin[slot] - origin) / scale);
+    float hi = std::ceil((childMax[slot] - origin) / scale);
+    int qlo = lo < 0.f ? 0 : (lo > 255.f ? 255 : static_cast<int>(lo));
+    int qhi = hi < 0.f ? 0 : (hi > 255.f ? 255 : static_cast<int>(hi));
+
+    // Compensate the rounding of the dequantization
+    while (qlo > 0 && Dequantize(origin, scale, static_cast<uint8_t>(qlo)) > childMin[slot])
+    {
+      qlo--;
+    }
+    while (qhi < 255 && Dequantize(origin, scale, static_cast<uint8_t>(qhi)) < childMax[slot])
+    {
+      qhi++;
+    }
+    if (Dequantize(origin, scale, static_cast<uint8_t>(qlo)) > childMin[slot] ||
+        Dequantize(origin, scale, static_cast<uint8_t>(qhi)) < childMax[slot])
+    {
+      return false;
+    }
+    qMin[slot] = static_cast<uint8_t>(qlo);
+    qMax[slot] = static_cast<uint8_t>(qhi);
+  }
+  return true;
+}
+
+// Choose the smallest power-of-two scale covering the extent of the node with
+// 255 steps, and quantize the child bounds along one axis
+void EncodeAxis(const float* childMin, const float* childMax, const uint32_t* children,
+                float frameMin, float frameMax, float* origin, int8_t* exponent, uint8_t* qMin,
+                uint8_t* qMax)
+{
+  float extent = frameMax - frameMin;
+  int e = -126;
+  if (extent > 0.f)
+  {
+    int frexpExponent;
+    float mantissa = std::frexp(extent / 255.f, &frexpExponent);
+    // extent / 255 = mantissa * 2^frexpExponent, with mantissa in [0.5, 1)
+    e = mantissa == 0.5f ? frexpExponent - 1 : frexpExponent;
+    e = e < -126 ? -126 : e;
+  }
+
+  *origin = frameMin;
+  while (!QuantizeAxis(childMin, childMax, children, frameMin, std::ldexp(1.f, e), qMin, qMax))
+  {
+    if (++e > 127)
+    {
+      throw std::logic_error("The bounds of a BVH node cannot be quantized");
+    }
+  }
+  *exponent = static_cast<int8_t>(e);
+}
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Encode an 8-wide hierarchy. The nodes are visited in breadth-first order, so that the internal
+// children of each node can be allocated contiguously, and the triangles of its leaf children are
+// appended contiguously to the compacted index list
+void CompressedBVH::Compress(const WideBVH<8>& bvh)
+{
+  nodes.clear();
+  primIndices.clear();
+  triangles = bvh.triangles;
+  bounds = bvh.bounds;
+
+  uint64_t triangleCount = triangles.size();
+  indexSizeInBytes = triangleCount <= (1ull << 8) ? 1
+                     : triangleCount <= (1ull << 16) ? 2
+                     : triangleCount <= (1ull << 24) ? 3
+                                                     : 4;
+  if (bvh.nodes.empty())
+  {
+    return;
+  }
+
+  // Wide node corresponding to each compressed node
+  std::vector<uint32_t> sources = {0};
+  nodes.emplace_back();
+  uint32_t primCount = 0;
+  for (size_t current = 0; current < sources.size(); current++)
+  {
+    const WideBVHNode<8>& wideNode = bvh.nodes[sources[current]];
+    CompressedBVHNode node = {};
+    node.childBaseIndex = static_cast<uint32_t>(nodes.size());
+    node.primBaseIndex = primCount;
+
+    // The frame of the node is the union of the bounds of its children
+    AABB frame;
+    frame.Reset();
+    for (int slot = 0; slot < 8; slot++)
+    {
+      if (wideNode.children[slot] == WideBVH<8>::kInvalidChild)
+      {
+        continue;
+      }
+      AABB child;
+      child.min[0] = wideNode.minX[slot];
+      child.min[1] = wideNode.minY[slot];
+      child.min[2] = wideNode.minZ[slot];
+      child.max[0] = wideNode.maxX[slot];
+      child.max[1] = wideNode.maxY[slot];
+      child.max[2] = wideNode.maxZ[slot];
+      frame.Grow(child);
+
+      if (wideNode.primCounts[slot] == 0)
+      {
+        node.internalMask |= static_cast<uint8_t>(1u << slot);
+        node.meta[slot] = static_cast<uint8_t>(sources.size() - node.childBaseIndex);
+        sources.push_back(wideNode.children[slot]);
+        nodes.emplace_back();
+      }
+      else
+      {
+        uint32_t count = wideNode.primCounts[slot];
+        uint32_t offset = primCount - node.primBaseIndex;
+        if (count > kMaxLeafSize || offset > kMaxPrimOffset)
+        {
+          throw std::logic_error("Compressed BVH leaves cannot contain more than 7 triangles, "
+                                 "nor more than 32 triangles per node");
+        }
+        node.meta[slot] = static_cast<uint8_t>((count << kPrimOffsetBits) | offset);
+        for (uint32_t i = 0; i < count; i++)
+        {
+          uint32_t index = bvh.primIndices[wideNode.children[slot] + i];
+          for (uint32_t b = 0; b < indexSizeInBytes; b++)
+          {
+            primIndices.push_back(static_cast<uint8_t>(index >> (8 * b)));
+          }
+        }
+        primCount += count;
+      }
+    }
+
+    EncodeAxis(wideNode.minX, wideNode.maxX, wideNode.children, frame.min[0], frame.max[0],
+               &node.origin[0], &node.exponent[0], node.qMinX, node.qMaxX);
+    EncodeAxis(wideNode.minY, wideNode.maxY, wideNode.children, frame.min[1], frame.max[1],
+               &node.origin[1], &node.exponent[1], node.qMinY, node.qMaxY);
+    EncodeAxis(wideNode.minZ, wideNode.maxZ, wideNode.children, frame.min[2], frame.max[2],
+               &node.origin[2], &node.exponent[2], node.qMinZ, node.qMaxZ);
+    nodes[current] = node;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the closest intersection of the ray with the triangles of the hierarchy. Each node is
+// decoded into a regular wide node, so that the SIMD child test of the wide hierarchy is reused.
+bool CompressedBVH::Intersect(const BVHRay& ray, BVHHit* hit) const
+{
+  if (nodes.empty())
+  {
+    return false;
+  }
+
+  WideBVHRay rayData(ray);
+
+  BVHRay current = ray;
+  bool found = false;
+
+  struct StackEntry
+  {
+    uint32_t child;
+    uint32_t primCount;
+    float t;
+  };
+  // Each level of the hierarchy pushes at most 7 entries beyond the one it pops,
+  // and the stack spills to the heap beyond 64 levels
+  BVHTraversalStack<StackEntry, 64 * 8> stack;
+  stack.Push({0, 0, ray.tMin});
+
+  WideBVHNode<8> decoded;
+  while (!stack.IsEmpty())
+  {
+    StackEntry entry = stack.Pop();
+    if (entry.t > current.tMax)
+    {
+      continue;
+    }
+
+    if (entry.primCount != 0)
+    {
+      for (uint32_t i = 0; i < entry.primCount; i++)
+      {
+        const BVHTriangle& tri = triangles[GetPrimIndex(entry.child + i)];
+        float t, u, v;
+        if (tri.Intersect(current, &t, &u, &v))
+        {
+          current.tMax = t;
+          hit->t = t;
+          hit->u = u;
+          hit->v = v;
+          hit->geometryIndex = tri.geometryIndex;
+          hit->primitiveIndex = tri.primitiveIndex;
+          found = true;
+        }
+      }
+      continue;
+    }
+
+    const CompressedBVHNode& node = nodes[entry.child];
+    float scaleX = std::ldexp(1.f, node.exponent[0]);
+    float scaleY = std::ldexp(1.f, node.exponent[1]);
+    float scaleZ = std::ldexp(1.f, node.exponent[2]);
+    for (int slot = 0; slot < 8; slot++)
+    {
+      decoded.minX[slot] = Dequantize(node.origin[0], scaleX, node.qMinX[slot]);
+      decoded.minY[slot] = Dequantize(node.origin[1], scaleY, node.qMinY[slot]);
+      decoded.minZ[slot] = Dequantize(node.origin[2], scaleZ, node.qMinZ[slot]);
+      decoded.maxX[slot] = Dequantize(node.origin[0], scaleX, node.qMaxX[slot]);
+      decoded.maxY[slot] = Dequantize(node.origin[1], scaleY, node.qMaxY[slot]);
+      decoded.maxZ[slot] = Dequantize(node.origin[2], scaleZ, node.qMaxZ[slot]);
+    }
+    float tEntry[8];
+    uint32_t mask = IntersectChildren(decoded, rayData, current.tMax, tEntry);
+
+    // Sort the children hit by decreasing distance, so that the nearest ends
+    // up on top of the stack
+    StackEntry hits[8];
+    int hitCount = 0;
+    for (int slot = 0; slot < 8; slot++)
+    {
+      if ((mask & (1u << slot)) == 0 ||
+          ((node.internalMask & (1u << slot)) == 0 && node.meta[slot] == 0))
+      {
+        continue;
+      }
+      StackEntry child;
+      if (node.internalMask & (1u << slot))
+      {
+        child = {node.childBaseIndex + node.meta[slot], 0, tEntry[slot]};
+      }
+      else
+      {
+        child = {node.primBaseIndex + (node.meta[slot] & kMaxPrimOffset),
+                 static_cast<uint32_t>(node.meta[slot] >> kPrimOffsetBits), tEntry[slot]};
+      }
+      int position = hitCount++;
+      while (position > 0 && hits[position - 1].t < child.t)
+      {
+        hits[position] = hits[position - 1];
+        position--;
+      }
+      hits[position] = child;
+    }
+    for (int i = 0; i < hitCount; i++)
+    {
+      stack.Push(hits[i]);
+    }
+  }
+  return found;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Memory used by the nodes and the compacted primitive indices
+uint64_t CompressedBVH::GetHierarchySizeInBytes() const
+{
+  return nodes.size() * sizeof(CompressedBVHNode) + primIndices.size();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Memory used by the uncompressed triangles
+uint64_t CompressedBVH::GetTriangleSizeInBytes() const
+{
+  return triangles.size() * sizeof(BVHTriangle);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Memory used by the nodes, primitive indices and triangles
+uint64_t CompressedBVH::GetSizeInBytes() const
+{
+  return GetHierarchySizeInBytes() + GetTriangleSizeInBytes();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Read an entry of the compacted primitive index list, stored in little-endian order
+uint32_t CompressedBVH::GetPrimIndex(uint32_t position) const
+{
+  const uint8_t* bytes = primIndices.data() + static_cast<size_t>(position) * indexSizeInBytes;
+  uint32_t index = 0;
+  for (uint32_t b = 0; b < indexSizeInBytes; b++)
+  {
+    index |= static_cast<uint32_t>(bytes[b]) << (8 * b);
+  }
+  return index;
+}
+} // namespace nv_helpers_dx12
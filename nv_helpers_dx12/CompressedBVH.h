@@ -0,0 +1,134 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The compressed hierarchy is a memory-efficient encoding of an 8-wide hierarchy,
+following the layout of Ylitie et al., "Efficient Incoherent Ray Traversal on
+GPUs Through Compressed Wide BVHs" (HPG 2017).
+
+Each node stores a local frame, made of the origin of its bounds and a
+power-of-two scale per axis. The bounds of its children are quantized to 8 bits
+per plane within that frame, conservatively rounding outwards so that a child
+box always contains the original one. The internal children of a node are
+stored contiguously, as are the triangles referenced by its leaf children, so
+that a node only stores two base indices and one byte of offset per child.
+
+The primitive index list is also compacted: each index is stored using the
+minimum number of bytes required to address all the triangles.
+
+An 8-wide node takes 80 bytes instead of 256, which typically reduces the
+memory used by the nodes and primitive indices by 3x over the binary hierarchy.
+The triangles themselves are stored uncompressed, 44 bytes each, and usually
+take more memory than the compressed nodes, so that the whole structure only
+shrinks by 1.5 to 2x. Compressing the triangles is out of the scope of this
+encoding, hence both parts are reported separately.
+
+Example:
+
+nv_helpers_dx12::WideBVH<8> wideBvh;
+wideBvh.Collapse(bvh);
+
+nv_helpers_dx12::CompressedBVH compressedBvh;
+compressedBvh.Compress(wideBvh);
+printf("%llu node and index bytes, %llu triangle bytes\n",
+compressedBvh.GetHierarchySizeInBytes(), compressedBvh.GetTriangleSizeInBytes());
+
+*/
+
+#pragma once
+
+#include "WideBVH.h"
+
+namespace nv_helpers_dx12
+{
+
+/// Node of a compressed 8-wide hierarchy
+struct CompressedBVHNode
+{
+  /// Origin of the quantization frame
+  float origin[3];
+  /// Scale of the quantization frame along each axis, as a power of two
+  int8_t exponent[3];
+  /// Bit mask of the internal children
+  uint8_t internalMask;
+  /// Index of the first internal child, the others following it
+  uint32_t childBaseIndex;
+  /// Index of the first triangle referenced by the leaf children
+  uint32_t primBaseIndex;
+  /// For internal children, the offset of the child from childBaseIndex. For
+  /// leaf children, the number of triangles in the 3 highest bits, and their
+  /// offset from primBaseIndex in the 5 lowest bits. 0 for unused slots.
+  uint8_t meta[8];
+  /// Quantized child bounds
+  uint8_t qMinX[8];
+  uint8_t qMinY[8];
+  uint8_t qMinZ[8];
+  uint8_t qMaxX[8];
+  uint8_t qMaxY[8];
+  uint8_t qMaxZ[8];
+};
+
+/// 8-wide hierarchy with quantized child bounds and compacted primitive indices
+struct CompressedBVH
+{
+  /// Largest maximum leaf size of the binary hierarchies that can always be
+  /// compressed, the leaves of a node being limited to 32 triangles in total
+  static const uint32_t kMaxSourceLeafSize = 4;
+
+  /// Nodes of the hierarchy, the root being the first one
+  std::vector<CompressedBVHNode> nodes;
+  /// Indices of the triangles referenced by the leaves, each stored on
+  /// indexSizeInBytes bytes
+  std::vector<uint8_t> primIndices;
+  /// Number of bytes used to store each primitive index, from 1 to 4
+  uint32_t indexSizeInBytes = 4;
+  /// Triangles of all the geometries contained in the hierarchy
+  std::vector<BVHTriangle> triangles;
+  /// Bounds of the whole hierarchy, which are not stored in any node
+  AABB bounds;
+
+  /// Encode an 8-wide hierarchy. Its leaves must contain at most 7 triangles,
+  /// and the leaves of a node at most 32 triangles in total, which holds for
+  /// hierarchies built with a maximum leaf size of 4.
+  void Compress(const WideBVH<8>& bvh);
+
+  /// Find the closest intersection of the ray with the triangles of the
+  /// hierarchy. Returns false if the ray does not hit anything.
+  bool Intersect(const BVHRay& ray, BVHHit* hit) const;
+
+  /// Memory used by the nodes and the compacted primitive indices, which is
+  /// the part of the hierarchy reduced by the compression
+  uint64_t GetHierarchySizeInBytes() const;
+
+  /// Memory used by the triangles, which are stored uncompressed
+  uint64_t GetTriangleSizeInBytes() const;
+
+  /// Memory used by the nodes, primitive indices and triangles
+  uint64_t GetSizeInBytes() const;
+
+  /// Read an entry of the compacted primitive index list
+  uint32_t GetPrimIndex(uint32_t position) const;
+};
+} // namespace nv_helpers_dx12
@@ -0,0 +1,301 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Frustum, distance and screen-size culling of the instances of a top-level AS.
+See InstanceCuller.h for details.
+*/
+
+#include "InstanceCuller.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define NV_HELPERS_CULLER_SSE
+#include <immintrin.h>
+#endif
+
+namespace nv_helpers_dx12
+{
+
+//--------------------------------------------------------------------------------------------------
+//
+// Extract the frustum planes from the view-projection matrix (Gribb and Hartmann, "Fast Extraction
+// of Viewing Frustum Planes from the World-View-Projection Matrix", 2001). DirectXMath transforms
+// row vectors, so that each clip-space coordinate is given by a column of the matrix.
+void InstanceCuller::SetFrustum(const DirectX::XMMATRIX& viewProjection)
+{
+  DirectX::XMFLOAT4X4 m;
+  DirectX::XMStoreFloat4x4(&m, viewProjection);
+  for (int i = 0; i < 4; i++)
+  {
+    float x = m.m[i][0];
+    float y = m.m[i][1];
+    float z = m.m[i][2];
+    float w = m.m[i][3];
+    m_planes[0][i] = w + x; // Left
+    m_planes[1][i] = w - x; // Right
+    m_planes[2][i] = w + y; // Bottom
+    m_planes[3][i] = w - y; // Top
+    m_planes[4][i] = z;     // Near, as the depth range starts at 0
+    m_planes[5][i] = w - z; // Far
+  }
+
+  // Normalizing the planes is not required by the tests, but keeps them well conditioned for
+  // projections with very large depth ranges
+  for (auto& plane : m_planes)
+  {
+    float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+    if (length > 0.f)
+    {
+      for (int i = 0; i < 4; i++)
+      {
+        plane[i] /= length;
+      }
+    }
+  }
+  m_frustumEnabled = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Position of the camera, used by the distance and screen-size tests
+void InstanceCuller::SetCameraPosition(const DirectX::XMFLOAT3& position)
+{
+  m_cameraPosition[0] = position.x;
+  m_cameraPosition[1] = position.y;
+  m_cameraPosition[2] = position.z;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Distance beyond which instances are culled, or 0 to disable distance culling
+void InstanceCuller::SetMaxDistance(float maxDistance)
+{
+  if (maxDistance < 0.f)
+  {
+    throw std::logic_error("The culling distance cannot be negative");
+  }
+  m_maxDistanceSquared = maxDistance * maxDistance;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// An instance whose bounding sphere of radius r is at a distance d from the camera covers about
+// r / (d * tan(fov / 2)) of the viewport height. The test compares the squares of both sides, to
+// avoid computing square roots.
+void InstanceCuller::SetMinScreenSize(float minScreenFraction, float verticalFieldOfView)
+{
+  if (minScreenFraction < 0.f || verticalFieldOfView <= 0.f)
+  {
+    throw std::logic_error("Invalid screen-size culling parameters");
+  }
+  float size = minScreenFraction * std::tan(0.5f * verticalFieldOfView);
+  m_minScreenSizeSquared = size * size;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Test a single box: the box is outside a plane if its vertex farthest along the plane normal is
+// outside, that is if the distance of its center minus its projected extent is negative
+InstanceCuller::CullReason InstanceCuller::Classify(const AABB& box) const
+{
+  if (box.IsEmpty())
+  {
+    return CULL_FRUSTUM;
+  }
+
+  float center[3];
+  float extent[3];
+  for (int axis = 0; axis < 3; axis++)
+  {
+    center[axis] = 0.5f * (box.min[axis] + box.max[axis]);
+    extent[axis] = 0.5f * (box.max[axis] - box.min[axis]);
+  }
+
+  if (m_frustumEnabled)
+  {
+    for (const auto& plane : m_planes)
+    {
+      float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] +
+                       plane[3] + std::fabs(plane[0]) * extent[0] +
+                       std::fabs(plane[1]) * extent[1] + std::fabs(plane[2]) * extent[2];
+      if (distance < 0.f)
+      {
+        return CULL_FRUSTUM;
+      }
+    }
+  }
+
+  // Distance from the camera to the closest point of the box, and to its center
+  float boxDistanceSquared = 0.f;
+  float centerDistanceSquared = 0.f;
+  float radiusSquared = 0.f;
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float d = std::fabs(center[axis] - m_cameraPosition[axis]);
+    float outside = d > extent[axis] ? d - extent[axis] : 0.f;
+    boxDistanceSquared += outside * outside;
+    centerDistanceSquared += d * d;
+    radiusSquared += extent[axis] * extent[axis];
+  }
+  if (m_maxDistanceSquared > 0.f && boxDistanceSquared > m_maxDistanceSquared)
+  {
+    return CULL_DISTANCE;
+  }
+  if (m_minScreenSizeSquared > 0.f &&
+      radiusSquared < m_minScreenSizeSquared * centerDistanceSquared)
+  {
+    return CULL_SCREEN_SIZE;
+  }
+  return CULL_NONE;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Test the bounds of all the instances. With SSE, the bounds of 4 instances are loaded as two
+// overlapping groups of 4 floats each, (min.x, min.y, min.z, max.x) and (min.z, max.x, max.y,
+// max.z), which are transposed into one register per coordinate. The same tests as Classify are
+// then evaluated on the 4 boxes at once, and the remaining instances are tested one by one.
+InstanceCullingStats InstanceCuller::Cull(const std::vector<AABB>& bounds,
+                                          std::vector<uint8_t>* visibility) const
+{
+  InstanceCullingStats stats;
+  auto count = static_cast<uint32_t>(bounds.size());
+  stats.instanceCount = count;
+  visibility->resize(count);
+  uint32_t culledCounts[4] = {};
+  uint32_t i = 0;
+
+#ifdef NV_HELPERS_CULLER_SSE
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  const __m128 maxDistanceSquared = _mm_set1_ps(m_maxDistanceSquared);
+  const __m128 minScreenSizeSquared = _mm_set1_ps(m_minScreenSizeSquared);
+  __m128 camera[3];
+  for (int axis = 0; axis < 3; axis++)
+  {
+    camera[axis] = _mm_set1_ps(m_cameraPosition[axis]);
+  }
+
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128 lo0 = _mm_loadu_ps(&bounds[i].min[0]);
+    __m128 lo1 = _mm_loadu_ps(&bounds[i + 1].min[0]);
+    __m128 lo2 = _mm_loadu_ps(&bounds[i + 2].min[0]);
+    __m128 lo3 = _mm_loadu_ps(&bounds[i + 3].min[0]);
+    __m128 hi0 = _mm_loadu_ps(&bounds[i].min[2]);
+    __m128 hi1 = _mm_loadu_ps(&bounds[i + 1].min[2]);
+    __m128 hi2 = _mm_loadu_ps(&bounds[i + 2].min[2]);
+    __m128 hi3 = _mm_loadu_ps(&bounds[i + 3].min[2]);
+    _MM_TRANSPOSE4_PS(lo0, lo1, lo2, lo3);
+    _MM_TRANSPOSE4_PS(hi0, hi1, hi2, hi3);
+    // lo0..lo2 now hold min.x, min.y, min.z, and hi1..hi3 hold max.x, max.y, max.z
+    __m128 minimum[3] = {lo0, lo1, lo2};
+    __m128 maximum[3] = {hi1, hi2, hi3};
+
+    __m128 center[3];
+    __m128 extent[3];
+    __m128 frustumCulled = zero;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      center[axis] = _mm_mul_ps(_mm_add_ps(minimum[axis], maximum[axis]), half);
+      extent[axis] = _mm_mul_ps(_mm_sub_ps(maximum[axis], minimum[axis]), half);
+      frustumCulled = _mm_or_ps(frustumCulled, _mm_cmplt_ps(extent[axis], zero));
+    }
+
+    if (m_frustumEnabled)
+    {
+      for (const auto& plane : m_planes)
+      {
+        __m128 distance = _mm_set1_ps(plane[3]);
+        for (int axis = 0; axis < 3; axis++)
+        {
+          distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane[axis]), center[axis]));
+          distance = _mm_add_ps(
+              distance, _mm_mul_ps(_mm_set1_ps(std::fabs(plane[axis])), extent[axis]));
+        }
+        frustumCulled = _mm_or_ps(frustumCulled, _mm_cmplt_ps(distance, zero));
+      }
+    }
+
+    __m128 boxDistanceSquared = zero;
+    __m128 centerDistanceSquared = zero;
+    __m128 radiusSquared = zero;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      __m128 d = _mm_and_ps(_mm_sub_ps(center[axis], camera[axis]), absMask);
+      __m128 outside = _mm_max_ps(_mm_sub_ps(d, extent[axis]), zero);
+      boxDistanceSquared = _mm_add_ps(boxDistanceSquared, _mm_mul_ps(outside, outside));
+      centerDistanceSquared = _mm_add_ps(centerDistanceSquared, _mm_mul_ps(d, d));
+      radiusSquared = _mm_add_ps(radiusSquared, _mm_mul_ps(extent[axis], extent[axis]));
+    }
+    int frustumMask = _mm_movemask_ps(frustumCulled);
+    int distanceMask = m_maxDistanceSquared > 0.f
+                           ? _mm_movemask_ps(_mm_cmpgt_ps(boxDistanceSquared, maxDistanceSquared))
+                           : 0;
+    int screenSizeMask =
+        m_minScreenSizeSquared > 0.f
+            ? _mm_movemask_ps(_mm_cmplt_ps(
+                  radiusSquared, _mm_mul_ps(minScreenSizeSquared, centerDistanceSquared)))
+            : 0;
+
+    for (uint32_t k = 0; k < 4; k++)
+    {
+      CullReason reason = CULL_NONE;
+      if (frustumMask & (1 << k))
+      {
+        reason = CULL_FRUSTUM;
+      }
+      else if (distanceMask & (1 << k))
+      {
+        reason = CULL_DISTANCE;
+      }
+      else if (screenSizeMask & (1 << k))
+      {
+        reason = CULL_SCREEN_SIZE;
+      }
+      culledCounts[reason]++;
+      (*visibility)[i + k] = reason == CULL_NONE ? 1 : 0;
+    }
+  }
+#endif
+
+  for (; i < count; i++)
+  {
+    CullReason reason = Classify(bounds[i]);
+    culledCounts[reason]++;
+    (*visibility)[i] = reason == CULL_NONE ? 1 : 0;
+  }
+
+  stats.visibleCount = culledCounts[CULL_NONE];
+  stats.frustumCulledCount = culledCounts[CULL_FRUSTUM];
+  stats.distanceCulledCount = culledCounts[CULL_DISTANCE];
+  stats.screenSizeCulledCount = culledCounts[CULL_SCREEN_SIZE];
+  return stats;
+}
+} // namespace nv_helpers_dx12
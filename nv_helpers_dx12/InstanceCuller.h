@@ -0,0 +1,139 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The instance culler selects the instances worth adding to a top-level AS for the
+current camera, so that the top-level AS built each frame only contains what can
+contribute to the image. Smaller top-level structures are faster to build and to
+traverse, which matters in large open scenes where most instances are either
+behind the camera or too far away to be visible.
+
+Three tests are available, each enabled independently:
+- Frustum culling removes the instances whose world-space bounds lie entirely
+outside one of the planes of the camera frustum
+- Distance culling removes the instances whose bounds are farther from the
+camera than a given distance
+- Screen-size culling removes the instances whose bounding sphere covers less
+than a given fraction of the viewport height
+
+The bounds are tested 4 at a time using SSE instructions. Each culled instance is
+counted under the first test that removes it, in the order above.
+
+Note that frustum culling only suits primary rays: secondary rays such as
+shadows and reflections may hit instances outside the frustum. The result can
+either be used to skip instances when adding them to the top-level AS, or to set
+their mask to 0 with TopLevelASGenerator::SetInstanceMask, which keeps the
+instance count stable and hence allows refitting the structure.
+
+Example:
+
+nv_helpers_dx12::InstanceCuller culler;
+culler.SetFrustum(XMMatrixMultiply(view, projection));
+culler.SetCameraPosition(cameraPosition);
+culler.SetMaxDistance(500.f);
+culler.SetMinScreenSize(0.002f, fovY);
+
+std::vector<uint8_t> visibility;
+nv_helpers_dx12::InstanceCullingStats stats = culler.Cull(instanceBounds, &visibility);
+for (size_t i = 0; i < instances.size(); i++)
+{
+  if (visibility[i])
+  {
+    topLevelAS.AddInstance(...);
+  }
+}
+
+*/
+
+#pragma once
+
+#include "BVHBuilder.h"
+
+#include <DirectXMath.h>
+
+namespace nv_helpers_dx12
+{
+
+/// Number of instances removed by each test of the culler
+struct InstanceCullingStats
+{
+  uint32_t instanceCount = 0;
+  uint32_t frustumCulledCount = 0;
+  uint32_t distanceCulledCount = 0;
+  uint32_t screenSizeCulledCount = 0;
+  uint32_t visibleCount = 0;
+};
+
+/// Helper class to cull the instances of a top-level AS against the camera
+class InstanceCuller
+{
+public:
+  /// Enable frustum culling, extracting the planes from the view-projection
+  /// matrix, using the DirectXMath conventions and a [0, 1] depth range
+  void SetFrustum(const DirectX::XMMATRIX& viewProjection);
+  /// Disable frustum culling
+  void DisableFrustum() { m_frustumEnabled = false; }
+
+  /// Position of the camera, used by the distance and screen-size tests
+  void SetCameraPosition(const DirectX::XMFLOAT3& position);
+
+  /// Distance beyond which instances are culled, or 0 to disable distance culling
+  void SetMaxDistance(float maxDistance);
+
+  /// Fraction of the viewport height under which the bounding sphere of an
+  /// instance is culled, given the vertical field of view of the camera in
+  /// radians. A fraction of 0 disables screen-size culling.
+  void SetMinScreenSize(float minScreenFraction, float verticalFieldOfView);
+
+  /// Test the world-space bounds of the instances, storing 1 in the visibility
+  /// of the visible instances and 0 in the others. Instances with empty bounds
+  /// are counted as culled by the frustum.
+  InstanceCullingStats Cull(const std::vector<AABB>& bounds,
+                            std::vector<uint8_t>* visibility) const;
+
+private:
+  /// Reason why an instance is culled, from the first test removing it
+  enum CullReason : uint8_t
+  {
+    CULL_NONE = 0,
+    CULL_FRUSTUM = 1,
+    CULL_DISTANCE = 2,
+    CULL_SCREEN_SIZE = 3
+  };
+
+  /// Test a single box with scalar instructions
+  CullReason Classify(const AABB& box) const;
+
+  bool m_frustumEnabled = false;
+  /// Planes of the frustum as (a, b, c, d), the inside verifying ax+by+cz+d >= 0
+  float m_planes[6][4] = {};
+  float m_cameraPosition[3] = {};
+  /// Squared maximum distance, or 0 if distance culling is disabled
+  float m_maxDistanceSquared = 0.f;
+  /// Squared product of the minimum screen fraction and the tangent of the half field of view,
+  /// or 0 if screen-size culling is disabled
+  float m_minScreenSizeSquared = 0.f;
+};
+} // namespace nv_helpers_dx12
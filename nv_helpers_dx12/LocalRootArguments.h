@@ -0,0 +1,226 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Local root arguments of Shader Binding Table records, declared as a list of
+parameter types. The same declaration defines both the local root signature of
+the shaders, through RootSignatureGenerator, and the packed layout of the
+arguments in the SBT records, so that they cannot diverge. The layout follows
+the packing rules of DXR: root constants are 4-byte aligned, while root
+descriptors and descriptor tables are 8-byte aligned. The offsets and the size
+of the arguments are computed at compile time, and the arguments are stored in
+place, without allocation.
+
+Example:
+
+struct MaterialConstants
+{
+  float albedo[3];
+  UINT textureIndex;
+};
+typedef nv_helpers_dx12::LocalRootArguments<
+    nv_helpers_dx12::RootSRVArgument<0>,                       // t0: vertex buffer
+    nv_helpers_dx12::RootConstantsArgument<MaterialConstants, 0>, // b0: material
+    nv_helpers_dx12::DescriptorTableArgument>                  // textures
+    HitArguments;
+
+nv_helpers_dx12::RootSignatureGenerator rsc;
+HitArguments::AddToRootSignature(rsc, {{{D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 8, 1, 0, 0}}});
+m_hitSignature = rsc.Generate(m_device.Get(), true);
+
+HitArguments arguments;
+arguments.Set<0>(m_vertexBuffer->GetGPUVirtualAddress());
+arguments.Set<1>(material);
+arguments.Set<2>(m_srvUavHeap->GetGPUDescriptorHandleForHeapStart());
+m_sbtHelper.AddHitGroup(L"HitGroup", arguments);
+
+*/
+
+#pragma once
+
+#include "RootSignatureGenerator.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace nv_helpers_dx12
+{
+
+/// Root descriptor parameter, whose argument is the GPU address of a buffer
+template <D3D12_ROOT_PARAMETER_TYPE Type, UINT ShaderRegister, UINT RegisterSpace = 0>
+struct RootDescriptorArgument
+{
+  typedef D3D12_GPU_VIRTUAL_ADDRESS ValueType;
+  static const UINT kSize = 8;
+  static const UINT kAlignment = 8;
+
+  static void AddToRootSignature(RootSignatureGenerator& generator,
+                                 const std::vector<std::vector<D3D12_DESCRIPTOR_RANGE>>&, UINT*)
+  {
+    generator.AddRootParameter(Type, ShaderRegister, RegisterSpace);
+  }
+};
+
+template <UINT ShaderRegister, UINT RegisterSpace = 0>
+using RootCBVArgument =
+    RootDescriptorArgument<D3D12_ROOT_PARAMETER_TYPE_CBV, ShaderRegister, RegisterSpace>;
+template <UINT ShaderRegister, UINT RegisterSpace = 0>
+using RootSRVArgument =
+    RootDescriptorArgument<D3D12_ROOT_PARAMETER_TYPE_SRV, ShaderRegister, RegisterSpace>;
+template <UINT ShaderRegister, UINT RegisterSpace = 0>
+using RootUAVArgument =
+    RootDescriptorArgument<D3D12_ROOT_PARAMETER_TYPE_UAV, ShaderRegister, RegisterSpace>;
+
+/// Root constants parameter, whose argument is a structure of 32-bit values stored in the record
+template <typename T, UINT ShaderRegister, UINT RegisterSpace = 0>
+struct RootConstantsArgument
+{
+  static_assert(sizeof(T) % 4 == 0, "Root constants are made of 32-bit values");
+
+  typedef T ValueType;
+  static const UINT kSize = sizeof(T);
+  static const UINT kAlignment = 4;
+
+  static void AddToRootSignature(RootSignatureGenerator& generator,
+                                 const std::vector<std::vector<D3D12_DESCRIPTOR_RANGE>>&, UINT*)
+  {
+    generator.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS, ShaderRegister,
+                               RegisterSpace, kSize / 4);
+  }
+};
+
+/// Descriptor table parameter, whose argument is the GPU handle of the first descriptor of the
+/// table in the heap. The ranges of the table are given when adding it to a root signature.
+struct DescriptorTableArgument
+{
+  typedef D3D12_GPU_DESCRIPTOR_HANDLE ValueType;
+  static const UINT kSize = 8;
+  static const UINT kAlignment = 8;
+
+  static void
+  AddToRootSignature(RootSignatureGenerator& generator,
+                     const std::vector<std::vector<D3D12_DESCRIPTOR_RANGE>>& tableRanges,
+                     UINT* tableIndex)
+  {
+    if (*tableIndex >= tableRanges.size())
+    {
+      throw std::logic_error("Missing the ranges of a descriptor table in the root arguments");
+    }
+    generator.AddHeapRangesParameter(tableRanges[(*tableIndex)++]);
+  }
+};
+
+namespace detail
+{
+constexpr UINT AlignArgument(UINT offset, UINT alignment)
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+/// Offset and type of the parameter at Index, the parameters before it starting at Offset
+template <UINT Offset, size_t Index, typename... Params>
+struct ArgumentLayout;
+
+template <UINT Offset, typename First, typename... Rest>
+struct ArgumentLayout<Offset, 0, First, Rest...>
+{
+  typedef First Type;
+  static const UINT kOffset = AlignArgument(Offset, First::kAlignment);
+};
+
+template <UINT Offset, size_t Index, typename First, typename... Rest>
+struct ArgumentLayout<Offset, Index, First, Rest...>
+    : ArgumentLayout<AlignArgument(Offset, First::kAlignment) + First::kSize, Index - 1, Rest...>
+{
+};
+
+/// End of the arguments of the parameters, starting at Offset
+template <UINT Offset, typename... Params>
+struct ArgumentsEnd
+{
+  static const UINT kValue = Offset;
+};
+
+template <UINT Offset, typename First, typename... Rest>
+struct ArgumentsEnd<Offset, First, Rest...>
+    : ArgumentsEnd<AlignArgument(Offset, First::kAlignment) + First::kSize, Rest...>
+{
+};
+} // namespace detail
+
+/// Packed local root arguments of a record, for the root signature made of Params in order
+template <typename... Params>
+class LocalRootArguments
+{
+public:
+  static const UINT kParameterCount = static_cast<UINT>(sizeof...(Params));
+  /// Size of the arguments in the record, after the shader identifier
+  static const UINT kSize = detail::ArgumentsEnd<0, Params...>::kValue;
+
+  /// Type and offset of a parameter
+  template <size_t Index>
+  using Parameter = typename detail::ArgumentLayout<0, Index, Params...>::Type;
+  template <size_t Index>
+  static constexpr UINT GetOffset()
+  {
+    return detail::ArgumentLayout<0, Index, Params...>::kOffset;
+  }
+
+  /// The arguments are initially zero, including the padding between them
+  LocalRootArguments() { memset(m_data, 0, sizeof(m_data)); }
+
+  /// Set the argument of a parameter, of the type declared by the parameter
+  template <size_t Index>
+  LocalRootArguments& Set(const typename Parameter<Index>::ValueType& value)
+  {
+    static_assert(Index < sizeof...(Params), "Invalid local root parameter index");
+    static_assert(sizeof(value) == Parameter<Index>::kSize, "Unexpected local root argument size");
+    memcpy(m_data + GetOffset<Index>(), &value, sizeof(value));
+    return *this;
+  }
+
+  const uint8_t* GetData() const { return m_data; }
+  static UINT GetSize() { return kSize; }
+
+  /// Add the parameters to a root signature, in order. The ranges of the descriptor tables are
+  /// given in the order of the tables in the parameters.
+  static void AddToRootSignature(
+      RootSignatureGenerator& generator,
+      const std::vector<std::vector<D3D12_DESCRIPTOR_RANGE>>& tableRanges = {})
+  {
+    UINT tableIndex = 0;
+    // The elements of a braced list are evaluated in order
+    int expand[] = {0, (Params::AddToRootSignature(generator, tableRanges, &tableIndex), 0)...};
+    (void)expand;
+    (void)generator;
+    (void)tableRanges;
+  }
+
+private:
+  /// Arguments as written in the record, which is 8-byte aligned after the shader identifier
+  alignas(8) uint8_t m_data[kSize > 0 ? kSize : 1];
+};
+} // namespace nv_helpers_dx12
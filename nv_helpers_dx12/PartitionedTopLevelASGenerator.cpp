@@ -0,0 +1,304 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Top-level acceleration structures partitioned by instance mask. See
+PartitionedTopLevelASGenerator.h for details.
+*/
+
+#include "PartitionedTopLevelASGenerator.h"
+
+#include <stdexcept>
+
+namespace nv_helpers_dx12
+{
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add a partition receiving the instances whose mask has a bit in common with instanceMaskBits
+UINT PartitionedTopLevelASGenerator::AddPartition(UINT8 instanceMaskBits, bool isDynamic)
+{
+  if (instanceMaskBits == 0)
+  {
+    throw std::logic_error("A top-level AS partition requires at least one instance mask bit");
+  }
+  Partition partition;
+  partition.instanceMaskBits = instanceMaskBits;
+  partition.isDynamic = isDynamic;
+  partition.generator.SetThreadPool(m_threadPool);
+  m_partitions.push_back(partition);
+  return static_cast<UINT>(m_partitions.size() - 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add an instance to the first partition matching its mask
+PartitionedTopLevelASGenerator::InstanceHandle PartitionedTopLevelASGenerator::AddInstance(
+    ID3D12Resource* bottomLevelAS,      // Bottom-level AS of the instance
+    const DirectX::XMMATRIX& transform, // Transform of the instance
+    UINT instanceID,                    // Instance ID visible in the shaders
+    UINT hitGroupIndex,                 // Hit group index in the Shader Binding Table
+    UINT8 instanceMask                  // Visibility mask, selecting the partition
+)
+{
+  return AddInstance(bottomLevelAS->GetGPUVirtualAddress(), transform, instanceID, hitGroupIndex,
+                     instanceMask);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add an instance referencing a bottom-level AS by its GPU address
+PartitionedTopLevelASGenerator::InstanceHandle PartitionedTopLevelASGenerator::AddInstance(
+    D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS, // Address of the bottom-level AS
+    const DirectX::XMMATRIX& transform,      // Transform of the instance
+    UINT instanceID,                         // Instance ID visible in the shaders
+    UINT hitGroupIndex,                      // Hit group index in the Shader Binding Table
+    UINT8 instanceMask                       // Visibility mask, selecting the partition
+)
+{
+  InstanceHandle instance;
+  instance.partition = FindPartition(instanceMask);
+  Partition& partition = m_partitions[instance.partition];
+  instance.index = partition.generator.AddInstance(bottomLevelAS, transform, instanceID,
+                                                   hitGroupIndex, instanceMask);
+  partition.instanceMaskUnion |= instanceMask;
+  MarkDirty(instance.partition);
+  return instance;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add an instance moving during the shutter interval
+PartitionedTopLevelASGenerator::InstanceHandle PartitionedTopLevelASGenerator::AddInstance(
+    D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS, // Address of the bottom-level AS
+    const DirectX::XMMATRIX& beginTransform, // Transform at time 0
+    const DirectX::XMMATRIX& endTransform,   // Transform at time 1
+    UINT instanceID,                         // Instance ID visible in the shaders
+    UINT hitGroupIndex,                      // Hit group index in the Shader Binding Table
+    UINT8 instanceMask                       // Visibility mask, selecting the partition
+)
+{
+  InstanceHandle instance;
+  instance.partition = FindPartition(instanceMask);
+  Partition& partition = m_partitions[instance.partition];
+  instance.index = partition.generator.AddInstance(bottomLevelAS, beginTransform, endTransform,
+                                                   instanceID, hitGroupIndex, instanceMask);
+  partition.instanceMaskUnion |= instanceMask;
+  MarkDirty(instance.partition);
+  return instance;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Modify the transform of an instance
+void PartitionedTopLevelASGenerator::SetInstanceTransform(InstanceHandle instance,
+                                                          const DirectX::XMMATRIX& transform)
+{
+  m_partitions.at(instance.partition).generator.SetInstanceTransform(instance.index, transform);
+  MarkDirty(instance.partition);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Modify the transforms of an instance at the beginning and at the end of the shutter interval
+void PartitionedTopLevelASGenerator::SetInstanceMotion(InstanceHandle instance,
+                                                       const DirectX::XMMATRIX& beginTransform,
+                                                       const DirectX::XMMATRIX& endTransform)
+{
+  m_partitions.at(instance.partition)
+      .generator.SetInstanceMotion(instance.index, beginTransform, endTransform);
+  MarkDirty(instance.partition);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Modify the mask of an instance, which stays in its partition
+void PartitionedTopLevelASGenerator::SetInstanceMask(InstanceHandle instance, UINT8 instanceMask)
+{
+  Partition& partition = m_partitions.at(instance.partition);
+  partition.generator.SetInstanceMask(instance.index, instanceMask);
+  partition.instanceMaskUnion |= instanceMask;
+  MarkDirty(instance.partition);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Modify the hit group index of an instance
+void PartitionedTopLevelASGenerator::SetInstanceHitGroupIndex(InstanceHandle instance,
+                                                              UINT hitGroupIndex)
+{
+  m_partitions.at(instance.partition)
+      .generator.SetInstanceHitGroupIndex(instance.index, hitGroupIndex);
+  MarkDirty(instance.partition);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Pool on which the partitions fill their instance descriptors
+void PartitionedTopLevelASGenerator::SetThreadPool(ThreadPool* threadPool)
+{
+  m_threadPool = threadPool;
+  for (auto& partition : m_partitions)
+  {
+    partition.generator.SetThreadPool(threadPool);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Compute the sizes of the buffers of a partition. Only dynamic partitions allow updates.
+void PartitionedTopLevelASGenerator::ComputeASBufferSizes(
+    ID3D12Device5* device,         // Device on which the build will be performed, or nullptr
+    UINT partitionIndex,           // Index of the partition
+    UINT64* scratchSizeInBytes,    // Required scratch memory
+    UINT64* resultSizeInBytes,     // Required memory for the structure
+    UINT64* descriptorsSizeInBytes // Required memory for the instance descriptors
+)
+{
+  Partition& partition = m_partitions.at(partitionIndex);
+  partition.generator.ComputeASBufferSizes(device, partition.isDynamic, scratchSizeInBytes,
+                                           resultSizeInBytes, descriptorsSizeInBytes);
+  partition.rebuildRequired = true;
+  partition.gpuDirty = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Enqueue the builds of the partitions whose instances changed since their last build
+UINT PartitionedTopLevelASGenerator::Generate(
+    ID3D12GraphicsCommandList4* commandList, // Command list on which the builds are enqueued
+    const PartitionBuffers* buffers          // Buffers of each partition
+)
+{
+  UINT builtCount = 0;
+  for (UINT i = 0; i < GetPartitionCount(); i++)
+  {
+    Partition& partition = m_partitions[i];
+    if (!partition.gpuDirty)
+    {
+      continue;
+    }
+    const PartitionBuffers& partitionBuffers = buffers[i];
+    if (!partitionBuffers.scratch || !partitionBuffers.result || !partitionBuffers.descriptors)
+    {
+      throw std::logic_error("Missing buffers for a top-level AS partition");
+    }
+
+    // Static partitions do not allow updates, and are rebuilt whenever they change
+    bool updateOnly = partition.isDynamic && !partition.rebuildRequired;
+    partition.generator.Generate(commandList, partitionBuffers.scratch, partitionBuffers.result,
+                                 partitionBuffers.descriptors, updateOnly,
+                                 updateOnly ? partitionBuffers.result : nullptr);
+    partition.gpuDirty = false;
+    partition.rebuildRequired = false;
+    builtCount++;
+  }
+  return builtCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build the CPU hierarchies of the partitions whose instances changed since the last call
+void PartitionedTopLevelASGenerator::GenerateOnCPU(
+    const std::unordered_map<D3D12_GPU_VIRTUAL_ADDRESS, const BVH*>&
+        bottomLevelHierarchies,        // CPU hierarchy of each bottom-level AS, by address
+    std::vector<TopLevelBVH>* results, // Hierarchy of each partition
+    const BVHBuilder& builder /*= BVHBuilder()*/ // Builder and its settings
+)
+{
+  // Partitions added since the last call have no hierarchy yet, and are dirty
+  results->resize(m_partitions.size());
+  for (UINT i = 0; i < GetPartitionCount(); i++)
+  {
+    Partition& partition = m_partitions[i];
+    if (partition.cpuDirty)
+    {
+      partition.generator.GenerateOnCPU(bottomLevelHierarchies, &(*results)[i], builder);
+      partition.cpuDirty = false;
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the closest intersection of a ray with the CPU hierarchies of the partitions
+bool PartitionedTopLevelASGenerator::Intersect(
+    const std::vector<TopLevelBVH>& hierarchies, // Hierarchies of the partitions
+    const BVHRay& ray,                           // Ray, with its time for moving instances
+    UINT8 instanceInclusionMask,                 // Mask of the ray, as given to TraceRay
+    TopLevelBVHHit* hit,                         // Closest intersection
+    UINT* hitPartition /*= nullptr*/,            // Partition of the closest intersection
+    BVHTraversalStats* traversalStats /*= nullptr*/ // Optional traversal statistics
+) const
+{
+  // Each partition is traversed with the ray shortened to the closest intersection so far
+  BVHRay closestRay = ray;
+  bool found = false;
+  for (UINT i = 0; i < GetPartitionCount() && i < hierarchies.size(); i++)
+  {
+    if ((m_partitions[i].instanceMaskUnion & instanceInclusionMask) == 0)
+    {
+      continue;
+    }
+    TopLevelBVHHit partitionHit;
+    if (hierarchies[i].Intersect(closestRay, instanceInclusionMask, &partitionHit,
+                                 traversalStats))
+    {
+      *hit = partitionHit;
+      closestRay.tMax = partitionHit.t;
+      found = true;
+      if (hitPartition)
+      {
+        *hitPartition = i;
+      }
+    }
+  }
+  return found;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Index of the partition receiving an instance mask
+UINT PartitionedTopLevelASGenerator::FindPartition(UINT8 instanceMask) const
+{
+  for (UINT i = 0; i < GetPartitionCount(); i++)
+  {
+    if ((m_partitions[i].instanceMaskBits & instanceMask) != 0)
+    {
+      return i;
+    }
+  }
+  throw std::logic_error("No top-level AS partition receives the instance mask");
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Mark a partition for the next builds on the GPU and the CPU
+void PartitionedTopLevelASGenerator::MarkDirty(UINT partition)
+{
+  m_partitions[partition].gpuDirty = true;
+  m_partitions[partition].cpuDirty = true;
+}
+} // namespace nv_helpers_dx12
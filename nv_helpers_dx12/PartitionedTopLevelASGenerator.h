@@ -0,0 +1,223 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Top-level acceleration structures partitioned by instance mask, so that parts of
+the scene changing at different rates are built separately. Each partition is
+defined by bits of the instance mask, and receives the instances whose mask
+has a bit in common with it. An instance is added to the first matching
+partition, in the order in which the partitions were added. Typical partitions
+are the static world, the dynamic actors and the shadow-only proxies.
+
+Each partition is a separate top-level AS with its own buffers. Generate only
+builds the partitions whose instances changed since their last build: static
+partitions are typically built once, while dynamic partitions allow updates and
+are refitted in place whenever their instances move. The shaders trace rays
+against each partition, and can skip the partitions whose instance mask has no
+bit in common with the mask of the ray, see GetPartitionInstanceMask.
+
+Example:
+
+nv_helpers_dx12::PartitionedTopLevelASGenerator topLevelAS;
+UINT worldPartition = topLevelAS.AddPartition(kWorldMask, false);
+UINT actorPartition = topLevelAS.AddPartition(kActorMask, true);
+UINT proxyPartition = topLevelAS.AddPartition(kShadowProxyMask, false);
+topLevelAS.AddInstance(buildingBlas, buildingMatrix, 0, 0, kWorldMask);
+auto actor = topLevelAS.AddInstance(characterBlas, characterMatrix, 1, 1, kActorMask);
+
+std::vector<nv_helpers_dx12::PartitionedTopLevelASGenerator::PartitionBuffers> buffers(3);
+for (UINT i = 0; i < topLevelAS.GetPartitionCount(); i++)
+{
+  UINT64 scratchSize, resultSize, descriptorsSize;
+  topLevelAS.ComputeASBufferSizes(GetRTDevice(), i, &scratchSize, &resultSize, &descriptorsSize);
+  buffers[i].scratch = nv_helpers_dx12::CreateBuffer(..., scratchSize, ...);
+  ...
+}
+topLevelAS.Generate(m_commandList.Get(), buffers.data());
+
+Each frame, only the actor partition is refitted:
+
+topLevelAS.SetInstanceTransform(actor, newCharacterMatrix);
+topLevelAS.Generate(m_commandList.Get(), buffers.data());
+
+The partitions can also be built on the CPU, and traced together with
+Intersect, which interpolates the transforms of moving instances at the time of
+the ray as TopLevelBVH does.
+
+*/
+
+#pragma once
+
+#include "TopLevelASGenerator.h"
+
+namespace nv_helpers_dx12
+{
+
+/// Set of top-level acceleration structures, each receiving the instances of a range of masks
+class PartitionedTopLevelASGenerator
+{
+public:
+  /// Location of an instance: its partition, and its index in the partition
+  struct InstanceHandle
+  {
+    UINT partition;
+    UINT index;
+  };
+
+  /// Buffers of a partition, allocated by the application with the sizes given by
+  /// ComputeASBufferSizes
+  struct PartitionBuffers
+  {
+    ID3D12Resource* scratch = nullptr;
+    ID3D12Resource* result = nullptr;
+    /// Instance descriptors, in the upload heap
+    ID3D12Resource* descriptors = nullptr;
+  };
+
+  /// Add a partition receiving the instances whose mask has a bit in common with
+  /// instanceMaskBits, and not received by a previous partition. Dynamic partitions allow
+  /// updates, and are refitted when their instances change. Returns the index of the partition.
+  UINT AddPartition(UINT8 instanceMaskBits, bool isDynamic);
+
+  /// Number of partitions, that is of top-level acceleration structures
+  UINT GetPartitionCount() const { return static_cast<UINT>(m_partitions.size()); }
+
+  /// Add an instance to the first partition matching its mask. Throws if no partition does.
+  InstanceHandle AddInstance(ID3D12Resource* bottomLevelAS, /// Bottom-level AS of the instance
+                             const DirectX::XMMATRIX& transform, /// Transform of the instance
+                             UINT instanceID,    /// Instance ID visible in the shaders
+                             UINT hitGroupIndex, /// Hit group index in the Shader Binding Table
+                             UINT8 instanceMask  /// Visibility mask, selecting the partition
+  );
+  InstanceHandle AddInstance(D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS, /// Address of the
+                                                                      /// bottom-level AS
+                             const DirectX::XMMATRIX& transform, /// Transform of the instance
+                             UINT instanceID,    /// Instance ID visible in the shaders
+                             UINT hitGroupIndex, /// Hit group index in the Shader Binding Table
+                             UINT8 instanceMask  /// Visibility mask, selecting the partition
+  );
+
+  /// Add an instance moving during the shutter interval, see TopLevelASGenerator::AddInstance
+  InstanceHandle AddInstance(D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS, /// Address of the
+                                                                      /// bottom-level AS
+                             const DirectX::XMMATRIX& beginTransform, /// Transform at time 0
+                             const DirectX::XMMATRIX& endTransform,   /// Transform at time 1
+                             UINT instanceID,    /// Instance ID visible in the shaders
+                             UINT hitGroupIndex, /// Hit group index in the Shader Binding Table
+                             UINT8 instanceMask  /// Visibility mask, selecting the partition
+  );
+
+  /// Modify an instance, marking its partition for the next build. An instance stays in its
+  /// partition when its mask changes.
+  void SetInstanceTransform(InstanceHandle instance, const DirectX::XMMATRIX& transform);
+  void SetInstanceMotion(InstanceHandle instance, const DirectX::XMMATRIX& beginTransform,
+                         const DirectX::XMMATRIX& endTransform);
+  void SetInstanceMask(InstanceHandle instance, UINT8 instanceMask);
+  void SetInstanceHitGroupIndex(InstanceHandle instance, UINT hitGroupIndex);
+
+  /// Union of the masks of the instances of a partition. A ray whose mask has no bit in common
+  /// with it cannot hit the partition. The union is conservative, as it is not reduced when the
+  /// mask of an instance changes.
+  UINT8 GetPartitionInstanceMask(UINT partition) const
+  {
+    return m_partitions.at(partition).instanceMaskUnion;
+  }
+
+  bool IsPartitionDynamic(UINT partition) const { return m_partitions.at(partition).isDynamic; }
+
+  /// Generator of a partition, for instance to query WasLastBuildUpdate
+  const TopLevelASGenerator& GetPartition(UINT partition) const
+  {
+    return m_partitions.at(partition).generator;
+  }
+
+  /// Pool on which the partitions fill their instance descriptors, see
+  /// TopLevelASGenerator::SetThreadPool
+  void SetThreadPool(ThreadPool* threadPool);
+
+  /// Compute the sizes of the buffers of a partition, once its instances have been added. The
+  /// partition is then rebuilt entirely by the next call to Generate, with new buffers.
+  void ComputeASBufferSizes(ID3D12Device5* device, /// Device on which the build will be
+                                                   /// performed, or nullptr to estimate the sizes
+                            UINT partition,      /// Index of the partition
+                            UINT64* scratchSizeInBytes,    /// Required scratch memory
+                            UINT64* resultSizeInBytes,     /// Required memory for the structure
+                            UINT64* descriptorsSizeInBytes /// Required memory for the instance
+                                                           /// descriptors
+  );
+
+  /// Enqueue the builds of the partitions whose instances changed since their last build. Static
+  /// partitions are rebuilt, and dynamic ones refitted in place unless their buffers were resized
+  /// or their instances moved too much. Returns the number of partitions built.
+  UINT Generate(ID3D12GraphicsCommandList4* commandList, /// Command list on which the builds
+                                                           /// are enqueued
+                  const PartitionBuffers* buffers /// Buffers of each partition
+  );
+
+  /// Build the CPU hierarchies of the partitions whose instances changed since the last call,
+  /// which must be given the same results. See TopLevelASGenerator::GenerateOnCPU.
+  void GenerateOnCPU(
+      const std::unordered_map<D3D12_GPU_VIRTUAL_ADDRESS, const BVH*>&
+          bottomLevelHierarchies,           /// CPU hierarchy of each bottom-level AS, by address
+      std::vector<TopLevelBVH>* results,    /// Hierarchy of each partition
+      const BVHBuilder& builder = BVHBuilder() /// Builder and its settings
+  );
+
+  /// Find the closest intersection of a ray with the CPU hierarchies of the partitions, skipping
+  /// the partitions the ray cannot hit. Returns true if an intersection was found, along with its
+  /// partition.
+  bool Intersect(const std::vector<TopLevelBVH>& hierarchies, /// Hierarchies of the partitions,
+                                                              /// built by GenerateOnCPU
+                 const BVHRay& ray,            /// Ray, with its time for moving instances
+                 UINT8 instanceInclusionMask,  /// Mask of the ray, as given to TraceRay
+                 TopLevelBVHHit* hit,          /// Closest intersection
+                 UINT* hitPartition = nullptr, /// Partition of the closest intersection
+                 BVHTraversalStats* traversalStats = nullptr /// Optional traversal statistics
+  ) const;
+
+private:
+  struct Partition
+  {
+    TopLevelASGenerator generator;
+    UINT8 instanceMaskBits = 0;
+    UINT8 instanceMaskUnion = 0;
+    bool isDynamic = false;
+    /// True if the instances changed since the last build on the GPU, and on the CPU
+    bool gpuDirty = true;
+    bool cpuDirty = true;
+    /// True if the buffers were resized, requiring a full build
+    bool rebuildRequired = true;
+  };
+
+  /// Index of the partition receiving an instance mask
+  UINT FindPartition(UINT8 instanceMask) const;
+
+  /// Mark a partition for the next builds on the GPU and the CPU
+  void MarkDirty(UINT partition);
+
+  std::vector<Partition> m_partitions;
+  ThreadPool* m_threadPool = nullptr;
+};
+} // namespace nv_helpers_dx12
@@ -0,0 +1,227 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Hierarchy of transforms with lazy world matrix propagation, driving the
+instances of a top-level AS. See SceneGraph.h for details.
+*/
+
+#include "SceneGraph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace nv_helpers_dx12
+{
+
+const UINT SceneGraph::kNoParent;
+const UINT SceneGraph::kNoInstance;
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add a node at the end of the arrays. As its parent was added before, the parent slot precedes
+// the slot of the node, so that the arrays remain ordered parents first until the next layout
+UINT SceneGraph::AddNode(UINT parent, const DirectX::XMMATRIX& localTransform,
+                         UINT instanceIndex /*= kNoInstance*/)
+{
+  if (parent != kNoParent && parent >= m_slots.size())
+  {
+    throw std::logic_error("The parent of a scene graph node must be added before the node");
+  }
+
+  auto node = static_cast<UINT>(m_slots.size());
+  auto slot = static_cast<UINT>(m_nodes.size());
+  m_slots.push_back(slot);
+  m_parentSlots.push_back(parent == kNoParent ? kNoParent : m_slots[parent]);
+  m_nodes.push_back(node);
+  DirectX::XMFLOAT4X4 transform;
+  DirectX::XMStoreFloat4x4(&transform, localTransform);
+  m_localTransforms.push_back(transform);
+  m_worldTransforms.push_back(transform);
+  m_instanceIndices.push_back(instanceIndex);
+  m_dirty.push_back(1);
+
+  m_firstDirtySlot = (std::min)(m_firstDirtySlot, slot);
+  m_layoutDirty = true;
+  return node;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Change the transform of a node relative to its parent, marking the node dirty
+void SceneGraph::SetLocalTransform(UINT node, const DirectX::XMMATRIX& localTransform)
+{
+  UINT slot = m_slots.at(node);
+  DirectX::XMStoreFloat4x4(&m_localTransforms[slot], localTransform);
+  m_dirty[slot] = 1;
+  m_firstDirtySlot = (std::min)(m_firstDirtySlot, slot);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// World transform of a node, as computed by the last Update
+DirectX::XMMATRIX SceneGraph::GetWorldTransform(UINT node) const
+{
+  return DirectX::XMLoadFloat4x4(&m_worldTransforms[m_slots.at(node)]);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Recompute the world transforms of the dirty nodes and their descendants in a single forward pass
+// over the slots. A node is recomputed if it is dirty or if its parent was recomputed during the
+// pass, which is known when the node is reached since parents precede their children. The pass
+// starts at the first dirty slot, as no node before it can change.
+UINT SceneGraph::Update(TopLevelASGenerator* topLevelAS /*= nullptr*/)
+{
+  if (m_layoutDirty)
+  {
+    UpdateLayout();
+  }
+
+  auto slotCount = static_cast<UINT>(m_nodes.size());
+  UINT updatedCount = 0;
+  for (UINT slot = m_firstDirtySlot; slot < slotCount; slot++)
+  {
+    UINT parentSlot = m_parentSlots[slot];
+    if (!m_dirty[slot] && (parentSlot == kNoParent || !m_dirty[parentSlot]))
+    {
+      continue;
+    }
+    m_dirty[slot] = 1;
+
+    // DirectXMath transforms row vectors, so that the local transform is applied first
+    DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4(&m_localTransforms[slot]);
+    if (parentSlot != kNoParent)
+    {
+      world = DirectX::XMMatrixMultiply(world,
+                                        DirectX::XMLoadFloat4x4(&m_worldTransforms[parentSlot]));
+    }
+    DirectX::XMStoreFloat4x4(&m_worldTransforms[slot], world);
+    if (topLevelAS && m_instanceIndices[slot] != kNoInstance)
+    {
+      topLevelAS->SetInstanceTransform(m_instanceIndices[slot], world);
+    }
+    updatedCount++;
+  }
+
+  // The dirty flags are cleared once the pass is complete, as they propagate the changes to the
+  // children during the pass
+  for (UINT slot = m_firstDirtySlot; slot < slotCount; slot++)
+  {
+    m_dirty[slot] = 0;
+  }
+  m_firstDirtySlot = slotCount;
+  return updatedCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Reorder the nodes breadth-first: the roots first, then their children, and so on, the children
+// of each node being contiguous and in the order they were added. The children lists are built as
+// offsets in a single array, by counting the children of each node.
+void SceneGraph::UpdateLayout()
+{
+  auto nodeCount = static_cast<UINT>(m_slots.size());
+
+  // Parent of each node, and the children of each node in the order they were added
+  std::vector<UINT> parents(nodeCount);
+  std::vector<UINT> childOffsets(nodeCount + 1, 0);
+  for (UINT node = 0; node < nodeCount; node++)
+  {
+    UINT parentSlot = m_parentSlots[m_slots[node]];
+    parents[node] = parentSlot == kNoParent ? kNoParent : m_nodes[parentSlot];
+    if (parents[node] != kNoParent)
+    {
+      childOffsets[parents[node] + 1]++;
+    }
+  }
+  for (UINT node = 0; node < nodeCount; node++)
+  {
+    childOffsets[node + 1] += childOffsets[node];
+  }
+  std::vector<UINT> children(childOffsets[nodeCount]);
+  std::vector<UINT> childCounts(nodeCount, 0);
+  for (UINT node = 0; node < nodeCount; node++)
+  {
+    if (parents[node] != kNoParent)
+    {
+      children[childOffsets[parents[node]] + childCounts[parents[node]]++] = node;
+    }
+  }
+
+  // The order itself is used as the queue of the traversal
+  std::vector<UINT> order;
+  order.reserve(nodeCount);
+  for (UINT node = 0; node < nodeCount; node++)
+  {
+    if (parents[node] == kNoParent)
+    {
+      order.push_back(node);
+    }
+  }
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    UINT node = order[i];
+    order.insert(order.end(), children.begin() + childOffsets[node],
+                 children.begin() + childOffsets[node + 1]);
+  }
+
+  // Permute the arrays into the new order
+  std::vector<UINT> slots(nodeCount);
+  for (UINT slot = 0; slot < nodeCount; slot++)
+  {
+    slots[order[slot]] = slot;
+  }
+  std::vector<UINT> parentSlots(nodeCount);
+  std::vector<DirectX::XMFLOAT4X4> localTransforms(nodeCount);
+  std::vector<DirectX::XMFLOAT4X4> worldTransforms(nodeCount);
+  std::vector<UINT> instanceIndices(nodeCount);
+  std::vector<uint8_t> dirty(nodeCount);
+  m_firstDirtySlot = nodeCount;
+  for (UINT slot = 0; slot < nodeCount; slot++)
+  {
+    UINT node = order[slot];
+    UINT oldSlot = m_slots[node];
+    parentSlots[slot] = parents[node] == kNoParent ? kNoParent : slots[parents[node]];
+    localTransforms[slot] = m_localTransforms[oldSlot];
+    worldTransforms[slot] = m_worldTransforms[oldSlot];
+    instanceIndices[slot] = m_instanceIndices[oldSlot];
+    dirty[slot] = m_dirty[oldSlot];
+    if (dirty[slot])
+    {
+      m_firstDirtySlot = (std::min)(m_firstDirtySlot, slot);
+    }
+  }
+
+  m_slots = std::move(slots);
+  m_parentSlots = std::move(parentSlots);
+  m_nodes = std::move(order);
+  m_localTransforms = std::move(localTransforms);
+  m_worldTransforms = std::move(worldTransforms);
+  m_instanceIndices = std::move(instanceIndices);
+  m_dirty = std::move(dirty);
+  m_layoutDirty = false;
+}
+} // namespace nv_helpers_dx12
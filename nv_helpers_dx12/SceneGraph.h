@@ -0,0 +1,121 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The scene graph organizes the instances of a top-level AS into a hierarchy of
+nodes, each with a transform relative to its parent. Moving a node moves its
+whole subtree, as for the bones of a rig or the parts of a vehicle.
+
+World matrices are recomputed lazily: changing the local transform of a node
+only marks it dirty, and Update recomputes the world matrices of the dirty
+nodes and of their descendants, leaving the rest of the scene untouched. Nodes
+referencing a top-level AS instance then push their new world matrix to the
+generator with SetInstanceTransform, so that only those instances are marked
+dirty, and the next Generate only rewrites their descriptors.
+
+The nodes are stored in breadth-first order: parents precede their children,
+and the children of a node are contiguous. Update is then a single forward pass
+over linear arrays, starting at the first dirty node, in which the world matrix
+of the parent of a node is always up to date when the node is reached. The
+layout is recomputed by Update after nodes were added, which only requires
+parents to be added before their children.
+
+Example:
+
+nv_helpers_dx12::SceneGraph sceneGraph;
+UINT body = sceneGraph.AddNode(nv_helpers_dx12::SceneGraph::kNoParent, bodyTransform,
+                               topLevelAS.AddInstance(bodyBlas, bodyTransform, 0, 0));
+UINT wheel = sceneGraph.AddNode(body, wheelOffset,
+                                topLevelAS.AddInstance(wheelBlas, wheelOffset, 1, 0));
+sceneGraph.Update(&topLevelAS);
+...
+sceneGraph.SetLocalTransform(body, newBodyTransform);
+sceneGraph.Update(&topLevelAS); // Moves the body and the wheel instances
+topLevelAS.Generate(...);
+
+*/
+
+#pragma once
+
+#include "TopLevelASGenerator.h"
+
+#include <DirectXMath.h>
+
+#include <vector>
+
+namespace nv_helpers_dx12
+{
+
+/// Hierarchy of transforms driving the instances of a top-level AS
+class SceneGraph
+{
+public:
+  /// Parent of the root nodes
+  static const UINT kNoParent = ~0u;
+  /// Instance index of the nodes not referencing any top-level AS instance
+  static const UINT kNoInstance = ~0u;
+
+  /// Add a node with a transform relative to its parent, which must have been added before.
+  /// The node can drive the transform of an instance of the top-level AS. Returns the index of
+  /// the node, which remains valid when the layout changes.
+  UINT AddNode(UINT parent, const DirectX::XMMATRIX& localTransform,
+               UINT instanceIndex = kNoInstance);
+
+  /// Change the transform of a node relative to its parent, marking the node dirty
+  void SetLocalTransform(UINT node, const DirectX::XMMATRIX& localTransform);
+
+  /// World transform of a node, as computed by the last Update
+  DirectX::XMMATRIX GetWorldTransform(UINT node) const;
+
+  /// Number of nodes in the graph
+  UINT GetNodeCount() const { return static_cast<UINT>(m_slots.size()); }
+
+  /// Recompute the world transforms of the dirty nodes and their descendants, and set the
+  /// transforms of the instances they reference in the optional top-level AS generator. Returns
+  /// the number of recomputed world transforms.
+  UINT Update(TopLevelASGenerator* topLevelAS = nullptr);
+
+private:
+  /// Reorder the nodes breadth-first
+  void UpdateLayout();
+
+  /// Slot of each node in the arrays below, which are in breadth-first order
+  std::vector<UINT> m_slots;
+  /// Slot of the parent of each node, or kNoParent for the roots
+  std::vector<UINT> m_parentSlots;
+  /// Index of the node stored in each slot
+  std::vector<UINT> m_nodes;
+  std::vector<DirectX::XMFLOAT4X4> m_localTransforms;
+  std::vector<DirectX::XMFLOAT4X4> m_worldTransforms;
+  std::vector<UINT> m_instanceIndices;
+  /// True if the world transform of the node has to be recomputed
+  std::vector<uint8_t> m_dirty;
+
+  /// First dirty slot, or the slot count if no node is dirty
+  UINT m_firstDirtySlot = 0;
+  /// True if nodes were added since the last breadth-first layout
+  bool m_layoutDirty = false;
+};
+} // namespace nv_helpers_dx12
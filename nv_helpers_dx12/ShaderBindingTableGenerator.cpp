@@ -36,6 +36,10 @@ dispatch rays description.
 
 #include "ShaderBindingTableGenerator.h"
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
 // Helper to compute aligned buffer sizes
 #ifndef ROUND_UP
 #define ROUND_UP(v, powerOf2Alignment) (((v) + (powerOf2Alignment)-1) & ~((powerOf2Alignment)-1))
@@ -48,30 +52,219 @@ namespace nv_helpers_dx12
 //
 // Add a ray generation program by name, with its list of data pointers or values according to
 // the layout of its root signature
-void ShaderBindingTableGenerator::AddRayGenerationProgram(const std::wstring& entryPoint,
-                                                          const std::vector<void*>& inputData)
+SBTRecordHandle
+ShaderBindingTableGenerator::AddRayGenerationProgram(const std::wstring& entryPoint,
+                                                     const std::vector<void*>& inputData)
 {
-  m_rayGen.emplace_back(SBTEntry(entryPoint, inputData));
+  return AddEntry(SBT_SECTION_RAY_GENERATION, entryPoint, inputData.data(),
+                  8 * static_cast<uint32_t>(inputData.size()));
 }
 
 //--------------------------------------------------------------------------------------------------
 //
 // Add a miss program by name, with its list of data pointers or values according to
 // the layout of its root signature
-void ShaderBindingTableGenerator::AddMissProgram(const std::wstring& entryPoint,
-                                                 const std::vector<void*>& inputData)
+SBTRecordHandle ShaderBindingTableGenerator::AddMissProgram(const std::wstring& entryPoint,
+                                                            const std::vector<void*>& inputData)
 {
-  m_miss.emplace_back(SBTEntry(entryPoint, inputData));
+  return AddEntry(SBT_SECTION_MISS, entryPoint, inputData.data(),
+                  8 * static_cast<uint32_t>(inputData.size()));
 }
 
 //--------------------------------------------------------------------------------------------------
 //
 // Add a hit group by name, with its list of data pointers or values according to
 // the layout of its root signature
-void ShaderBindingTableGenerator::AddHitGroup(const std::wstring& entryPoint,
-                                              const std::vector<void*>& inputData)
+SBTRecordHandle ShaderBindingTableGenerator::AddHitGroup(const std::wstring& entryPoint,
+                                                         const std::vector<void*>& inputData)
+{
+  return AddEntry(SBT_SECTION_HIT_GROUP, entryPoint, inputData.data(),
+                  8 * static_cast<uint32_t>(inputData.size()));
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add a hit group record, or return an identical one added by this function
+SBTRecordHandle ShaderBindingTableGenerator::AddSharedHitGroup(const std::wstring& entryPoint,
+                                                               const std::vector<void*>& inputData)
+{
+  return AddSharedEntry(entryPoint, inputData.data(), 8 * static_cast<uint32_t>(inputData.size()));
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Replace the data pointers or values of a record, which is written by the next call to Update
+void ShaderBindingTableGenerator::UpdateRecord(SBTRecordHandle record,
+                                               const std::vector<void*>& inputData)
 {
-  m_hitGroup.emplace_back(SBTEntry(entryPoint, inputData));
+  UpdateRecordData(record, inputData.data(), 8 * static_cast<uint32_t>(inputData.size()));
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Replace the arguments of a record, as packed in the record
+void ShaderBindingTableGenerator::UpdateRecordData(SBTRecordHandle record, const void* arguments,
+                                                   uint32_t argumentSize)
+{
+  std::vector<SBTEntry>& entries = GetSection(record.section);
+  if (record.index >= entries.size())
+  {
+    throw std::logic_error("Invalid shader binding table record");
+  }
+  SBTEntry& entry = entries[record.index];
+
+  // Before the record is placed by ComputeSBTSize, it is simply written by Generate
+  if (record.index < m_sectionLayouts[record.section].recordSubTables.size())
+  {
+    if (m_progIdSize + argumentSize > GetRecordEntrySize(record))
+    {
+      throw std::logic_error(
+          "Updated shader binding table record exceeds the entry size of its table");
+    }
+    // Previous arguments which are no longer used are cleared
+    uint32_t dirtySize = (std::max)(entry.m_argumentSize, argumentSize);
+    if (dirtySize != 0)
+    {
+      SIZE_T begin = static_cast<SIZE_T>(GetRecordOffset(record)) + m_progIdSize;
+      SIZE_T end = begin + dirtySize;
+      bool pendingEmpty = m_dirtyRecords.empty();
+      m_pendingRange.Begin = pendingEmpty ? begin : (std::min)(m_pendingRange.Begin, begin);
+      m_pendingRange.End = pendingEmpty ? end : (std::max)(m_pendingRange.End, end);
+      if (entry.m_dirtyIndex == ~0u)
+      {
+        entry.m_dirtyIndex = static_cast<UINT>(m_dirtyRecords.size());
+        m_dirtyRecords.push_back(record);
+        m_dirtyRecordSizes.push_back(dirtySize);
+      }
+      else
+      {
+        m_dirtyRecordSizes[entry.m_dirtyIndex] =
+            (std::max)(m_dirtyRecordSizes[entry.m_dirtyIndex], dirtySize);
+      }
+    }
+  }
+
+  // A shared record is found by its new contents once updated
+  bool isShared = record.section == SBT_SECTION_HIT_GROUP && RemoveSharedHitGroup(record.index);
+
+  // The arguments are replaced in place when they fit, and appended otherwise
+  if (argumentSize > entry.m_argumentCapacity)
+  {
+    entry.m_argumentOffset = StoreArguments(arguments, argumentSize);
+    entry.m_argumentCapacity = argumentSize;
+  }
+  else if (argumentSize != 0)
+  {
+    memcpy(m_argumentData.data() + entry.m_argumentOffset, arguments, argumentSize);
+  }
+  entry.m_argumentSize = argumentSize;
+
+  if (isShared)
+  {
+    m_sharedHitGroups.emplace(HashRecord(entry.m_exportIndex, arguments, argumentSize),
+                              record.index);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add an entry to a section, with its arguments as packed in the record
+SBTRecordHandle ShaderBindingTableGenerator::AddEntry(SBTSection section,
+                                                      const std::wstring& entryPoint,
+                                                      const void* arguments, uint32_t argumentSize)
+{
+  std::vector<SBTEntry>& entries = GetSection(section);
+  entries.emplace_back(SBTEntry(m_identifierCache.InternExport(entryPoint),
+                                StoreArguments(arguments, argumentSize), argumentSize));
+  return {section, static_cast<UINT>(entries.size() - 1)};
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add a hit group record, or find an identical one among the shared records
+SBTRecordHandle ShaderBindingTableGenerator::AddSharedEntry(const std::wstring& entryPoint,
+                                                            const void* arguments,
+                                                            uint32_t argumentSize)
+{
+  UINT exportIndex = m_identifierCache.InternExport(entryPoint);
+  uint64_t hash = HashRecord(exportIndex, arguments, argumentSize);
+
+  // Records with the same hash are compared, since the hash can collide
+  auto candidates = m_sharedHitGroups.equal_range(hash);
+  for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+  {
+    const SBTEntry& entry = m_hitGroup[candidate->second];
+    if (entry.m_exportIndex == exportIndex && entry.m_argumentSize == argumentSize &&
+        (argumentSize == 0 ||
+         memcmp(m_argumentData.data() + entry.m_argumentOffset, arguments, argumentSize) == 0))
+    {
+      m_sharedHitGroupReuseCount++;
+      return {SBT_SECTION_HIT_GROUP, candidate->second};
+    }
+  }
+
+  m_hitGroup.emplace_back(
+      SBTEntry(exportIndex, StoreArguments(arguments, argumentSize), argumentSize));
+  UINT index = static_cast<UINT>(m_hitGroup.size() - 1);
+  m_sharedHitGroups.emplace(hash, index);
+  return {SBT_SECTION_HIT_GROUP, index};
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Hash the program and arguments of a record with FNV-1a. The arguments are small, and are
+// hashed once per shared record added.
+uint64_t ShaderBindingTableGenerator::HashRecord(UINT exportIndex, const void* arguments,
+                                                 uint32_t argumentSize)
+{
+  uint64_t hash = 0xCBF29CE484222325ull;
+  auto mix = [&hash](const uint8_t* bytes, size_t count) {
+    for (size_t i = 0; i < count; i++)
+    {
+      hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+  };
+  mix(reinterpret_cast<const uint8_t*>(&exportIndex), sizeof(exportIndex));
+  mix(static_cast<const uint8_t*>(arguments), argumentSize);
+  return hash;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Remove a hit group record from the shared records, returning false if it is not shared
+bool ShaderBindingTableGenerator::RemoveSharedHitGroup(UINT index)
+{
+  if (m_sharedHitGroups.empty())
+  {
+    return false;
+  }
+  const SBTEntry& entry = m_hitGroup[index];
+  auto candidates = m_sharedHitGroups.equal_range(HashRecord(
+      entry.m_exportIndex, m_argumentData.data() + entry.m_argumentOffset, entry.m_argumentSize));
+  for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+  {
+    if (candidate->second == index)
+    {
+      m_sharedHitGroups.erase(candidate);
+      return true;
+    }
+  }
+  return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Append arguments to the shared argument storage, returning their offset
+size_t ShaderBindingTableGenerator::StoreArguments(const void* arguments, uint32_t argumentSize)
+{
+  // Each entry starts 8-byte aligned, as its arguments in the record
+  size_t offset = ROUND_UP(m_argumentData.size(), static_cast<size_t>(8));
+  m_argumentData.resize(offset + argumentSize);
+  if (argumentSize != 0)
+  {
+    memcpy(m_argumentData.data() + offset, arguments, argumentSize);
+  }
+  return offset;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -82,18 +275,24 @@ uint32_t ShaderBindingTableGenerator::ComputeSBTSize()
   // Size of a program identifier
   m_progIdSize = D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT;
   // Compute the entry size of each program type depending on the maximum number of parameters in
-  // each category
-  m_rayGenEntrySize = GetEntrySize(m_rayGen);
+  // each category. Each ray generation record is the start of a table in DispatchRays.
+  m_rayGenEntrySize =
+      ROUND_UP(GetEntrySize(m_rayGen), D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
   m_missEntrySize = GetEntrySize(m_miss);
   m_hitGroupEntrySize = GetEntrySize(m_hitGroup);
 
-  // The total SBT size is the sum of the entries for ray generation, miss and hit groups, aligned
-  // on 256 bytes
-  uint32_t sbtSize = ROUND_UP(m_rayGenEntrySize * static_cast<UINT>(m_rayGen.size()) +
-                                  m_missEntrySize * static_cast<UINT>(m_miss.size()) +
-                                  m_hitGroupEntrySize * static_cast<UINT>(m_hitGroup.size()),
-                              256);
-  return sbtSize;
+  // The sections are stored one after the other: ray generation, miss and hit groups. Their
+  // sizes are multiples of the table alignment, so that each section starts aligned.
+  m_layoutStats = SBTLayoutStats();
+  UINT64 sbtSize = 0;
+  sbtSize += ComputeSectionLayout(SBT_SECTION_RAY_GENERATION, sbtSize);
+  sbtSize += ComputeSectionLayout(SBT_SECTION_MISS, sbtSize);
+  sbtSize += ComputeSectionLayout(SBT_SECTION_HIT_GROUP, sbtSize);
+
+  m_layoutStats.sizeInBytes = sbtSize;
+  m_layoutStats.alignmentPaddingBytes =
+      sbtSize - m_layoutStats.recordBytes - m_layoutStats.recordPaddingBytes;
+  return static_cast<uint32_t>(sbtSize);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -104,6 +303,13 @@ uint32_t ShaderBindingTableGenerator::ComputeSBTSize()
 void ShaderBindingTableGenerator::Generate(ID3D12Resource* sbtBuffer,
                                            ID3D12StateObjectProperties* raytracingPipeline)
 {
+  if (m_sectionLayouts[SBT_SECTION_RAY_GENERATION].recordSubTables.size() != m_rayGen.size() ||
+      m_sectionLayouts[SBT_SECTION_MISS].recordSubTables.size() != m_miss.size() ||
+      m_sectionLayouts[SBT_SECTION_HIT_GROUP].recordSubTables.size() != m_hitGroup.size())
+  {
+    throw std::logic_error("Programs were added to the SBT since ComputeSBTSize was called");
+  }
+
   // Map the SBT
   uint8_t* pData;
   HRESULT hr = sbtBuffer->Map(0, nullptr, reinterpret_cast<void**>(&pData));
@@ -111,20 +317,78 @@ void ShaderBindingTableGenerator::Generate(ID3D12Resource* sbtBuffer,
   {
     throw std::logic_error("Could not map the shader binding table");
   }
+  // The identifiers resolved for the same pipeline by a previous call are reused
+  m_identifierCache.SetPipeline(raytracingPipeline);
+
   // Copy the shader identifiers followed by their resource pointers or root constants: first the
   // ray generation, then the miss shaders, and finally the set of hit groups
-  uint32_t offset = 0;
+  CopyShaderData(pData, SBT_SECTION_RAY_GENERATION);
+  CopyShaderData(pData, SBT_SECTION_MISS);
+  CopyShaderData(pData, SBT_SECTION_HIT_GROUP);
 
-  offset = CopyShaderData(raytracingPipeline, pData, m_rayGen, m_rayGenEntrySize);
-  pData += offset;
+  // Unmap the SBT
+  sbtBuffer->Unmap(0, nullptr);
 
-  offset = CopyShaderData(raytracingPipeline, pData, m_miss, m_missEntrySize);
-  pData += offset;
+  // The whole table is written, including the pending record updates
+  m_writtenRange.Begin = 0;
+  m_writtenRange.End = static_cast<SIZE_T>(m_layoutStats.sizeInBytes);
+  ClearDirtyRecords();
+}
 
-  offset = CopyShaderData(raytracingPipeline, pData, m_hitGroup, m_hitGroupEntrySize);
+//--------------------------------------------------------------------------------------------------
+//
+// Rewrite the arguments of the records updated since the last call to Generate or Update
+void ShaderBindingTableGenerator::Update(ID3D12Resource* sbtBuffer)
+{
+  m_writtenRange.Begin = 0;
+  m_writtenRange.End = 0;
+  if (m_dirtyRecords.empty())
+  {
+    return;
+  }
 
-  // Unmap the SBT
-  sbtBuffer->Unmap(0, nullptr);
+  // The CPU does not read the SBT, and only the range of the dirty records is written
+  D3D12_RANGE readRange = {0, 0};
+  uint8_t* pData;
+  HRESULT hr = sbtBuffer->Map(0, &readRange, reinterpret_cast<void**>(&pData));
+  if (FAILED(hr))
+  {
+    throw std::logic_error("Could not map the shader binding table");
+  }
+  for (size_t i = 0; i < m_dirtyRecords.size(); i++)
+  {
+    SBTRecordHandle record = m_dirtyRecords[i];
+    const SBTEntry& entry = GetSection(record.section)[record.index];
+    uint8_t* recordData = pData + GetRecordOffset(record) + m_progIdSize;
+    memcpy(recordData, m_argumentData.data() + entry.m_argumentOffset, entry.m_argumentSize);
+    memset(recordData + entry.m_argumentSize, 0, m_dirtyRecordSizes[i] - entry.m_argumentSize);
+  }
+  sbtBuffer->Unmap(0, &m_pendingRange);
+
+  m_writtenRange = m_pendingRange;
+  ClearDirtyRecords();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Empty the list of dirty records once they are written
+void ShaderBindingTableGenerator::ClearDirtyRecords()
+{
+  for (SBTRecordHandle record : m_dirtyRecords)
+  {
+    GetSection(record.section)[record.index].m_dirtyIndex = ~0u;
+  }
+  m_dirtyRecords.clear();
+  m_dirtyRecordSizes.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Byte range of the SBT written by the last call to Generate or Update
+bool ShaderBindingTableGenerator::GetDirtyRange(D3D12_RANGE* range) const
+{
+  *range = m_writtenRange;
+  return m_writtenRange.End > m_writtenRange.Begin;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -135,11 +399,24 @@ void ShaderBindingTableGenerator::Reset()
   m_rayGen.clear();
   m_miss.clear();
   m_hitGroup.clear();
+  m_argumentData.clear();
+  m_sharedHitGroups.clear();
+  m_sharedHitGroupReuseCount = 0;
 
   m_rayGenEntrySize = 0;
   m_missEntrySize = 0;
   m_hitGroupEntrySize = 0;
   m_progIdSize = 0;
+  for (auto& sectionLayout : m_sectionLayouts)
+  {
+    sectionLayout = SectionLayout();
+  }
+  m_layoutStats = SBTLayoutStats();
+
+  m_dirtyRecords.clear();
+  m_dirtyRecordSizes.clear();
+  m_writtenRange.Begin = 0;
+  m_writtenRange.End = 0;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -151,7 +428,7 @@ void ShaderBindingTableGenerator::Reset()
 // Get the size in bytes of the SBT section dedicated to ray generation programs
 UINT ShaderBindingTableGenerator::GetRayGenSectionSize() const
 {
-  return m_rayGenEntrySize * static_cast<UINT>(m_rayGen.size());
+  return static_cast<UINT>(m_sectionLayouts[SBT_SECTION_RAY_GENERATION].size);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -167,7 +444,7 @@ UINT ShaderBindingTableGenerator::GetRayGenEntrySize() const
 // Get the size in bytes of the SBT section dedicated to miss programs
 UINT ShaderBindingTableGenerator::GetMissSectionSize() const
 {
-  return m_missEntrySize * static_cast<UINT>(m_miss.size());
+  return static_cast<UINT>(m_sectionLayouts[SBT_SECTION_MISS].size);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -183,7 +460,7 @@ UINT ShaderBindingTableGenerator::GetMissEntrySize()
 // Get the size in bytes of the SBT section dedicated to hit groups
 UINT ShaderBindingTableGenerator::GetHitGroupSectionSize() const
 {
-  return m_hitGroupEntrySize * static_cast<UINT>(m_hitGroup.size());
+  return static_cast<UINT>(m_sectionLayouts[SBT_SECTION_HIT_GROUP].size);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -196,33 +473,128 @@ UINT ShaderBindingTableGenerator::GetHitGroupEntrySize() const
 
 //--------------------------------------------------------------------------------------------------
 //
-// For each entry, copy the shader identifier followed by its resource pointers and/or root
-// constants in outputData, with a stride in bytes of entrySize, and returns the size in bytes
-// actually written to outputData.
-uint32_t ShaderBindingTableGenerator::CopyShaderData(
-    ID3D12StateObjectProperties* raytracingPipeline, uint8_t* outputData,
-    const std::vector<SBTEntry>& shaders, uint32_t entrySize)
+// Table of a section and its address range, given the address of the SBT buffer
+D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE
+ShaderBindingTableGenerator::GetSubTable(SBTSection section, UINT subTable,
+                                         D3D12_GPU_VIRTUAL_ADDRESS sbtAddress) const
+{
+  const SubTable& table = m_sectionLayouts[section].subTables.at(subTable);
+  D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE range;
+  range.StartAddress = sbtAddress + table.offset;
+  range.SizeInBytes = static_cast<UINT64>(table.entrySize) * table.recordCount;
+  range.StrideInBytes = table.entrySize;
+  return range;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Table of a record within its section, and the index of the record within that table
+void ShaderBindingTableGenerator::GetRecordLocation(SBTRecordHandle record, UINT* subTable,
+                                                    UINT* indexInSubTable) const
 {
-  uint8_t* pData = outputData;
-  for (const auto& shader : shaders)
+  const SectionLayout& sectionLayout = m_sectionLayouts[record.section];
+  *subTable = sectionLayout.recordSubTables.at(record.index);
+  *indexInSubTable = sectionLayout.recordIndices[record.index];
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Hit group index of the instances using a hit group record, relative to its table
+UINT ShaderBindingTableGenerator::GetInstanceContribution(SBTRecordHandle record) const
+{
+  if (record.section != SBT_SECTION_HIT_GROUP || record.index >= m_hitGroup.size())
   {
-    // Get the shader identifier, and check whether that identifier is known
-    void* id = raytracingPipeline->GetShaderIdentifier(shader.m_entryPoint.c_str());
-    if (!id)
-    {
-      std::wstring errMsg(std::wstring(L"Unknown shader identifier used in the SBT: ") +
-                          shader.m_entryPoint);
-      throw std::logic_error(std::string(errMsg.begin(), errMsg.end()));
-    }
+    throw std::logic_error("Invalid hit group record");
+  }
+  const SectionLayout& sectionLayout = m_sectionLayouts[SBT_SECTION_HIT_GROUP];
+  if (record.index < sectionLayout.recordIndices.size())
+  {
+    return sectionLayout.recordIndices[record.index];
+  }
+  // Before ComputeSBTSize, the records of the uniform layout are in the order of their addition
+  if (m_layout != SBT_LAYOUT_UNIFORM)
+  {
+    throw std::logic_error(
+        "The hit group index of a record of the grouped layout is known once the SBT size is "
+        "computed");
+  }
+  return record.index;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// For each entry of a section, copy the shader identifier followed by its resource pointers
+// and/or root constants at the offset of the record in sbtData
+void ShaderBindingTableGenerator::CopyShaderData(uint8_t* sbtData, SBTSection section)
+{
+  const std::vector<SBTEntry>& shaders = GetSection(section);
+  for (UINT i = 0; i < static_cast<UINT>(shaders.size()); i++)
+  {
+    const SBTEntry& shader = shaders[i];
+    uint8_t* pData = sbtData + GetRecordOffset({section, i});
+    // Get the shader identifier from the cache, which throws if that identifier is unknown
+    const uint8_t* id = m_identifierCache.GetIdentifier(shader.m_exportIndex);
     // Copy the shader identifier
     memcpy(pData, id, m_progIdSize);
     // Copy all its resources pointers or values in bulk
-    memcpy(pData + m_progIdSize, shader.m_inputData.data(), shader.m_inputData.size() * 8);
+    memcpy(pData + m_progIdSize, m_argumentData.data() + shader.m_argumentOffset,
+           shader.m_argumentSize);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Place the records of a section starting at offset, and return the size of the section. With
+// the grouped layout, the records of each size form a table, in the order in which the sizes
+// first appear.
+UINT64 ShaderBindingTableGenerator::ComputeSectionLayout(SBTSection section, UINT64 offset)
+{
+  const std::vector<SBTEntry>& entries = GetSection(section);
+  const uint32_t maxEntrySizes[] = {m_rayGenEntrySize, m_missEntrySize, m_hitGroupEntrySize};
+  uint32_t maxEntrySize = maxEntrySizes[section];
+  SectionLayout& sectionLayout = m_sectionLayouts[section];
+  sectionLayout = SectionLayout();
+  sectionLayout.offset = offset;
+
+  for (const auto& entry : entries)
+  {
+    uint32_t recordSize = m_progIdSize + entry.m_argumentSize;
+    uint32_t entrySize = maxEntrySize;
+    if (m_layout == SBT_LAYOUT_GROUPED_BY_SIZE)
+    {
+      entrySize = ROUND_UP(recordSize, section == SBT_SECTION_RAY_GENERATION
+                                           ? D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT
+                                           : D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
+    }
+
+    // Only a few distinct sizes are expected, which are searched linearly
+    UINT subTable = 0;
+    while (subTable < sectionLayout.subTables.size() &&
+           sectionLayout.subTables[subTable].entrySize != entrySize)
+    {
+      subTable++;
+    }
+    if (subTable == sectionLayout.subTables.size())
+    {
+      sectionLayout.subTables.push_back({0, entrySize, 0});
+    }
+    sectionLayout.recordSubTables.push_back(subTable);
+    sectionLayout.recordIndices.push_back(sectionLayout.subTables[subTable].recordCount++);
+
+    m_layoutStats.recordBytes += recordSize;
+    m_layoutStats.recordPaddingBytes += entrySize - recordSize;
+  }
 
-    pData += entrySize;
+  // Each table starts on the alignment required for the start addresses of DispatchRays
+  UINT64 tableOffset = offset;
+  for (auto& table : sectionLayout.subTables)
+  {
+    table.offset = tableOffset;
+    tableOffset = ROUND_UP(tableOffset + static_cast<UINT64>(table.entrySize) * table.recordCount,
+                           static_cast<UINT64>(D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT));
   }
-  // Return the number of bytes actually written to the output buffer
-  return static_cast<uint32_t>(shaders.size()) * entrySize;
+  sectionLayout.size = tableOffset - offset;
+  return sectionLayout.size;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -231,15 +603,15 @@ uint32_t ShaderBindingTableGenerator::CopyShaderData(
 // number of parameters of their root signature
 uint32_t ShaderBindingTableGenerator::GetEntrySize(const std::vector<SBTEntry>& entries)
 {
-  // Find the maximum number of parameters used by a single entry
-  size_t maxArgs = 0;
+  // Find the largest arguments of a single entry
+  uint32_t maxArgumentSize = 0;
   for (const auto& shader : entries)
   {
-    maxArgs = max(maxArgs, shader.m_inputData.size());
+    maxArgumentSize = (std::max)(maxArgumentSize, shader.m_argumentSize);
   }
-  // A SBT entry is made of a program ID and a set of parameters, taking 8 bytes each. Those
-  // parameters can either be 8-bytes pointers, or 4-bytes constants
-  uint32_t entrySize = m_progIdSize + 8 * static_cast<uint32_t>(maxArgs);
+  // A SBT entry is made of a program ID and a set of parameters, taking 8 bytes each for
+  // pointers and descriptor handles, and 4 bytes for each root constant
+  uint32_t entrySize = m_progIdSize + maxArgumentSize;
 
   // The entries of the shader binding table must be 16-bytes-aligned
   entrySize = ROUND_UP(entrySize, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
@@ -247,12 +619,50 @@ uint32_t ShaderBindingTableGenerator::GetEntrySize(const std::vector<SBTEntry>&
   return entrySize;
 }
 
+//--------------------------------------------------------------------------------------------------
+//
+// Entries of a section
+std::vector<ShaderBindingTableGenerator::SBTEntry>&
+ShaderBindingTableGenerator::GetSection(SBTSection section)
+{
+  switch (section)
+  {
+  case SBT_SECTION_RAY_GENERATION:
+    return m_rayGen;
+  case SBT_SECTION_MISS:
+    return m_miss;
+  default:
+    return m_hitGroup;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Size of a record in its table
+uint32_t ShaderBindingTableGenerator::GetRecordEntrySize(SBTRecordHandle record) const
+{
+  const SectionLayout& sectionLayout = m_sectionLayouts[record.section];
+  return sectionLayout.subTables[sectionLayout.recordSubTables[record.index]].entrySize;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Offset in bytes of a record in the SBT
+UINT64 ShaderBindingTableGenerator::GetRecordOffset(SBTRecordHandle record) const
+{
+  const SectionLayout& sectionLayout = m_sectionLayouts[record.section];
+  const SubTable& table = sectionLayout.subTables[sectionLayout.recordSubTables[record.index]];
+  return table.offset +
+         static_cast<UINT64>(sectionLayout.recordIndices[record.index]) * table.entrySize;
+}
+
 //--------------------------------------------------------------------------------------------------
 //
 //
-ShaderBindingTableGenerator::SBTEntry::SBTEntry(std::wstring entryPoint,
-                                                std::vector<void*> inputData)
-    : m_entryPoint(std::move(entryPoint)), m_inputData(std::move(inputData))
+ShaderBindingTableGenerator::SBTEntry::SBTEntry(UINT exportIndex, size_t argumentOffset,
+                                                uint32_t argumentSize)
+    : m_exportIndex(exportIndex), m_argumentOffset(argumentOffset), m_argumentSize(argumentSize),
+      m_argumentCapacity(argumentSize), m_dirtyIndex(~0u)
 {
 }
 } // namespace nv_helpers_dx12
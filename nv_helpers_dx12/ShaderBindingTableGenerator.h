@@ -102,6 +102,52 @@ missSectionSizeInBytes; desc.HitGroupTable.SizeInBytes = hitGroupsSectionSize;
 desc.HitGroupTable.StrideInBytes = m_sbtHelper.GetHitGroupEntrySize();
 
 
+//--------------------------------------------------------------------
+Records can then be patched without regenerating the whole table
+//--------------------------------------------------------------------
+
+The Add* methods return a handle to the record they add, which stays valid until
+Reset. Updating the arguments of a record only rewrites its argument bytes, as
+long as they fit in the entry size computed by ComputeSBTSize:
+
+nv_helpers_dx12::SBTRecordHandle material = m_sbtHelper.AddHitGroup(L"HitGroup", {cbAddress});
+...
+m_sbtHelper.UpdateRecord(material, {(void*)(newConstantBuffer->GetGPUVirtualAddress())});
+m_sbtHelper.Update(m_sbtStorage.Get());
+
+When the table is copied from an upload buffer into the default heap, only the bytes within
+GetDirtyRange need to be copied after Update.
+
+//--------------------------------------------------------------------
+Records of different sizes can be stored in separate tables
+//--------------------------------------------------------------------
+
+With a few hit groups taking many arguments among many taking few, most of a
+uniform table is padding. The grouped layout stores the records of each size in
+their own table, with its own stride. A dispatch then only addresses one table
+per section, and the hit group indices of the instances are relative to that
+table:
+
+m_sbtHelper.SetLayout(nv_helpers_dx12::SBT_LAYOUT_GROUPED_BY_SIZE);
+uint32_t sbtSize = m_sbtHelper.ComputeSBTSize();
+UINT64 wastedBytes = m_sbtHelper.GetLayoutStats().GetWastedBytes();
+...
+UINT table, hitGroupIndex;
+m_sbtHelper.GetRecordLocation(material, &table, &hitGroupIndex);
+desc.HitGroupTable = m_sbtHelper.GetSubTable(nv_helpers_dx12::SBT_SECTION_HIT_GROUP, table,
+                                             m_sbtStorage->GetGPUVirtualAddress());
+//--------------------------------------------------------------------
+Instances with identical hit group records can share them
+//--------------------------------------------------------------------
+
+When many instances use the same hit group with the same arguments, the record
+is only stored once, keeping the table small. The hit group index of each
+instance is given by the record:
+
+nv_helpers_dx12::SBTRecordHandle record =
+    m_sbtHelper.AddSharedHitGroup(L"HitGroup", {(void*)(vertexBuffer->GetGPUVirtualAddress())});
+m_topLevelASGenerator.AddInstance(blas, transform, instanceId,
+                                  m_sbtHelper.GetInstanceContribution(record));
 
 */
 
@@ -109,41 +155,187 @@ desc.HitGroupTable.StrideInBytes = m_sbtHelper.GetHitGroupEntrySize();
 
 #include "d3d12.h"
 
+#include "LocalRootArguments.h"
+#include "ShaderIdentifierCache.h"
+
+#include <unordered_map>
 #include <vector>
 
 namespace nv_helpers_dx12
 {
+/// Sections of the SBT, in the order in which they are stored
+enum SBTSection : uint8_t
+{
+  SBT_SECTION_RAY_GENERATION = 0,
+  SBT_SECTION_MISS = 1,
+  SBT_SECTION_HIT_GROUP = 2
+};
+
+/// Handle to a record of the SBT, returned when adding a program or a hit group
+struct SBTRecordHandle
+{
+  SBTSection section;
+  /// Index of the record in its section
+  UINT index;
+};
+
+/// Arrangement of the records within each section of the SBT
+enum SBTLayout : uint8_t
+{
+  /// All the records of a section have the size of the largest one, forming a single table
+  SBT_LAYOUT_UNIFORM = 0,
+  /// The records of a section are grouped by size into sub-tables, each with its own stride and
+  /// addressable separately. Indices within a sub-table are given by GetRecordLocation.
+  SBT_LAYOUT_GROUPED_BY_SIZE = 1
+};
+
+/// Use of the bytes of the SBT, as computed by ComputeSBTSize
+struct SBTLayoutStats
+{
+  /// Total size of the SBT
+  UINT64 sizeInBytes = 0;
+  /// Shader identifiers and arguments of the records
+  UINT64 recordBytes = 0;
+  /// Padding of the records up to the stride of their table
+  UINT64 recordPaddingBytes = 0;
+  /// Padding aligning the start of the tables
+  UINT64 alignmentPaddingBytes = 0;
+
+  UINT64 GetWastedBytes() const { return recordPaddingBytes + alignmentPaddingBytes; }
+};
+
 /// Helper class to create and maintain a Shader Binding Table
 class ShaderBindingTableGenerator
 {
 public:
   /// Add a ray generation program by name, with its list of data pointers or values according to
   /// the layout of its root signature
-  void AddRayGenerationProgram(const std::wstring& entryPoint, const std::vector<void*>& inputData);
+  SBTRecordHandle AddRayGenerationProgram(const std::wstring& entryPoint,
+                                          const std::vector<void*>& inputData);
 
   /// Add a miss program by name, with its list of data pointers or values according to
   /// the layout of its root signature
-  void AddMissProgram(const std::wstring& entryPoint, const std::vector<void*>& inputData);
+  SBTRecordHandle AddMissProgram(const std::wstring& entryPoint,
+                                 const std::vector<void*>& inputData);
 
   /// Add a hit group by name, with its list of data pointers or values according to
   /// the layout of its root signature
-  void AddHitGroup(const std::wstring& entryPoint, const std::vector<void*>& inputData);
+  SBTRecordHandle AddHitGroup(const std::wstring& entryPoint, const std::vector<void*>& inputData);
 
-  /// Compute the size of the SBT based on the set of programs and hit groups it contains
+  /// Add a program or a hit group with typed local root arguments, see LocalRootArguments.h. The
+  /// arguments are copied as packed, so root constants can be smaller than 8 bytes.
+  template <typename... Params>
+  SBTRecordHandle AddRayGenerationProgram(const std::wstring& entryPoint,
+                                          const LocalRootArguments<Params...>& arguments)
+  {
+    return AddEntry(SBT_SECTION_RAY_GENERATION, entryPoint, arguments.GetData(),
+                    arguments.GetSize());
+  }
+  template <typename... Params>
+  SBTRecordHandle AddMissProgram(const std::wstring& entryPoint,
+                                 const LocalRootArguments<Params...>& arguments)
+  {
+    return AddEntry(SBT_SECTION_MISS, entryPoint, arguments.GetData(), arguments.GetSize());
+  }
+  template <typename... Params>
+  SBTRecordHandle AddHitGroup(const std::wstring& entryPoint,
+                              const LocalRootArguments<Params...>& arguments)
+  {
+    return AddEntry(SBT_SECTION_HIT_GROUP, entryPoint, arguments.GetData(), arguments.GetSize());
+  }
+
+  /// Add a hit group record shared by all the instances using the same hit group with the same
+  /// arguments. If an identical record was added by this function, no record is added and the
+  /// handle of that record is returned. Each record is shared as a whole, so instances sharing it
+  /// are expected to have one geometry and to trace a single ray type.
+  SBTRecordHandle AddSharedHitGroup(const std::wstring& entryPoint,
+                                    const std::vector<void*>& inputData);
+  template <typename... Params>
+  SBTRecordHandle AddSharedHitGroup(const std::wstring& entryPoint,
+                                    const LocalRootArguments<Params...>& arguments)
+  {
+    return AddSharedEntry(entryPoint, arguments.GetData(), arguments.GetSize());
+  }
+
+  /// Number of calls to AddSharedHitGroup which returned an existing record
+  UINT GetSharedHitGroupReuseCount() const { return m_sharedHitGroupReuseCount; }
+
+  /// Replace the data pointers or values of a record. Once the SBT size is computed, the new
+  /// values must fit in the entry size of the section, and the record is written by the next call
+  /// to Update. A shared hit group record is updated for all the instances using it.
+  void UpdateRecord(SBTRecordHandle record, const std::vector<void*>& inputData);
+  template <typename... Params>
+  void UpdateRecord(SBTRecordHandle record, const LocalRootArguments<Params...>& arguments)
+  {
+    UpdateRecordData(record, arguments.GetData(), arguments.GetSize());
+  }
+
+  /// Set the arrangement of the records used by the next call to ComputeSBTSize
+  void SetLayout(SBTLayout layout) { m_layout = layout; }
+
+  /// Compute the size of the SBT based on the set of programs and hit groups it contains. Each
+  /// section, and each sub-table of a section, starts on a 64-byte boundary as required for the
+  /// start addresses of DispatchRays. Ray generation records are 64-byte aligned as well, since
+  /// each of them is given to DispatchRays on its own.
   uint32_t ComputeSBTSize();
 
+  /// Use of the bytes of the SBT, reporting the bytes wasted by padding
+  const SBTLayoutStats& GetLayoutStats() const { return m_layoutStats; }
+
   /// Build the SBT and store it into sbtBuffer, which has to be pre-allocated on the upload heap.
   /// Access to the raytracing pipeline object is required to fetch program identifiers using their
-  /// names
+  /// names. The identifiers are cached, and only fetched again when the pipeline changes.
   void Generate(ID3D12Resource* sbtBuffer,
                 ID3D12StateObjectProperties* raytracingPipeline);
 
-  /// Reset the sets of programs and hit groups
+  /// Rewrite the arguments of the records updated since the last call to Generate or Update in
+  /// sbtBuffer, which must have been filled by Generate. The shader identifiers and the other
+  /// records are left untouched.
+  void Update(ID3D12Resource* sbtBuffer);
+
+  /// Byte range of the SBT written by the last call to Generate or Update, which is the only part
+  /// to copy when the table is uploaded through an intermediate buffer. Returns false if the last
+  /// call wrote nothing.
+  bool GetDirtyRange(D3D12_RANGE* range) const;
+
+  /// Reset the sets of programs and hit groups, invalidating the record handles. The shader
+  /// identifier cache is kept.
   void Reset();
 
+  /// Cache of the shader identifiers, whose export names are interned when programs are added
+  ShaderIdentifierCache& GetShaderIdentifierCache() { return m_identifierCache; }
+
   /// The following getters are used to simplify the call to DispatchRays where the offsets of the
   /// shader programs must be exactly following the SBT layout
 
+  /// Number of separately addressable tables in a section: 1 with the uniform layout, and one per
+  /// record size with the grouped layout
+  UINT GetSubTableCount(SBTSection section) const
+  {
+    return static_cast<UINT>(m_sectionLayouts[section].subTables.size());
+  }
+
+  /// Address range and stride of a table of a section, given the address of the SBT buffer. For
+  /// the ray generation section, the record at index i of the table starts at
+  /// StartAddress + i * StrideInBytes.
+  D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE GetSubTable(SBTSection section, UINT subTable,
+                                                        D3D12_GPU_VIRTUAL_ADDRESS sbtAddress) const;
+
+  /// Table of a record within its section, and the index of the record within that table, to be
+  /// used as InstanceContributionToHitGroupIndex or MissShaderIndex
+  void GetRecordLocation(SBTRecordHandle record, UINT* subTable, UINT* indexInSubTable) const;
+
+  /// Hit group index to give to TopLevelASGenerator::AddInstance for the instances using a hit
+  /// group record, stored as InstanceContributionToHitGroupIndex. With the uniform layout, it is
+  /// the index of the record in its section, known as soon as the record is added. With the
+  /// grouped layout, it is only known once the SBT size is computed, and is relative to the
+  /// sub-table of the record.
+  UINT GetInstanceContribution(SBTRecordHandle record) const;
+
+  /// With the grouped layout, the entry sizes below are the ones of the largest records, and the
+  /// section sizes include all their tables. The section sizes include the padding aligning the
+  /// next section, so that the sections can be addressed by adding up their sizes.
+
   /// Get the size in bytes of the SBT section dedicated to ray generation programs
   UINT GetRayGenSectionSize() const;
   /// Get the size in bytes of one ray generation program entry in the SBT
@@ -160,40 +352,120 @@ public:
   UINT GetHitGroupEntrySize() const;
 
 private:
-  /// Wrapper for SBT entries, each consisting of the name of the program and a list of values,
-  /// which can be either pointers or raw 32-bit constants
+  /// Wrapper for SBT entries, each consisting of the interned name of the program and its
+  /// arguments, which can be pointers, descriptor handles or 32-bit constants. The arguments are
+  /// stored in m_argumentData, avoiding an allocation per entry.
   struct SBTEntry
   {
-    SBTEntry(std::wstring entryPoint, std::vector<void*> inputData);
+    SBTEntry(UINT exportIndex, size_t argumentOffset, uint32_t argumentSize);
+
+    /// Index of the name of the program in the shader identifier cache
+    const UINT m_exportIndex;
+    /// Location of the arguments in m_argumentData, and the bytes available there
+    size_t m_argumentOffset;
+    uint32_t m_argumentSize;
+    uint32_t m_argumentCapacity;
+    /// Index of the record in m_dirtyRecords, or ~0u if it is not dirty
+    UINT m_dirtyIndex;
+  };
+
+  /// Add an entry to a section, with its arguments as packed in the record
+  SBTRecordHandle AddEntry(SBTSection section, const std::wstring& entryPoint,
+                           const void* arguments, uint32_t argumentSize);
+
+  /// Replace the arguments of a record, see UpdateRecord
+  void UpdateRecordData(SBTRecordHandle record, const void* arguments, uint32_t argumentSize);
 
-    const std::wstring m_entryPoint;
-    const std::vector<void*> m_inputData;
+  /// Empty the list of dirty records once they are written
+  void ClearDirtyRecords();
+
+  /// Append arguments to m_argumentData, returning their offset
+  size_t StoreArguments(const void* arguments, uint32_t argumentSize);
+
+  /// Add a hit group record, or find an identical one, see AddSharedHitGroup
+  SBTRecordHandle AddSharedEntry(const std::wstring& entryPoint, const void* arguments,
+                                 uint32_t argumentSize);
+
+  /// Hash of the program and arguments of a record, identifying shared hit group records
+  static uint64_t HashRecord(UINT exportIndex, const void* arguments, uint32_t argumentSize);
+
+  /// Remove a hit group record from m_sharedHitGroups, before its arguments are replaced. Returns
+  /// false if the record is not shared.
+  bool RemoveSharedHitGroup(UINT index);
+
+  /// Table of records of the same size within a section
+  struct SubTable
+  {
+    /// Offset of the table in the SBT
+    UINT64 offset;
+    uint32_t entrySize;
+    UINT recordCount;
   };
 
-  /// For each entry, copy the shader identifier followed by its resource pointers and/or root
-  /// constants in outputData, with a stride in bytes of entrySize, and returns the size in bytes
-  /// actually written to outputData.
-  uint32_t CopyShaderData(ID3D12StateObjectProperties* raytracingPipeline,
-                          uint8_t* outputData, const std::vector<SBTEntry>& shaders,
-                          uint32_t entrySize);
+  /// Location of a section in the SBT, its tables and the location of each of its records
+  struct SectionLayout
+  {
+    UINT64 offset = 0;
+    UINT64 size = 0;
+    std::vector<SubTable> subTables;
+    std::vector<UINT> recordSubTables;
+    std::vector<UINT> recordIndices;
+  };
+
+  /// For each entry of a section, copy the shader identifier followed by its resource pointers
+  /// and/or root constants at the offset of the record in sbtData
+  void CopyShaderData(uint8_t* sbtData, SBTSection section);
+
+  /// Place the records of a section starting at offset, and return the size of the section
+  UINT64 ComputeSectionLayout(SBTSection section, UINT64 offset);
 
-  /// Compute the size of the SBT entries for a set of entries, which is determined by the maximum
-  /// number of parameters of their root signature
+  /// Compute the size of the SBT entries for a set of entries, which is determined by the largest
+  /// arguments of their root signature
   uint32_t GetEntrySize(const std::vector<SBTEntry>& entries);
 
+  /// Entries of a section, and the size of a record in its table
+  std::vector<SBTEntry>& GetSection(SBTSection section);
+  uint32_t GetRecordEntrySize(SBTRecordHandle record) const;
+
+  /// Offset in bytes of a record in the SBT
+  UINT64 GetRecordOffset(SBTRecordHandle record) const;
+
   std::vector<SBTEntry> m_rayGen;
   std::vector<SBTEntry> m_miss;
   std::vector<SBTEntry> m_hitGroup;
+  /// Arguments of all the entries, 8-byte aligned for each entry
+  std::vector<uint8_t> m_argumentData;
+
+  /// Indices of the shared hit group records by hash of their contents. Records with the same
+  /// hash are compared to find the identical one.
+  std::unordered_multimap<uint64_t, UINT> m_sharedHitGroups;
+  UINT m_sharedHitGroupReuseCount = 0;
 
   /// For each category, the size of an entry in the SBT depends on the maximum number of resources
   /// used by the shaders in that category.The helper computes those values automatically in
   /// GetEntrySize()
-  uint32_t m_rayGenEntrySize;
-  uint32_t m_missEntrySize;
-  uint32_t m_hitGroupEntrySize;
+  uint32_t m_rayGenEntrySize = 0;
+  uint32_t m_missEntrySize = 0;
+  uint32_t m_hitGroupEntrySize = 0;
 
   /// The program names are translated into program identifiers.The size in bytes of an identifier
   /// is provided by the device and is the same for all categories.
-  UINT m_progIdSize;
+  UINT m_progIdSize = 0;
+
+  SBTLayout m_layout = SBT_LAYOUT_UNIFORM;
+  /// Layout of each section, in the order of SBTSection
+  SectionLayout m_sectionLayouts[3];
+  SBTLayoutStats m_layoutStats;
+
+  ShaderIdentifierCache m_identifierCache;
+
+  /// Records updated since the last call to Generate or Update, and the number of argument bytes
+  /// to rewrite for each, covering the previous arguments if they were longer. A record updated
+  /// several times is listed once, with the largest of those sizes.
+  std::vector<SBTRecordHandle> m_dirtyRecords;
+  std::vector<uint32_t> m_dirtyRecordSizes;
+  /// Byte range of the dirty records, and byte range written by the last Generate or Update
+  D3D12_RANGE m_pendingRange = {0, 0};
+  D3D12_RANGE m_writtenRange = {0, 0};
 };
 } // namespace nv_helpers_dx12
@@ -0,0 +1,108 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Cache of the shader identifiers of a raytracing pipeline. See
+ShaderIdentifierCache.h for details.
+*/
+
+#include "ShaderIdentifierCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace nv_helpers_dx12
+{
+
+const UINT ShaderIdentifierCache::kIdentifierSize;
+
+//--------------------------------------------------------------------------------------------------
+//
+// Set the pipeline from which the identifiers are fetched
+void ShaderIdentifierCache::SetPipeline(ID3D12StateObjectProperties* pipeline)
+{
+  if (pipeline != m_pipeline)
+  {
+    m_pipeline = pipeline;
+    std::fill(m_resolved.begin(), m_resolved.end(), 0);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Index of an export name, added if the name is new
+UINT ShaderIdentifierCache::InternExport(const std::wstring& exportName)
+{
+  auto it = m_exportIndices.find(exportName);
+  if (it != m_exportIndices.end())
+  {
+    return it->second;
+  }
+  UINT exportIndex = static_cast<UINT>(m_exportNames.size());
+  m_exportIndices.emplace(exportName, exportIndex);
+  m_exportNames.push_back(exportName);
+  m_identifiers.resize(m_identifiers.size() + kIdentifierSize);
+  m_resolved.push_back(0);
+  return exportIndex;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Intern export names and resolve their identifiers in the current pipeline
+void ShaderIdentifierCache::Resolve(const std::vector<std::wstring>& exportNames)
+{
+  for (const auto& exportName : exportNames)
+  {
+    GetIdentifier(InternExport(exportName));
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Identifier of an interned export, fetched from the pipeline the first time it is requested
+const uint8_t* ShaderIdentifierCache::GetIdentifier(UINT exportIndex)
+{
+  uint8_t* identifier = &m_identifiers[static_cast<size_t>(exportIndex) * kIdentifierSize];
+  if (!m_resolved[exportIndex])
+  {
+    if (!m_pipeline)
+    {
+      throw std::logic_error("No pipeline to fetch the shader identifiers from");
+    }
+    void* id = m_pipeline->GetShaderIdentifier(m_exportNames[exportIndex].c_str());
+    m_lookupCount++;
+    if (!id)
+    {
+      std::wstring errMsg(std::wstring(L"Unknown shader identifier used in the SBT: ") +
+                          m_exportNames[exportIndex]);
+      throw std::logic_error(std::string(errMsg.begin(), errMsg.end()));
+    }
+    memcpy(identifier, id, kIdentifierSize);
+    m_resolved[exportIndex] = 1;
+  }
+  return identifier;
+}
+} // namespace nv_helpers_dx12
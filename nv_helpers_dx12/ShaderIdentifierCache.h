@@ -0,0 +1,103 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Cache of the shader identifiers of a raytracing pipeline. Looking up an
+identifier in the pipeline hashes its wide-string export name in the runtime,
+which becomes noticeable when thousands of SBT records share a few exports. The
+cache interns each export name once into an index, and resolves the identifier
+of each export once per pipeline. The SBT records then only store the index of
+their export, and copy the identifier from the cache.
+
+The pipeline is identified by its address: SetPipeline(nullptr) has to be called
+when it is released, as a new pipeline may be created at the same address.
+
+The cache only calls GetShaderIdentifier on the pipeline, and can be exercised
+with a fake ID3D12StateObjectProperties, as done by
+Benchmarks/ShaderIdentifierCacheValidation.cpp.
+
+Example, right after creating the pipeline:
+
+nv_helpers_dx12::ShaderIdentifierCache& identifiers = m_sbtHelper.GetShaderIdentifierCache();
+identifiers.SetPipeline(m_rtStateObjectProps.Get());
+identifiers.Resolve({L"RayGen", L"Miss", L"HitGroup"});
+
+*/
+
+#pragma once
+
+#include "d3d12.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nv_helpers_dx12
+{
+
+/// Shader identifiers of a pipeline, by interned export name
+class ShaderIdentifierCache
+{
+public:
+  /// Size of the identifiers, as copied in the SBT records
+  static const UINT kIdentifierSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
+
+  /// Set the pipeline from which the identifiers are fetched. Changing the pipeline drops the
+  /// identifiers resolved so far, but keeps the interned export names and their indices.
+  void SetPipeline(ID3D12StateObjectProperties* pipeline);
+  ID3D12StateObjectProperties* GetPipeline() const { return m_pipeline; }
+
+  /// Index of an export name, added if the name is new. The index remains valid for the
+  /// lifetime of the cache, across pipelines.
+  UINT InternExport(const std::wstring& exportName);
+
+  /// Intern export names and resolve their identifiers in the current pipeline, typically
+  /// right after its creation. Throws if an export is unknown to the pipeline.
+  void Resolve(const std::vector<std::wstring>& exportNames);
+
+  /// Identifier of an interned export, of kIdentifierSize bytes, fetched from the pipeline the
+  /// first time it is requested. Throws if the export is unknown to the pipeline.
+  const uint8_t* GetIdentifier(UINT exportIndex);
+
+  /// Name of an interned export
+  const std::wstring& GetExportName(UINT exportIndex) const { return m_exportNames[exportIndex]; }
+
+  /// Number of interned export names
+  UINT GetExportCount() const { return static_cast<UINT>(m_exportNames.size()); }
+
+  /// Number of identifiers fetched from the pipelines, for statistics
+  UINT GetLookupCount() const { return m_lookupCount; }
+
+private:
+  ID3D12StateObjectProperties* m_pipeline = nullptr;
+  /// Interned export names and their index
+  std::unordered_map<std::wstring, UINT> m_exportIndices;
+  std::vector<std::wstring> m_exportNames;
+  /// Identifiers of the exports, kIdentifierSize bytes each, valid when resolved
+  std::vector<uint8_t> m_identifiers;
+  std::vector<uint8_t> m_resolved;
+  UINT m_lookupCount = 0;
+};
+} // namespace nv_helpers_dx12
@@ -0,0 +1,224 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Work-stealing thread pool. See ThreadPool.h for details.
+*/
+
+#include "ThreadPool.h"
+
+namespace nv_helpers_dx12
+{
+
+namespace
+{
+// Pool and queue of the worker running on the current thread, if any, so that the tasks submitted
+// by a worker go to its own queue
+thread_local const ThreadPool* t_workerPool = nullptr;
+thread_local uint32_t t_workerQueue = 0;
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Start the worker threads, each owning a task queue
+ThreadPool::ThreadPool(uint32_t threadCount)
+    : m_queuedTaskCount(0), m_pendingTaskCount(0), m_nextQueue(0)
+{
+  if (threadCount == 0)
+  {
+    uint32_t hardwareThreads = std::thread::hardware_concurrency();
+    threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+  }
+
+  for (uint32_t i = 0; i < threadCount; i++)
+  {
+    m_queues.emplace_back(new WorkQueue());
+  }
+  for (uint32_t i = 0; i < threadCount; i++)
+  {
+    m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Stop the worker threads once the tasks already submitted are complete
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_stop = true;
+  }
+  m_taskAvailable.notify_all();
+  for (auto& worker : m_workers)
+  {
+    worker.join();
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Submit a task for execution, on the queue of the calling worker if any, or on the next queue in
+// round-robin order otherwise
+void ThreadPool::Submit(std::function<void()> task)
+{
+  uint32_t queueIndex;
+  if (t_workerPool == this)
+  {
+    queueIndex = t_workerQueue;
+  }
+  else
+  {
+    queueIndex = m_nextQueue++ % static_cast<uint32_t>(m_queues.size());
+  }
+
+  m_pendingTaskCount++;
+  {
+    std::lock_guard<std::mutex> lock(m_queues[queueIndex]->mutex);
+    m_queues[queueIndex]->tasks.push_back(std::move(task));
+  }
+  {
+    // Incrementing under the lock ensures a worker checking for tasks cannot miss the wake-up
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_queuedTaskCount++;
+  }
+  m_taskAvailable.notify_one();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Execute tasks on the calling thread until all the submitted tasks are complete
+void ThreadPool::Wait()
+{
+  // Threads outside the pool steal from all the queues, starting from the first one
+  uint32_t queueIndex = t_workerPool == this ? t_workerQueue : 0;
+  std::function<void()> task;
+  while (m_pendingTaskCount > 0)
+  {
+    if (PopTask(queueIndex, &task))
+    {
+      RunTask(task);
+      continue;
+    }
+    // The remaining tasks are being executed by the workers
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    m_tasksDone.wait(lock, [this]() { return m_pendingTaskCount == 0; });
+  }
+
+  std::exception_ptr exception;
+  {
+    std::lock_guard<std::mutex> lock(m_exceptionMutex);
+    exception = m_exception;
+    m_exception = nullptr;
+  }
+  if (exception)
+  {
+    std::rethrow_exception(exception);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Fetch a task from the back of the given queue, or steal one from the front of the other queues
+bool ThreadPool::PopTask(uint32_t queueIndex, std::function<void()>* task)
+{
+  uint32_t queueCount = static_cast<uint32_t>(m_queues.size());
+  for (uint32_t i = 0; i < queueCount; i++)
+  {
+    WorkQueue& queue = *m_queues[(queueIndex + i) % queueCount];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+    {
+      continue;
+    }
+    if (i == 0)
+    {
+      *task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    else
+    {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    m_queuedTaskCount--;
+    return true;
+  }
+  return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Execute a task, keeping the first exception for Wait, and wake up the waiting threads once the
+// last pending task is complete
+void ThreadPool::RunTask(std::function<void()>& task)
+{
+  try
+  {
+    task();
+  }
+  catch (...)
+  {
+    std::lock_guard<std::mutex> lock(m_exceptionMutex);
+    if (!m_exception)
+    {
+      m_exception = std::current_exception();
+    }
+  }
+  task = nullptr;
+
+  if (--m_pendingTaskCount == 0)
+  {
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_tasksDone.notify_all();
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Main loop of a worker thread: execute tasks from its own queue, steal from the others when it is
+// empty, and sleep when there is nothing left to do
+void ThreadPool::WorkerLoop(uint32_t queueIndex)
+{
+  t_workerPool = this;
+  t_workerQueue = queueIndex;
+
+  std::function<void()> task;
+  for (;;)
+  {
+    if (PopTask(queueIndex, &task))
+    {
+      RunTask(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    m_taskAvailable.wait(lock, [this]() { return m_stop || m_queuedTaskCount > 0; });
+    if (m_stop && m_queuedTaskCount == 0)
+    {
+      return;
+    }
+  }
+}
+} // namespace nv_helpers_dx12
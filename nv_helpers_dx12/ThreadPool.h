@@ -0,0 +1,127 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Thread pool executing independent tasks, such as the CPU-side work of many
+acceleration structure builds. Each worker owns a queue: tasks submitted by a
+worker are pushed to and popped from the back of its own queue, keeping the
+most recent (cache-hot) work local, and idle workers steal from the front of
+the other queues. Tasks submitted from outside the pool are distributed over
+the queues in a round-robin fashion.
+
+The thread calling Wait also executes tasks until all of them are complete,
+rather than sleeping while the workers are busy. The first exception thrown by
+a task is rethrown by Wait.
+
+Example:
+
+nv_helpers_dx12::ThreadPool pool;
+for (auto& mesh : meshes)
+{
+  pool.Submit([&mesh]() { mesh.Build(); });
+}
+pool.Wait();
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nv_helpers_dx12
+{
+
+/// Work-stealing pool of worker threads
+class ThreadPool
+{
+public:
+  /// Start the worker threads. 0 uses all the hardware threads but one, the calling thread being
+  /// expected to help in Wait.
+  explicit ThreadPool(uint32_t threadCount = 0);
+
+  /// Stop the worker threads once the tasks already submitted are complete
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// Submit a task for execution. Tasks can themselves submit other tasks.
+  void Submit(std::function<void()> task);
+
+  /// Execute tasks on the calling thread until all the submitted tasks are complete, and rethrow
+  /// the first exception thrown by a task, if any. Must not be called from a task.
+  void Wait();
+
+  /// Number of worker threads, not counting the thread calling Wait
+  uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_workers.size()); }
+
+private:
+  /// Tasks owned by a worker
+  struct WorkQueue
+  {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  /// Fetch a task, from the back of the given queue first, then from the front of the others
+  bool PopTask(uint32_t queueIndex, std::function<void()>* task);
+
+  /// Execute a task and record its exception, if any
+  void RunTask(std::function<void()>& task);
+
+  /// Main loop of a worker thread
+  void WorkerLoop(uint32_t queueIndex);
+
+  /// One queue per worker
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::vector<std::thread> m_workers;
+
+  /// Wakes up the workers when tasks are submitted, and the waiting threads when all are done
+  std::mutex m_wakeMutex;
+  std::condition_variable m_taskAvailable;
+  std::condition_variable m_tasksDone;
+
+  /// Number of tasks in the queues
+  std::atomic<uint32_t> m_queuedTaskCount;
+  /// Number of submitted tasks not completed yet
+  std::atomic<uint32_t> m_pendingTaskCount;
+  /// Queue receiving the next task submitted from outside the pool
+  std::atomic<uint32_t> m_nextQueue;
+  bool m_stop = false;
+
+  /// First exception thrown by a task since the last Wait
+  std::mutex m_exceptionMutex;
+  std::exception_ptr m_exception;
+};
+} // namespace nv_helpers_dx12
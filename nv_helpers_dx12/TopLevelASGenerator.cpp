@@ -47,6 +47,17 @@ buffer needs to be kept until the command list execution is finished.
 
 #include "TopLevelASGenerator.h"
 
+#include "ASSizeEstimator.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define NV_HELPERS_TLAS_SSE
+#include <immintrin.h>
+#endif
+
 // Helper to compute aligned buffer sizes
 #ifndef ROUND_UP
 #define ROUND_UP(v, powerOf2Alignment) (((v) + (powerOf2Alignment)-1) & ~((powerOf2Alignment)-1))
@@ -55,13 +66,41 @@ buffer needs to be kept until the command list execution is finished.
 namespace nv_helpers_dx12
 {
 
+const UINT TopLevelASGenerator::kNoMotion;
+
+namespace
+{
+// Number of instances whose descriptors are filled by a single task. Each descriptor is exactly a
+// cache line, so that the chunks never share a line.
+const UINT kDescriptorChunkSize = 2048;
+
+// Number of dirty instances under which the descriptors are filled on the calling thread, as the
+// cost of dispatching the tasks would exceed the gain
+const size_t kMinParallelDescriptorCount = 16384;
+
+#ifdef NV_HELPERS_TLAS_SSE
+// Store 16 bytes, with a non-temporal store if the destination is aligned
+inline void StoreRow(float* destination, __m128 value, bool stream)
+{
+  if (stream)
+  {
+    _mm_stream_ps(destination, value);
+  }
+  else
+  {
+    _mm_storeu_ps(destination, value);
+  }
+}
+#endif
+} // namespace
+
 //--------------------------------------------------------------------------------------------------
 //
 // Add an instance to the top-level acceleration structure. The instance is
 // represented by a bottom-level AS, a transform, an instance ID and the index
 // of the hit group indicating which shaders are executed upon hitting any
-// geometry within the instance
-void TopLevelASGenerator::AddInstance(
+// geometry within the instance. Returns the index of the instance
+UINT TopLevelASGenerator::AddInstance(
     ID3D12Resource* bottomLevelAS,      // Bottom-level acceleration structure containing the
                                         // actual geometric data of the instance
     const DirectX::XMMATRIX& transform, // Transform matrix to apply to the instance, allowing the
@@ -69,12 +108,373 @@ void TopLevelASGenerator::AddInstance(
                                         // positions
     UINT instanceID,                    // Instance ID, which can be used in the shaders to
                                         // identify this specific instance
-    UINT hitGroupIndex                  // Hit group index, corresponding the the index of the
+    UINT hitGroupIndex,                 // Hit group index, corresponding the the index of the
                                         // hit group in the Shader Binding Table that will be
                                         // invocated upon hitting the geometry
+    UINT8 instanceMask /*= 0xFF*/       // Visibility mask, tested against the mask of the rays
+)
+{
+  return AddInstance(bottomLevelAS->GetGPUVirtualAddress(), transform, instanceID, hitGroupIndex,
+                     instanceMask);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add an instance referencing a bottom-level AS by its GPU address, for structures sharing a
+// buffer
+UINT TopLevelASGenerator::AddInstance(
+    D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS, // Address of the bottom-level AS
+    const DirectX::XMMATRIX& transform,      // Transform matrix to apply to the instance
+    UINT instanceID,                         // Instance ID visible in the shaders
+    UINT hitGroupIndex,                      // Hit group index in the Shader Binding Table
+    UINT8 instanceMask /*= 0xFF*/            // Visibility mask of the instance
 )
 {
-  m_instances.emplace_back(Instance(bottomLevelAS, transform, instanceID, hitGroupIndex));
+  UINT instanceIndex = m_instances.Size();
+  for (auto& elements : m_instances.transform)
+  {
+    elements.push_back(0.f);
+  }
+  m_instances.SetTransform(instanceIndex, transform);
+  m_instances.instanceIDAndMask.push_back((instanceID & 0xFFFFFF) |
+                                          (static_cast<uint32_t>(instanceMask) << 24));
+  // Instance flags, including backface culling, winding, etc - TODO: should
+  // be accessible from outside
+  m_instances.hitGroupAndFlags.push_back((hitGroupIndex & 0xFFFFFF) |
+                                         (D3D12_RAYTRACING_INSTANCE_FLAG_NONE << 24));
+  m_instances.bottomLevelAS.push_back(bottomLevelAS);
+  m_instances.dirty.push_back(1);
+  m_instances.movedSinceRebuild.push_back(0);
+  m_instances.rebuildPosition.push_back(m_instances.GetPosition(instanceIndex));
+  m_instances.motionIndex.push_back(kNoMotion);
+  m_dirtyInstances.push_back(instanceIndex);
+  return instanceIndex;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add an instance moving during the shutter interval, for motion blur
+UINT TopLevelASGenerator::AddInstance(
+    ID3D12Resource* bottomLevelAS,           // Bottom-level AS of the instance
+    const DirectX::XMMATRIX& beginTransform, // Transform at time 0
+    const DirectX::XMMATRIX& endTransform,   // Transform at time 1
+    UINT instanceID,                         // Instance ID visible in the shaders
+    UINT hitGroupIndex,                      // Hit group index in the Shader Binding Table
+    UINT8 instanceMask /*= 0xFF*/            // Visibility mask of the instance
+)
+{
+  return AddInstance(bottomLevelAS->GetGPUVirtualAddress(), beginTransform, endTransform,
+                     instanceID, hitGroupIndex, instanceMask);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Add an instance moving during the shutter interval, referencing a bottom-level AS by its GPU
+// address. The descriptors only use the transform at the beginning of the interval, the one at
+// the end being only stored for the CPU hierarchy.
+UINT TopLevelASGenerator::AddInstance(
+    D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS, // Address of the bottom-level AS
+    const DirectX::XMMATRIX& beginTransform, // Transform at time 0
+    const DirectX::XMMATRIX& endTransform,   // Transform at time 1
+    UINT instanceID,                         // Instance ID visible in the shaders
+    UINT hitGroupIndex,                      // Hit group index in the Shader Binding Table
+    UINT8 instanceMask /*= 0xFF*/            // Visibility mask of the instance
+)
+{
+  UINT instanceIndex =
+      AddInstance(bottomLevelAS, beginTransform, instanceID, hitGroupIndex, instanceMask);
+  SetEndTransform(instanceIndex, endTransform);
+  return instanceIndex;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Change the transform of an instance, keeping track of its displacement since the last rebuild
+void TopLevelASGenerator::SetInstanceTransform(UINT instanceIndex,
+                                               const DirectX::XMMATRIX& transform)
+{
+  if (instanceIndex >= m_instances.Size())
+  {
+    throw std::out_of_range("Invalid instance index");
+  }
+  m_instances.SetTransform(instanceIndex, transform);
+  if (m_instances.motionIndex[instanceIndex] != kNoMotion)
+  {
+    SetEndTransform(instanceIndex, transform);
+  }
+  MarkDirty(instanceIndex);
+
+  if (!m_instances.movedSinceRebuild[instanceIndex])
+  {
+    m_instances.movedSinceRebuild[instanceIndex] = 1;
+    m_movedSinceRebuildCount++;
+  }
+  DirectX::XMFLOAT3 position = m_instances.GetPosition(instanceIndex);
+  const DirectX::XMFLOAT3& rebuildPosition = m_instances.rebuildPosition[instanceIndex];
+  float dx = position.x - rebuildPosition.x;
+  float dy = position.y - rebuildPosition.y;
+  float dz = position.z - rebuildPosition.z;
+  float displacement = std::sqrt(dx * dx + dy * dy + dz * dz);
+  m_maxDisplacement = displacement > m_maxDisplacement ? displacement : m_maxDisplacement;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Change both keyframes of an instance. The motion since the last rebuild is measured on the
+// transform at the beginning of the interval, which is the one used by the descriptors.
+void TopLevelASGenerator::SetInstanceMotion(UINT instanceIndex,
+                                            const DirectX::XMMATRIX& beginTransform,
+                                            const DirectX::XMMATRIX& endTransform)
+{
+  SetInstanceTransform(instanceIndex, beginTransform);
+  SetEndTransform(instanceIndex, endTransform);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Store the end transform of an instance in the layout of the descriptors, that is transposed
+void TopLevelASGenerator::SetEndTransform(UINT instanceIndex, const DirectX::XMMATRIX& transform)
+{
+  UINT& motionIndex = m_instances.motionIndex[instanceIndex];
+  if (motionIndex == kNoMotion)
+  {
+    motionIndex = static_cast<UINT>(m_instances.endTransforms.size());
+    m_instances.endTransforms.emplace_back();
+  }
+  DirectX::XMFLOAT4X4 m;
+  DirectX::XMStoreFloat4x4(&m, transform);
+  std::array<float, 12>& endTransform = m_instances.endTransforms[motionIndex];
+  for (int row = 0; row < 3; row++)
+  {
+    for (int column = 0; column < 4; column++)
+    {
+      endTransform[4 * row + column] = m.m[column][row];
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Change the visibility mask of an instance
+void TopLevelASGenerator::SetInstanceMask(UINT instanceIndex, UINT8 instanceMask)
+{
+  uint32_t& instanceIDAndMask = m_instances.instanceIDAndMask.at(instanceIndex);
+  instanceIDAndMask = (instanceIDAndMask & 0xFFFFFF) | (static_cast<uint32_t>(instanceMask) << 24);
+  MarkDirty(instanceIndex);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Change the hit group index of an instance
+void TopLevelASGenerator::SetInstanceHitGroupIndex(UINT instanceIndex, UINT hitGroupIndex)
+{
+  uint32_t& hitGroupAndFlags = m_instances.hitGroupAndFlags.at(instanceIndex);
+  hitGroupAndFlags = (hitGroupAndFlags & 0xFF000000) | (hitGroupIndex & 0xFFFFFF);
+  MarkDirty(instanceIndex);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Set when an update requested from Generate is replaced by a full rebuild
+void TopLevelASGenerator::SetRebuildThresholds(float movedFraction, float maxDisplacement)
+{
+  if (movedFraction < 0.f || maxDisplacement < 0.f)
+  {
+    throw std::logic_error("The rebuild thresholds cannot be negative");
+  }
+  m_rebuildMovedFraction = movedFraction;
+  m_rebuildMaxDisplacement = maxDisplacement;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// True if too many instances moved, or if an instance moved too far, since the last rebuild
+bool TopLevelASGenerator::NeedsRebuild() const
+{
+  if (m_instances.Size() == 0)
+  {
+    return false;
+  }
+  float movedFraction =
+      static_cast<float>(m_movedSinceRebuildCount) / static_cast<float>(m_instances.Size());
+  return movedFraction > m_rebuildMovedFraction ||
+         m_maxDisplacement > m_rebuildMaxDisplacement * m_rebuildExtent;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Mark an instance dirty, so that its descriptor is rewritten by the next Generate
+void TopLevelASGenerator::MarkDirty(UINT instanceIndex)
+{
+  if (!m_instances.dirty[instanceIndex])
+  {
+    m_instances.dirty[instanceIndex] = 1;
+    m_dirtyInstances.push_back(instanceIndex);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Fill the descriptors of the instances in [begin, end). Row r of the 3x4 matrix of a descriptor
+// is column r of the XMMATRIX, that is the elements r, 3+r, 6+r and 9+r of the instance store:
+// loading those elements for 4 (or 8) consecutive instances and transposing the resulting 4x4
+// (or 4x8) block yields the rows of 4 (or 8) descriptors. The descriptors are assembled in
+// registers and written with full 16-byte non-temporal stores in increasing addresses, as reading
+// back or partially writing the bit fields would be slow on the write-combined upload heap.
+void TopLevelASGenerator::PackInstanceDescs(UINT begin, UINT end,
+                                            D3D12_RAYTRACING_INSTANCE_DESC* descs) const
+{
+  static_assert(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) == 64,
+                "Instance descriptors are expected to be 4 rows of 16 bytes");
+  const std::vector<float>* t = m_instances.transform;
+  const uint32_t* idMask = m_instances.instanceIDAndMask.data();
+  const uint32_t* hitGroupFlags = m_instances.hitGroupAndFlags.data();
+  const D3D12_GPU_VIRTUAL_ADDRESS* bottomLevelAS = m_instances.bottomLevelAS.data();
+  UINT i = begin;
+
+#ifdef NV_HELPERS_TLAS_SSE
+  // Last 16 bytes of a descriptor: InstanceID and InstanceMask, then the hit group index and
+  // flags, then the address of the bottom-level AS
+  auto packTail = [&](UINT index) {
+    return _mm_castsi128_ps(_mm_set_epi64x(
+        static_cast<long long>(bottomLevelAS[index]),
+        static_cast<long long>(static_cast<uint64_t>(hitGroupFlags[index]) << 32 | idMask[index])));
+  };
+  // The mapped buffer is aligned, hence the descriptors too, which allows non-temporal stores:
+  // those bypass the caches and fill the write-combining buffers with whole lines
+  bool stream = (reinterpret_cast<uintptr_t>(descs) & 15) == 0;
+
+#ifdef __AVX__
+  for (; i + 8 <= end; i += 8)
+  {
+    __m256 rows[3][4];
+    for (int r = 0; r < 3; r++)
+    {
+      __m256 c0 = _mm256_loadu_ps(&t[r][i]);
+      __m256 c1 = _mm256_loadu_ps(&t[3 + r][i]);
+      __m256 c2 = _mm256_loadu_ps(&t[6 + r][i]);
+      __m256 c3 = _mm256_loadu_ps(&t[9 + r][i]);
+      // Transpose the 4x8 block within each 128-bit lane, so that each lane of rows[r][k]
+      // contains the row r of instance i+k (low lane) and i+4+k (high lane)
+      __m256 t0 = _mm256_unpacklo_ps(c0, c1);
+      __m256 t1 = _mm256_unpacklo_ps(c2, c3);
+      __m256 t2 = _mm256_unpackhi_ps(c0, c1);
+      __m256 t3 = _mm256_unpackhi_ps(c2, c3);
+      rows[r][0] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+      rows[r][1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+      rows[r][2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+      rows[r][3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    for (UINT k = 0; k < 8; k++)
+    {
+      auto desc = reinterpret_cast<float*>(&descs[i + k]);
+      for (int r = 0; r < 3; r++)
+      {
+        __m256 v = rows[r][k & 3];
+        StoreRow(desc + 4 * r, k < 4 ? _mm256_castps256_ps128(v) : _mm256_extractf128_ps(v, 1),
+                 stream);
+      }
+      StoreRow(desc + 12, packTail(i + k), stream);
+    }
+  }
+#endif
+
+  for (; i + 4 <= end; i += 4)
+  {
+    __m128 rows[3][4];
+    for (int r = 0; r < 3; r++)
+    {
+      rows[r][0] = _mm_loadu_ps(&t[r][i]);
+      rows[r][1] = _mm_loadu_ps(&t[3 + r][i]);
+      rows[r][2] = _mm_loadu_ps(&t[6 + r][i]);
+      rows[r][3] = _mm_loadu_ps(&t[9 + r][i]);
+      _MM_TRANSPOSE4_PS(rows[r][0], rows[r][1], rows[r][2], rows[r][3]);
+    }
+    for (UINT k = 0; k < 4; k++)
+    {
+      auto desc = reinterpret_cast<float*>(&descs[i + k]);
+      StoreRow(desc, rows[0][k], stream);
+      StoreRow(desc + 4, rows[1][k], stream);
+      StoreRow(desc + 8, rows[2][k], stream);
+      StoreRow(desc + 12, packTail(i + k), stream);
+    }
+  }
+#endif
+
+  // Remaining instances, or all of them without SIMD support. The descriptor is built on the
+  // stack and then copied.
+  for (; i < end; i++)
+  {
+    D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
+    for (int r = 0; r < 3; r++)
+    {
+      for (int c = 0; c < 4; c++)
+      {
+        instanceDesc.Transform[r][c] = t[3 * c + r][i];
+      }
+    }
+    instanceDesc.InstanceID = idMask[i] & 0xFFFFFF;
+    instanceDesc.InstanceMask = idMask[i] >> 24;
+    instanceDesc.InstanceContributionToHitGroupIndex = hitGroupFlags[i] & 0xFFFFFF;
+    instanceDesc.Flags = hitGroupFlags[i] >> 24;
+    instanceDesc.AccelerationStructure = bottomLevelAS[i];
+#ifdef NV_HELPERS_TLAS_SSE
+    auto source = reinterpret_cast<const float*>(&instanceDesc);
+    auto desc = reinterpret_cast<float*>(&descs[i]);
+    for (int r = 0; r < 4; r++)
+    {
+      StoreRow(desc + 4 * r, _mm_loadu_ps(source + 4 * r), stream);
+    }
+#else
+    memcpy(&descs[i], &instanceDesc, sizeof(instanceDesc));
+#endif
+  }
+
+#ifdef NV_HELPERS_TLAS_SSE
+  // Non-temporal stores are weakly ordered: make them visible before the descriptors are used
+  _mm_sfence();
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Write the descriptors of the dirty instances. The sorted dirty indices are split into runs of
+// consecutive instances, themselves split into chunks of at most kDescriptorChunkSize instances.
+// Since each descriptor fills a cache line, the chunks can be written by different threads without
+// sharing lines. The pool is only used when there are enough dirty instances to amortize it.
+void TopLevelASGenerator::WriteDirtyDescriptors()
+{
+  std::vector<std::pair<UINT, UINT>> chunks;
+  size_t runStart = 0;
+  for (size_t d = 1; d <= m_dirtyInstances.size(); d++)
+  {
+    if (d == m_dirtyInstances.size() || m_dirtyInstances[d] != m_dirtyInstances[d - 1] + 1)
+    {
+      UINT runEnd = m_dirtyInstances[d - 1] + 1;
+      for (UINT begin = m_dirtyInstances[runStart]; begin < runEnd; begin += kDescriptorChunkSize)
+      {
+        chunks.push_back({begin, (std::min)(begin + kDescriptorChunkSize, runEnd)});
+      }
+      runStart = d;
+    }
+  }
+
+  if (m_threadPool == nullptr || chunks.size() < 2 ||
+      m_dirtyInstances.size() < kMinParallelDescriptorCount)
+  {
+    for (const auto& chunk : chunks)
+    {
+      PackInstanceDescs(chunk.first, chunk.second, m_mappedDescriptors);
+    }
+    return;
+  }
+
+  for (const auto& chunk : chunks)
+  {
+    m_threadPool->Submit(
+        [this, chunk]() { PackInstanceDescs(chunk.first, chunk.second, m_mappedDescriptors); });
+  }
+  m_threadPool->Wait();
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -90,9 +490,11 @@ void TopLevelASGenerator::ComputeASBufferSizes(
                                              // the acceleration structure
     UINT64* resultSizeInBytes,               // Required GPU memory to store the acceleration
                                              // structure
-    UINT64* descriptorsSizeInBytes           // Required GPU memory to store instance
+    UINT64* descriptorsSizeInBytes,          // Required GPU memory to store instance
                                              // descriptors, containing the matrices,
                                              // indices etc.
+    bool allowCompaction                     // If true, the resulting acceleration structure
+                                             // can be compacted after the build
 )
 {
   // The generated AS can support iterative updates. This may change the final
@@ -100,6 +502,10 @@ void TopLevelASGenerator::ComputeASBufferSizes(
   // to be set before the actual build
   m_flags = allowUpdate ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
                         : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+  if (allowCompaction)
+  {
+    m_flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+  }
 
   // Describe the work being requested, in this case the construction of a
   // (possibly dynamic) top-level hierarchy, with the given instance descriptors
@@ -107,7 +513,7 @@ void TopLevelASGenerator::ComputeASBufferSizes(
   prebuildDesc = {};
   prebuildDesc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
   prebuildDesc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-  prebuildDesc.NumDescs = static_cast<UINT>(m_instances.size());
+  prebuildDesc.NumDescs = m_instances.Size();
   prebuildDesc.Flags = m_flags;
 
   // This structure is used to hold the sizes of the required scratch memory and
@@ -117,8 +523,16 @@ void TopLevelASGenerator::ComputeASBufferSizes(
   // Building the acceleration structure (AS) requires some scratch space, as
   // well as space to store the resulting structure This function computes a
   // conservative estimate of the memory requirements for both, based on the
-  // number of bottom-level instances.
-  device->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildDesc, &info);
+  // number of bottom-level instances. Without a device, the sizes are
+  // estimated from the same inputs
+  if (device)
+  {
+    device->GetRaytracingAccelerationStructurePrebuildInfo(&prebuildDesc, &info);
+  }
+  else
+  {
+    info = EstimateTopLevelASPrebuildInfo(m_instances.Size(), m_flags);
+  }
 
   // Buffer sizes need to be 256-byte-aligned
   info.ResultDataMaxSizeInBytes =
@@ -131,12 +545,67 @@ void TopLevelASGenerator::ComputeASBufferSizes(
   // The instance descriptors are stored as-is in GPU memory, so we can deduce
   // the required size from the instance count
   m_instanceDescsSizeInBytes =
-      ROUND_UP(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * static_cast<UINT64>(m_instances.size()),
+      ROUND_UP(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * static_cast<UINT64>(m_instances.Size()),
                D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
 
   *scratchSizeInBytes = m_scratchSizeInBytes;
   *resultSizeInBytes = m_resultSizeInBytes;
   *descriptorsSizeInBytes = m_instanceDescsSizeInBytes;
+
+  // New buffers are expected to be allocated, whose descriptors all have to be written
+  m_lastDescriptorsBuffer = nullptr;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Write the descriptors of the dirty instances in the descriptor buffer
+void TopLevelASGenerator::UpdateInstanceDescriptors(ID3D12Resource* descriptorsBuffer)
+{
+  UINT instanceCount = m_instances.Size();
+  if (sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * static_cast<UINT64>(instanceCount) >
+      m_instanceDescsSizeInBytes)
+  {
+    throw std::logic_error("Instances were added since ComputeASBufferSizes was called");
+  }
+
+  // The descriptors written by the previous call are kept in the buffer, so only the dirty
+  // instances need to be written. A new buffer is mapped once for its lifetime, as resources in
+  // the upload heap can remain mapped while in use by the GPU. The CPU never reads the mapped
+  // memory. The buffer is then written entirely, zeroing its padding once.
+  bool newBuffer = descriptorsBuffer != m_lastDescriptorsBuffer;
+  if (newBuffer)
+  {
+    D3D12_RANGE readRange = {0, 0};
+    void* mappedData = nullptr;
+    descriptorsBuffer->Map(0, &readRange, &mappedData);
+    if (!mappedData)
+    {
+      throw std::logic_error("Cannot map the instance descriptor buffer - is it "
+                             "in the upload heap?");
+    }
+    m_mappedDescriptors = static_cast<D3D12_RAYTRACING_INSTANCE_DESC*>(mappedData);
+    m_lastDescriptorsBuffer = descriptorsBuffer;
+
+    SIZE_T usedSize = sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceCount;
+    ZeroMemory(static_cast<uint8_t*>(mappedData) + usedSize,
+               static_cast<SIZE_T>(m_instanceDescsSizeInBytes) - usedSize);
+
+    m_dirtyInstances.clear();
+    for (UINT i = 0; i < instanceCount; i++)
+    {
+      m_dirtyInstances.push_back(i);
+    }
+  }
+
+  // Write the dirty descriptors in increasing addresses, which keeps the write-combined stores
+  // sequential
+  if (!m_dirtyInstances.empty())
+  {
+    std::sort(m_dirtyInstances.begin(), m_dirtyInstances.end());
+    WriteDirtyDescriptors();
+    std::fill(m_instances.dirty.begin(), m_instances.dirty.end(), 0);
+    m_dirtyInstances.clear();
+  }
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -154,50 +623,66 @@ void TopLevelASGenerator::Generate(
                                        // descriptors, has to be in upload heap
     bool updateOnly /*= false*/,       // If true, simply refit the existing
                                        // acceleration structure
-    ID3D12Resource* previousResult /*= nullptr*/ // Optional previous acceleration
-                                                 // structure, used if an iterative update
-                                                 // is requested
+    ID3D12Resource* previousResult /*= nullptr*/, // Optional previous acceleration
+                                                  // structure, used if an iterative update
+                                                  // is requested
+    D3D12_GPU_VIRTUAL_ADDRESS compactedSizeAddress /*= 0*/ // Optional address receiving the
+                                                           // compacted size of the structure
 )
 {
-  // Copy the descriptors in the target descriptor buffer
-  D3D12_RAYTRACING_INSTANCE_DESC* instanceDescs;
-  descriptorsBuffer->Map(0, nullptr, reinterpret_cast<void**>(&instanceDescs));
-  if (!instanceDescs)
+  bool allowUpdate =
+      (m_flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) != 0;
+
+  // Sanity checks
+  if (!allowUpdate && updateOnly)
   {
-    throw std::logic_error("Cannot map the instance descriptor buffer - is it "
-                           "in the upload heap?");
+    throw std::logic_error("Cannot update a top-level AS not originally built for updates");
   }
-
-  auto instanceCount = static_cast<UINT>(m_instances.size());
-
-  // Initialize the memory to zero on the first time only
-  if (!updateOnly)
+  if (updateOnly && previousResult == nullptr)
   {
-    ZeroMemory(instanceDescs, m_instanceDescsSizeInBytes);
+    throw std::logic_error("Top-level hierarchy update requires the previous hierarchy");
   }
-
-  // Create the description for each instance
-  for (uint32_t i = 0; i < instanceCount; i++)
+  if (compactedSizeAddress != 0 &&
+      (m_flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION) == 0)
   {
-    // Instance ID visible in the shader in InstanceID()
-    instanceDescs[i].InstanceID = m_instances[i].instanceID;
-    // Index of the hit group invoked upon intersection
-    instanceDescs[i].InstanceContributionToHitGroupIndex = m_instances[i].hitGroupIndex;
-    // Instance flags, including backface culling, winding, etc - TODO: should
-    // be accessible from outside
-    instanceDescs[i].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-    // Instance transform matrix
-    DirectX::XMMATRIX m = XMMatrixTranspose(
-        m_instances[i].transform); // GLM is column major, the INSTANCE_DESC is row major
-    memcpy(instanceDescs[i].Transform, &m, sizeof(instanceDescs[i].Transform));
-    // Get access to the bottom level
-    instanceDescs[i].AccelerationStructure = m_instances[i].bottomLevelAS->GetGPUVirtualAddress();
-    // Visibility mask, always visible here - TODO: should be accessible from
-    // outside
-    instanceDescs[i].InstanceMask = 0xFF;
+    throw std::logic_error(
+        "Cannot query the compacted size of a top-level AS not built with compaction allowed");
   }
 
-  descriptorsBuffer->Unmap(0, nullptr);
+  UpdateInstanceDescriptors(descriptorsBuffer);
+
+  // A refit is only performed if the instances did not move too much since the last rebuild, and
+  // requires the same instances as the previous build
+  UINT instanceCount = m_instances.Size();
+  bool rebuild = !updateOnly || NeedsRebuild() || instanceCount != m_lastBuildInstanceCount;
+
+  // A rebuild resets the reference positions used to measure the motion of the instances
+  if (rebuild)
+  {
+    DirectX::XMFLOAT3 minPosition = {FLT_MAX, FLT_MAX, FLT_MAX};
+    DirectX::XMFLOAT3 maxPosition = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (UINT i = 0; i < instanceCount; i++)
+    {
+      DirectX::XMFLOAT3 position = m_instances.GetPosition(i);
+      m_instances.rebuildPosition[i] = position;
+      minPosition.x = (std::min)(minPosition.x, position.x);
+      minPosition.y = (std::min)(minPosition.y, position.y);
+      minPosition.z = (std::min)(minPosition.z, position.z);
+      maxPosition.x = (std::max)(maxPosition.x, position.x);
+      maxPosition.y = (std::max)(maxPosition.y, position.y);
+      maxPosition.z = (std::max)(maxPosition.z, position.z);
+    }
+    std::fill(m_instances.movedSinceRebuild.begin(), m_instances.movedSinceRebuild.end(), 0);
+    float dx = maxPosition.x - minPosition.x;
+    float dy = maxPosition.y - minPosition.y;
+    float dz = maxPosition.z - minPosition.z;
+    m_rebuildExtent = instanceCount == 0 ? 0.f : std::sqrt(dx * dx + dy * dy + dz * dz);
+    m_movedSinceRebuildCount = 0;
+    m_maxDisplacement = 0.f;
+  }
+  m_lastBuildWasUpdate = !rebuild;
+  m_lastBuildInstanceCount = instanceCount;
+  updateOnly = !rebuild;
 
   // If this in an update operation we need to provide the source buffer
   D3D12_GPU_VIRTUAL_ADDRESS pSourceAS = updateOnly ? previousResult->GetGPUVirtualAddress() : 0;
@@ -206,19 +691,9 @@ void TopLevelASGenerator::Generate(
   // The stored flags represent whether the AS has been built for updates or
   // not. If yes and an update is requested, the builder is told to only update
   // the AS instead of fully rebuilding it
-  if (flags == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE && updateOnly)
+  if (allowUpdate && updateOnly)
   {
-    flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
-  }
-
-  // Sanity checks
-  if (m_flags != D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE && updateOnly)
-  {
-    throw std::logic_error("Cannot update a top-level AS not originally built for updates");
-  }
-  if (updateOnly && previousResult == nullptr)
-  {
-    throw std::logic_error("Top-level hierarchy update requires the previous hierarchy");
+    flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
   }
 
   // Create a descriptor of the requested builder work, to generate a top-level
@@ -235,8 +710,16 @@ void TopLevelASGenerator::Generate(
   buildDesc.SourceAccelerationStructureData = pSourceAS;
   buildDesc.Inputs.Flags = flags;
 
+  // The compacted size is only known once the build is complete, and is
+  // written by the GPU to the application-provided address
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc;
+  postbuildDesc.DestBuffer = compactedSizeAddress;
+  postbuildDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+
   // Build the top-level AS
-  commandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
+  commandList->BuildRaytracingAccelerationStructure(
+      &buildDesc, compactedSizeAddress != 0 ? 1 : 0,
+      compactedSizeAddress != 0 ? &postbuildDesc : nullptr);
 
   // Wait for the builder to complete by setting a barrier on the resulting
   // buffer. This can be important in case the rendering is triggered
@@ -250,10 +733,96 @@ void TopLevelASGenerator::Generate(
 
 //--------------------------------------------------------------------------------------------------
 //
+// Enqueue the copy of an acceleration structure built with compaction allowed
+// into a buffer of the size emitted by Generate. The copy only contains the
+// data actually used by the structure, so that the oversized source buffer can
+// be released once the command list is executed.
+void TopLevelASGenerator::Compact(
+    ID3D12GraphicsCommandList4* commandList, // Command list on which the copy will be enqueued
+    ID3D12Resource* sourceBuffer,            // Buffer storing the acceleration structure
+    ID3D12Resource* compactedBuffer          // Buffer of the compacted size, receiving the
+                                             // structure
+)
+{
+  commandList->CopyRaytracingAccelerationStructure(
+      compactedBuffer->GetGPUVirtualAddress(), sourceBuffer->GetGPUVirtualAddress(),
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+
+  // Wait for the copy to complete before the structure is used for rendering
+  D3D12_RESOURCE_BARRIER uavBarrier;
+  uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+  uavBarrier.UAV.pResource = compactedBuffer;
+  uavBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+  commandList->ResourceBarrier(1, &uavBarrier);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build the top-level hierarchy on the CPU. The instances are converted to the layout of the
+// descriptors, and each bottom-level AS is resolved into its CPU hierarchy by its GPU address.
+void TopLevelASGenerator::GenerateOnCPU(
+    const std::unordered_map<D3D12_GPU_VIRTUAL_ADDRESS, const BVH*>&
+        bottomLevelHierarchies,  // CPU hierarchy of each bottom-level AS, by GPU address
+    TopLevelBVH* result,         // Hierarchy built over the instances
+    const BVHBuilder& builder    // Builder and its settings
+) const
+{
+  UINT instanceCount = m_instances.Size();
+  std::vector<BVHInstance> instances(instanceCount);
+  for (UINT i = 0; i < instanceCount; i++)
+  {
+    auto bottomLevel = bottomLevelHierarchies.find(m_instances.bottomLevelAS[i]);
+    if (bottomLevel == bottomLevelHierarchies.end())
+    {
+      throw std::logic_error("No CPU hierarchy was given for the bottom-level AS of an instance");
+    }
+
+    BVHInstance& instance = instances[i];
+    for (int row = 0; row < 3; row++)
+    {
+      for (int column = 0; column < 4; column++)
+      {
+        instance.transform[row][column] = m_instances.transform[3 * column + row][i];
+      }
+    }
+    UINT motionIndex = m_instances.motionIndex[i];
+    instance.hasMotion = motionIndex != kNoMotion;
+    if (instance.hasMotion)
+    {
+      memcpy(instance.endTransform, m_instances.endTransforms[motionIndex].data(),
+             sizeof(instance.endTransform));
+    }
+    instance.bottomLevel = bottomLevel->second;
+    instance.instanceID = m_instances.instanceIDAndMask[i] & 0xFFFFFF;
+    instance.instanceMask = static_cast<uint8_t>(m_instances.instanceIDAndMask[i] >> 24);
+    instance.hitGroupIndex = m_instances.hitGroupAndFlags[i] & 0xFFFFFF;
+  }
+  result->Build(std::move(instances), builder);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Store the first 3 columns of a transform matrix, the last one being implicitly (0, 0, 0, 1)
+void TopLevelASGenerator::InstanceStore::SetTransform(UINT instanceIndex,
+                                                      const DirectX::XMMATRIX& matrix)
+{
+  DirectX::XMFLOAT4X4 m;
+  DirectX::XMStoreFloat4x4(&m, matrix);
+  for (int row = 0; row < 4; row++)
+  {
+    for (int column = 0; column < 3; column++)
+    {
+      transform[3 * row + column][instanceIndex] = m.m[row][column];
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
 //
-TopLevelASGenerator::Instance::Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID,
-                                        UINT hgId)
-    : bottomLevelAS(blAS), transform(tr), instanceID(iID), hitGroupIndex(hgId)
+// The translation is stored in the last row of the matrix
+DirectX::XMFLOAT3 TopLevelASGenerator::InstanceStore::GetPosition(UINT instanceIndex) const
 {
+  return {transform[9][instanceIndex], transform[10][instanceIndex],
+          transform[11][instanceIndex]};
 }
 } // namespace nv_helpers_dx12
@@ -64,14 +64,45 @@ m_topLevelAS.pResult.Get() : nullptr);
 
 return buffers;
 
+The descriptor buffer is mapped once, and the descriptors are written with
+non-temporal stores, bypassing the caches on the write-combined upload heap. For
+large instance counts, the descriptors can be filled in parallel:
+
+nv_helpers_dx12::ThreadPool threadPool;
+topLevelAS.SetThreadPool(&threadPool);
+
+Instances can then be modified individually, which marks them dirty. The next
+call to Generate only rewrites the descriptors of the dirty instances, and
+refits the structure unless the instances moved too much since the last full
+build, in which case the structure is rebuilt:
+
+topLevelAS.SetInstanceTransform(movingInstance, newMatrix);
+topLevelAS.SetInstanceMask(hiddenInstance, 0);
+topLevelAS.Generate(m_commandList.Get(), m_topLevelAS.pScratch.Get(),
+m_topLevelAS.pResult.Get(), m_topLevelAS.pInstanceDesc.Get(), true,
+m_topLevelAS.pResult.Get());
+
+The same instances can be built into a CPU hierarchy, given the CPU hierarchies
+of the bottom-level AS, to trace rays without a GPU (see TopLevelBVH.h):
+
+std::unordered_map<D3D12_GPU_VIRTUAL_ADDRESS, const nv_helpers_dx12::BVH*> hierarchies;
+hierarchies[bottomLevelBuffer->GetGPUVirtualAddress()] = &bottomLevelBvh;
+nv_helpers_dx12::TopLevelBVH topLevelBvh;
+topLevelAS.GenerateOnCPU(hierarchies, &topLevelBvh);
+
 */
 
 #pragma once
 
 #include "d3d12.h"
 
+#include "ThreadPool.h"
+#include "TopLevelBVH.h"
+
 #include <DirectXMath.h>
 
+#include <array>
+#include <unordered_map>
 #include <vector>
 
 namespace nv_helpers_dx12
@@ -84,8 +115,9 @@ public:
   /// Add an instance to the top-level acceleration structure. The instance is
   /// represented by a bottom-level AS, a transform, an instance ID and the
   /// index of the hit group indicating which shaders are executed upon hitting
-  /// any geometry within the instance
-  void
+  /// any geometry within the instance. The transform is copied, and can later
+  /// be modified with SetInstanceTransform. Returns the index of the instance.
+  UINT
   AddInstance(ID3D12Resource* bottomLevelAS, /// Bottom-level acceleration structure containing the
                                              /// actual geometric data of the instance
               const DirectX::XMMATRIX& transform, /// Transform matrix to apply to the instance,
@@ -93,32 +125,110 @@ public:
                                                   /// at several world-space positions
               UINT instanceID,   /// Instance ID, which can be used in the shaders to
                                  /// identify this specific instance
-              UINT hitGroupIndex /// Hit group index, corresponding the the index of the
-                                 /// hit group in the Shader Binding Table that will be
-                                 /// invocated upon hitting the geometry
+              UINT hitGroupIndex, /// Hit group index, corresponding the the index of the
+                                  /// hit group in the Shader Binding Table that will be
+                                  /// invocated upon hitting the geometry
+              UINT8 instanceMask = 0xFF /// Visibility mask, tested against the mask of the
+                                        /// rays in TraceRay
+  );
+
+  /// Add an instance referencing a bottom-level AS by its GPU address, for structures sharing a
+  /// buffer such as the ones built by BottomLevelASBatch
+  UINT AddInstance(D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS, /// Address of the bottom-level AS
+                   const DirectX::XMMATRIX& transform, /// Transform matrix to apply to the instance
+                   UINT instanceID,    /// Instance ID visible in the shaders
+                   UINT hitGroupIndex, /// Hit group index in the Shader Binding Table
+                   UINT8 instanceMask = 0xFF /// Visibility mask of the instance
+  );
+
+  /// Add an instance moving during the shutter interval, for motion blur. The CPU traversal of
+  /// TopLevelBVH interpolates linearly between the transforms at the beginning and at the end of
+  /// the interval, at the time of each ray. As DXR does not support motion, the descriptors
+  /// written by Generate use the transform at the beginning of the interval.
+  UINT AddInstance(ID3D12Resource* bottomLevelAS,          /// Bottom-level AS of the instance
+                   const DirectX::XMMATRIX& beginTransform, /// Transform at time 0
+                   const DirectX::XMMATRIX& endTransform,   /// Transform at time 1
+                   UINT instanceID,    /// Instance ID visible in the shaders
+                   UINT hitGroupIndex, /// Hit group index in the Shader Binding Table
+                   UINT8 instanceMask = 0xFF /// Visibility mask of the instance
+  );
+  UINT AddInstance(D3D12_GPU_VIRTUAL_ADDRESS bottomLevelAS,  /// Address of the bottom-level AS
+                   const DirectX::XMMATRIX& beginTransform, /// Transform at time 0
+                   const DirectX::XMMATRIX& endTransform,   /// Transform at time 1
+                   UINT instanceID,    /// Instance ID visible in the shaders
+                   UINT hitGroupIndex, /// Hit group index in the Shader Binding Table
+                   UINT8 instanceMask = 0xFF /// Visibility mask of the instance
   );
 
+  /// Change the transform of an instance, marking it dirty. For an instance with motion, both
+  /// keyframes are set to the transform.
+  void SetInstanceTransform(UINT instanceIndex, const DirectX::XMMATRIX& transform);
+
+  /// Change the transforms at the beginning and at the end of the shutter interval of an
+  /// instance, marking it dirty. This gives motion to instances added without it.
+  void SetInstanceMotion(UINT instanceIndex, const DirectX::XMMATRIX& beginTransform,
+                         const DirectX::XMMATRIX& endTransform);
+
+  /// Change the visibility mask of an instance, marking it dirty
+  void SetInstanceMask(UINT instanceIndex, UINT8 instanceMask);
+
+  /// Change the hit group index of an instance, marking it dirty
+  void SetInstanceHitGroupIndex(UINT instanceIndex, UINT hitGroupIndex);
+
+  /// Set when an update requested from Generate is replaced by a full rebuild: when more than
+  /// movedFraction of the instances moved since the last rebuild, or when an instance moved by
+  /// more than maxDisplacement times the extent of the instance positions at the last rebuild.
+  /// Refitting keeps the topology of the previous build, whose quality degrades as the instances
+  /// move away from their original positions.
+  void SetRebuildThresholds(float movedFraction, float maxDisplacement);
+
+  /// True if the motion since the last rebuild exceeds the thresholds, see SetRebuildThresholds
+  bool NeedsRebuild() const;
+
+  /// True if the last call to Generate refitted the structure rather than rebuilding it
+  bool WasLastBuildUpdate() const { return m_lastBuildWasUpdate; }
+
+  /// Pool on which Generate fills the instance descriptors, or nullptr to fill them on the
+  /// calling thread. The pool is only used for large numbers of dirty instances, and Generate
+  /// must then not be called from one of its tasks.
+  void SetThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; }
+
   /// Compute the size of the scratch space required to build the acceleration
   /// structure, as well as the size of the resulting structure. The allocation
-  /// of the buffers is then left to the application
+  /// of the buffers is then left to the application. Without a device, the
+  /// sizes are estimated by EstimateTopLevelASPrebuildInfo, for budgeting only.
   void ComputeASBufferSizes(
-      ID3D12Device5* device, /// Device on which the build will be performed
+      ID3D12Device5* device, /// Device on which the build will be performed, or nullptr
       bool allowUpdate,              /// If true, the resulting acceleration structure will
                                      /// allow iterative updates
       UINT64* scratchSizeInBytes,    /// Required scratch memory on the GPU to
                                      /// build the acceleration structure
       UINT64* resultSizeInBytes,     /// Required GPU memory to store the
                                      /// acceleration structure
-      UINT64* descriptorsSizeInBytes /// Required GPU memory to store instance
-                                     /// descriptors, containing the matrices,
-                                     /// indices etc.
+      UINT64* descriptorsSizeInBytes, /// Required GPU memory to store instance
+                                      /// descriptors, containing the matrices,
+                                      /// indices etc.
+      bool allowCompaction = false    /// If true, the size of the compacted acceleration
+                                      /// structure can be emitted by Generate, and the
+                                      /// structure then copied into a tightly sized buffer
+                                      /// using Compact
   );
 
+  /// Write the descriptors of the dirty instances in the descriptor buffer, as done by Generate
+  /// before enqueuing the build. Calling it ahead of Generate, with the same buffer, overlaps the
+  /// writes with other CPU work, after which Generate only enqueues the build.
+  void UpdateInstanceDescriptors(ID3D12Resource* descriptorsBuffer);
+
   /// Enqueue the construction of the acceleration structure on a command list,
   /// using application-provided buffers and possibly a pointer to the previous
   /// acceleration structure in case of iterative updates. Note that the update
   /// can be done in place: the result and previousResult pointers can be the
-  /// same.
+  /// same. Only the descriptors of the dirty instances are written, unless the
+  /// descriptor buffer changed since the last call: the dirty tracking assumes
+  /// the same descriptor buffer is used from one call to the next. A requested
+  /// update is replaced by a rebuild when NeedsRebuild is true, or when
+  /// instances were added since the last build. The descriptor buffer is mapped
+  /// the first time it is used, and remains mapped for its lifetime.
   void Generate(
       ID3D12GraphicsCommandList4* commandList, /// Command list on which the build will be enqueued
       ID3D12Resource* scratchBuffer,     /// Scratch buffer used by the builder to
@@ -127,29 +237,105 @@ public:
       ID3D12Resource* descriptorsBuffer, /// Auxiliary result buffer containing the instance
                                          /// descriptors, has to be in upload heap
       bool updateOnly = false, /// If true, simply refit the existing acceleration structure
-      ID3D12Resource* previousResult = nullptr /// Optional previous acceleration structure, used
-                                               /// if an iterative update is requested
+      ID3D12Resource* previousResult = nullptr, /// Optional previous acceleration structure, used
+                                                /// if an iterative update is requested
+      D3D12_GPU_VIRTUAL_ADDRESS compactedSizeAddress = 0 /// Optional address of 8 bytes in a
+                                                         /// buffer in the UAV state, receiving
+                                                         /// the compacted size of the structure
+  );
+
+  /// Enqueue the copy of an acceleration structure built with compaction allowed into a buffer of
+  /// the size emitted by Generate. Once the command list is executed, the source buffer can be
+  /// released.
+  static void Compact(
+      ID3D12GraphicsCommandList4* commandList, /// Command list on which the copy will be enqueued
+      ID3D12Resource* sourceBuffer,            /// Buffer storing the acceleration structure
+      ID3D12Resource* compactedBuffer /// Buffer of the compacted size, receiving the structure
   );
 
+  /// Build the top-level hierarchy on the CPU, from the current instances. The bottom-level AS
+  /// referenced by each instance is resolved into its CPU hierarchy using its GPU address, as
+  /// given to AddInstance. The hierarchies must outlive the result.
+  void GenerateOnCPU(
+      const std::unordered_map<D3D12_GPU_VIRTUAL_ADDRESS, const BVH*>&
+          bottomLevelHierarchies, /// CPU hierarchy of each bottom-level AS, by GPU address
+      TopLevelBVH* result,        /// Hierarchy built over the instances
+      const BVHBuilder& builder = BVHBuilder() /// Builder and its settings
+  ) const;
+
 private:
-  /// Helper struct storing the instance data
-  struct Instance
+  /// Instance data stored as a structure of arrays, so that the descriptors of several instances
+  /// can be packed at once using SIMD instructions
+  struct InstanceStore
   {
-    Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID, UINT hgId);
-    /// Bottom-level AS
-    ID3D12Resource* bottomLevelAS;
-    /// Transform matrix
-    const DirectX::XMMATRIX& transform;
-    /// Instance ID visible in the shader
-    UINT instanceID;
-    /// Hit group index used to fetch the shaders from the SBT
-    UINT hitGroupIndex;
+    /// Elements of the transform matrices: transform[3 * row + column] holds the element (row,
+    /// column) of the XMMATRIX of each instance. Only the first 3 columns are stored, which form
+    /// the rows of the transposed 3x4 matrix of the descriptors.
+    std::vector<float> transform[12];
+    /// InstanceID in the low 24 bits and InstanceMask in the high 8 bits, as in the descriptors
+    std::vector<uint32_t> instanceIDAndMask;
+    /// InstanceContributionToHitGroupIndex in the low 24 bits and Flags in the high 8 bits
+    std::vector<uint32_t> hitGroupAndFlags;
+    /// Address of the bottom-level AS
+    std::vector<D3D12_GPU_VIRTUAL_ADDRESS> bottomLevelAS;
+    /// True if the descriptor has to be rewritten by the next Generate
+    std::vector<uint8_t> dirty;
+    /// True if the transform changed since the last rebuild
+    std::vector<uint8_t> movedSinceRebuild;
+    /// Position of the instance at the last rebuild
+    std::vector<DirectX::XMFLOAT3> rebuildPosition;
+    /// Index of the transform at the end of the shutter interval in endTransforms, or kNoMotion
+    std::vector<UINT> motionIndex;
+    /// Transforms at the end of the shutter interval of the instances with motion, as 3x4
+    /// row-major matrices in the layout of the descriptors
+    std::vector<std::array<float, 12>> endTransforms;
+
+    UINT Size() const { return static_cast<UINT>(bottomLevelAS.size()); }
+    /// Store the first 3 columns of a transform matrix
+    void SetTransform(UINT instanceIndex, const DirectX::XMMATRIX& matrix);
+    /// Translation of an instance, stored in the last row of its matrix
+    DirectX::XMFLOAT3 GetPosition(UINT instanceIndex) const;
   };
 
+  /// Motion index of the instances without motion
+  static const UINT kNoMotion = ~0u;
+
+  /// Store the end transform of an instance, allocating it if the instance had no motion
+  void SetEndTransform(UINT instanceIndex, const DirectX::XMMATRIX& transform);
+
+  /// Mark an instance dirty, so that its descriptor is rewritten by the next Generate
+  void MarkDirty(UINT instanceIndex);
+
+  /// Fill the descriptors of a contiguous range of instances, transposing and packing the
+  /// transforms of 4 instances per iteration with SSE, or 8 with AVX
+  void PackInstanceDescs(UINT begin, UINT end, D3D12_RAYTRACING_INSTANCE_DESC* descs) const;
+
+  /// Write the descriptors of the dirty instances into the mapped descriptor buffer, splitting
+  /// them into chunks filled in parallel if a thread pool was given
+  void WriteDirtyDescriptors();
+
   /// Construction flags, indicating whether the AS supports iterative updates
   D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags;
   /// Instances contained in the top-level AS
-  std::vector<Instance> m_instances;
+  InstanceStore m_instances;
+  /// Indices of the instances whose descriptors have to be rewritten
+  std::vector<UINT> m_dirtyInstances;
+  /// Descriptor buffer written by the last call to Generate, whose content is kept
+  ID3D12Resource* m_lastDescriptorsBuffer = nullptr;
+  /// Persistent mapping of the descriptor buffer
+  D3D12_RAYTRACING_INSTANCE_DESC* m_mappedDescriptors = nullptr;
+  /// Optional pool on which the descriptors are filled
+  ThreadPool* m_threadPool = nullptr;
+
+  /// Motion since the last rebuild, used to choose between refit and rebuild
+  UINT m_movedSinceRebuildCount = 0;
+  float m_maxDisplacement = 0.f;
+  /// Extent of the instance positions at the last rebuild
+  float m_rebuildExtent = 0.f;
+  float m_rebuildMovedFraction = 0.25f;
+  float m_rebuildMaxDisplacement = 0.1f;
+  bool m_lastBuildWasUpdate = false;
+  UINT m_lastBuildInstanceCount = 0;
 
   /// Size of the temporary memory used by the TLAS builder
   UINT64 m_scratchSizeInBytes;
@@ -0,0 +1,298 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Two-level hierarchy over instances of bottom-level hierarchies, traversed as
+TraceRay does. See TopLevelBVH.h for details.
+*/
+
+#include "TopLevelBVH.h"
+
+#include <limits>
+#include <utility>
+
+namespace nv_helpers_dx12
+{
+
+namespace
+{
+// Ray/box slab test, returning the entry distance along the ray, or infinity if
+// the box is missed within [tMin, tMax]
+inline float IntersectAABB(const AABB& box, const float origin[3], const float invDir[3],
+                           float tMin, float tMax)
+{
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float t0 = (box.min[axis] - origin[axis]) * invDir[axis];
+    float t1 = (box.max[axis] - origin[axis]) * invDir[axis];
+    if (t0 > t1)
+    {
+      std::swap(t0, t1);
+    }
+    tMin = t0 > tMin ? t0 : tMin;
+    tMax = t1 < tMax ? t1 : tMax;
+    if (tMin > tMax)
+    {
+      return std::numeric_limits<float>::infinity();
+    }
+  }
+  return tMin;
+}
+
+// Invert an affine 3x4 transform, returning false if it is singular
+bool InvertTransform(const float m[3][4], float inverse[12])
+{
+  float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+  float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+  float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+  float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+  if (det == 0.f)
+  {
+    return false;
+  }
+  float invDet = 1.f / det;
+
+  // The inverse of the 3x3 part is the transposed cofactor matrix divided by the determinant
+  float r[3][3] = {
+      {c00 * invDet, (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet,
+       (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet},
+      {c01 * invDet, (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet,
+       (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet},
+      {c02 * invDet, (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet,
+       (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet}};
+
+  // The translation of the inverse brings the translation of the transform back to the origin
+  for (int row = 0; row < 3; row++)
+  {
+    inverse[4 * row + 0] = r[row][0];
+    inverse[4 * row + 1] = r[row][1];
+    inverse[4 * row + 2] = r[row][2];
+    inverse[4 * row + 3] = -(r[row][0] * m[0][3] + r[row][1] * m[1][3] + r[row][2] * m[2][3]);
+  }
+  return true;
+}
+
+// Transform a box by an affine 3x4 transform. Each output extent is obtained from the extents of
+// the input box along each axis, which gives the same result as transforming its 8 corners (Arvo,
+// "Transforming Axis-Aligned Bounding Boxes", Graphics Gems 1990)
+AABB TransformBounds(const float transform[3][4], const AABB& local)
+{
+  AABB bounds;
+  for (int row = 0; row < 3; row++)
+  {
+    bounds.min[row] = transform[row][3];
+    bounds.max[row] = transform[row][3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+      float a = transform[row][axis] * local.min[axis];
+      float b = transform[row][axis] * local.max[axis];
+      bounds.min[row] += a < b ? a : b;
+      bounds.max[row] += a < b ? b : a;
+    }
+  }
+  return bounds;
+}
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Compute the world-space bounds of an instance by transforming the root bounds of its
+// bottom-level hierarchy. A point transformed by the interpolation of two matrices is the
+// interpolation of the point transformed by each matrix, hence the bounds of an instance with
+// motion are the union of the bounds at both ends of the interval.
+AABB TopLevelBVH::ComputeInstanceBounds(const BVHInstance& instance)
+{
+  AABB bounds;
+  bounds.Reset();
+  if (instance.bottomLevel == nullptr || instance.bottomLevel->nodes.empty())
+  {
+    return bounds;
+  }
+
+  const AABB& local = instance.bottomLevel->nodes[0].bounds;
+  bounds = TransformBounds(instance.transform, local);
+  if (instance.hasMotion)
+  {
+    bounds.Grow(TransformBounds(instance.endTransform, local));
+  }
+  return bounds;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build the hierarchy over the world-space bounds of the instances. The hierarchy is built over
+// the instances that can be hit, and its leaves are then remapped to the original instance indices
+void TopLevelBVH::Build(std::vector<BVHInstance> instances,
+                        const BVHBuilder& builder /*= BVHBuilder()*/)
+{
+  m_instances = std::move(instances);
+  m_worldToObject.resize(m_instances.size());
+
+  std::vector<AABB> bounds;
+  std::vector<uint32_t> builtInstances;
+  bounds.reserve(m_instances.size());
+  builtInstances.reserve(m_instances.size());
+  for (size_t i = 0; i < m_instances.size(); i++)
+  {
+    AABB box = ComputeInstanceBounds(m_instances[i]);
+    if (!box.IsEmpty() && InvertTransform(m_instances[i].transform, m_worldToObject[i].data()))
+    {
+      bounds.push_back(box);
+      builtInstances.push_back(static_cast<uint32_t>(i));
+    }
+  }
+
+  builder.BuildSAH(bounds, &m_bvh);
+  for (auto& prim : m_bvh.primIndices)
+  {
+    prim = builtInstances[prim];
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the closest intersection of the ray with the instances. The top-level hierarchy is
+// traversed in world space, visiting the closest child first. In the leaves, the ray is
+// transformed into the space of each instance, and the bottom-level hierarchy of the instance is
+// intersected within the current ray interval, which shrinks with each hit.
+bool TopLevelBVH::Intersect(const BVHRay& ray, uint8_t instanceInclusionMask, TopLevelBVHHit* hit,
+                            BVHTraversalStats* traversalStats /*= nullptr*/) const
+{
+  if (m_bvh.nodes.empty())
+  {
+    return false;
+  }
+
+  float invDir[3];
+  for (int axis = 0; axis < 3; axis++)
+  {
+    invDir[axis] = 1.f / ray.direction[axis];
+  }
+
+  float tMax = ray.tMax;
+  bool found = false;
+  BVHTraversalStats counters;
+
+  BVHTraversalStack<uint32_t, 256> stack;
+  counters.boxTests++;
+  if (IntersectAABB(m_bvh.nodes[0].bounds, ray.origin, invDir, ray.tMin, tMax) !=
+      std::numeric_limits<float>::infinity())
+  {
+    stack.Push(0);
+  }
+
+  while (!stack.IsEmpty())
+  {
+    const BVHNode& node = m_bvh.nodes[stack.Pop()];
+    if (node.IsLeaf())
+    {
+      for (uint32_t i = 0; i < node.primCount; i++)
+      {
+        uint32_t instanceIndex = m_bvh.primIndices[node.leftFirst + i];
+        const BVHInstance& instance = m_instances[instanceIndex];
+        if ((instance.instanceMask & instanceInclusionMask) == 0)
+        {
+          continue;
+        }
+
+        // The transform of an instance with motion is interpolated at the time of the ray
+        const float* m = m_worldToObject[instanceIndex].data();
+        float interpolatedWorldToObject[12];
+        if (instance.hasMotion)
+        {
+          float objectToWorld[3][4];
+          for (int row = 0; row < 3; row++)
+          {
+            for (int column = 0; column < 4; column++)
+            {
+              objectToWorld[row][column] =
+                  (1.f - ray.time) * instance.transform[row][column] +
+                  ray.time * instance.endTransform[row][column];
+            }
+          }
+          if (!InvertTransform(objectToWorld, interpolatedWorldToObject))
+          {
+            continue;
+          }
+          m = interpolatedWorldToObject;
+        }
+
+        // The direction is transformed without normalization, so that distances along the
+        // object-space ray match the ones along the world-space ray
+        BVHRay objectRay;
+        for (int row = 0; row < 3; row++)
+        {
+          const float* r = m + 4 * row;
+          objectRay.origin[row] =
+              r[0] * ray.origin[0] + r[1] * ray.origin[1] + r[2] * ray.origin[2] + r[3];
+          objectRay.direction[row] =
+              r[0] * ray.direction[0] + r[1] * ray.direction[1] + r[2] * ray.direction[2];
+        }
+        objectRay.tMin = ray.tMin;
+        objectRay.tMax = tMax;
+        objectRay.time = ray.time;
+
+        BVHHit objectHit;
+        if (instance.bottomLevel->Intersect(objectRay, &objectHit, &counters))
+        {
+          tMax = objectHit.t;
+          static_cast<BVHHit&>(*hit) = objectHit;
+          hit->instanceIndex = instanceIndex;
+          hit->instanceID = instance.instanceID;
+          hit->hitGroupIndex = instance.hitGroupIndex;
+          found = true;
+        }
+      }
+      continue;
+    }
+
+    counters.boxTests += 2;
+    uint32_t near = node.leftFirst;
+    uint32_t far = node.leftFirst + 1;
+    float tNear = IntersectAABB(m_bvh.nodes[near].bounds, ray.origin, invDir, ray.tMin, tMax);
+    float tFar = IntersectAABB(m_bvh.nodes[far].bounds, ray.origin, invDir, ray.tMin, tMax);
+    if (tFar < tNear)
+    {
+      std::swap(near, far);
+      std::swap(tNear, tFar);
+    }
+    // Push the farthest child first so that the nearest one is popped next
+    if (tFar != std::numeric_limits<float>::infinity())
+    {
+      stack.Push(far);
+    }
+    if (tNear != std::numeric_limits<float>::infinity())
+    {
+      stack.Push(near);
+    }
+  }
+  if (traversalStats)
+  {
+    traversalStats->boxTests += counters.boxTests;
+    traversalStats->triangleTests += counters.triangleTests;
+  }
+  return found;
+}
+} // namespace nv_helpers_dx12
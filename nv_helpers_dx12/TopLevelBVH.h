@@ -0,0 +1,147 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+The top-level hierarchy built on the CPU is the counterpart of the top-level
+acceleration structure: a binary hierarchy over the world-space bounds of the
+instances, each instance referencing the CPU hierarchy of its bottom-level AS.
+The bounds of an instance are the bounds of the root of its bottom-level
+hierarchy, transformed by the instance matrix.
+
+Intersecting the hierarchy performs the same two-level traversal as TraceRay:
+the ray descends the top-level hierarchy in world space, and is transformed into
+the space of each instance it reaches before descending the bottom-level
+hierarchy. As for the GPU, the direction of the transformed ray is not
+normalized, so that the hit distances are the same in both spaces. Instances
+are skipped if their mask and the inclusion mask of the ray have no bit in
+common.
+
+For motion blur, an instance can be given a second transform at the end of the
+shutter interval. Its transform at the time of a ray is the linear
+interpolation of both transforms, whose bounds are contained in the union of
+the bounds at both ends, which are used to build the hierarchy. The two
+keyframes are stored once, instead of building a hierarchy per time sample.
+Note that linearly interpolating matrices shrinks rotated objects in the middle
+of the interval, which remains unnoticeable for the small rotations typical of
+a single frame.
+
+The instances are typically taken from a TopLevelASGenerator, which resolves
+the bottom-level AS referenced by each instance into its CPU hierarchy.
+
+Example:
+
+nv_helpers_dx12::BVH bottomLevelBvh;
+bottomLevelAS.GenerateOnCPU(&bottomLevelBvh);
+
+std::unordered_map<D3D12_GPU_VIRTUAL_ADDRESS, const nv_helpers_dx12::BVH*> hierarchies;
+hierarchies[bottomLevelBuffer->GetGPUVirtualAddress()] = &bottomLevelBvh;
+
+nv_helpers_dx12::TopLevelBVH topLevelBvh;
+topLevelAS.GenerateOnCPU(hierarchies, &topLevelBvh);
+
+nv_helpers_dx12::TopLevelBVHHit hit;
+if (topLevelBvh.Intersect(ray, 0xFF, &hit))
+{
+  printf("instance %u, primitive %u at t=%f\n", hit.instanceIndex, hit.primitiveIndex, hit.t);
+}
+
+*/
+
+#pragma once
+
+#include "BVHBuilder.h"
+
+#include <array>
+
+namespace nv_helpers_dx12
+{
+
+/// Instance of a bottom-level hierarchy, with the same layout of the transform
+/// as D3D12_RAYTRACING_INSTANCE_DESC
+struct BVHInstance
+{
+  /// Object-to-world transform, as a row-major 3x4 matrix whose last column is
+  /// the translation
+  float transform[3][4];
+  /// Hierarchy of the bottom-level AS, which must outlive the top-level hierarchy
+  const BVH* bottomLevel;
+  /// Instance ID visible in the shader, as returned by InstanceID()
+  uint32_t instanceID;
+  /// Offset of the hit groups of the instance in the Shader Binding Table
+  uint32_t hitGroupIndex;
+  /// Visibility mask, tested against the inclusion mask of the rays
+  uint8_t instanceMask;
+  /// True if the instance moves during the shutter interval
+  bool hasMotion = false;
+  /// Object-to-world transform at the end of the shutter interval, if the
+  /// instance has motion, transform being the one at its beginning
+  float endTransform[3][4];
+};
+
+/// Closest intersection found by the two-level traversal. The geometry and
+/// primitive indices refer to the bottom-level AS of the instance that was hit.
+struct TopLevelBVHHit : BVHHit
+{
+  /// Index of the instance in the top-level AS, as returned by InstanceIndex()
+  uint32_t instanceIndex;
+  /// Instance ID, as returned by InstanceID()
+  uint32_t instanceID;
+  /// Offset of the hit groups of the instance in the Shader Binding Table
+  uint32_t hitGroupIndex;
+};
+
+/// Hierarchy over instances of bottom-level hierarchies, built on the CPU
+class TopLevelBVH
+{
+public:
+  /// Build the hierarchy over the world-space bounds of the instances. Instances
+  /// without geometry or with a singular transform can never be hit, and are
+  /// left out of the hierarchy.
+  void Build(std::vector<BVHInstance> instances, const BVHBuilder& builder = BVHBuilder());
+
+  /// Find the closest intersection of the ray with the instances whose mask
+  /// shares a bit with the inclusion mask. Returns false if the ray does not hit
+  /// anything. The work done in both levels is added to the optional statistics.
+  bool Intersect(const BVHRay& ray, uint8_t instanceInclusionMask, TopLevelBVHHit* hit,
+                 BVHTraversalStats* traversalStats = nullptr) const;
+
+  /// Hierarchy over the instances, whose leaves reference the instance indices
+  const BVH& GetHierarchy() const { return m_bvh; }
+  const std::vector<BVHInstance>& GetInstances() const { return m_instances; }
+
+  /// Compute the world-space bounds of an instance over the shutter interval.
+  /// The bounds are empty if the instance has no geometry.
+  static AABB ComputeInstanceBounds(const BVHInstance& instance);
+
+private:
+  /// Instances in the order they were given, indexed by the leaves of the hierarchy
+  std::vector<BVHInstance> m_instances;
+  /// World-to-object transforms of the instances, in the same layout as their transforms. The
+  /// transforms of the instances with motion are inverted for each ray instead.
+  std::vector<std::array<float, 12>> m_worldToObject;
+  /// Hierarchy over the instance bounds
+  BVH m_bvh;
+};
+} // namespace nv_helpers_dx12
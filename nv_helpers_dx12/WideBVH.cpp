@@ -0,0 +1,392 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Wide hierarchies store up to 4 or 8 children per node, with their bounds laid
+out for SIMD ray/box tests. See WideBVH.h for details.
+*/
+
+#include "WideBVH.h"
+
+#include <cfloat>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define NV_HELPERS_WIDE_BVH_SSE
+#include <immintrin.h>
+#endif
+
+namespace nv_helpers_dx12
+{
+
+static_assert(sizeof(WideBVHNode<4>) == 128, "4-wide BVH nodes are expected to be 2 cache lines");
+static_assert(sizeof(WideBVHNode<8>) == 256, "8-wide BVH nodes are expected to be 4 cache lines");
+
+//--------------------------------------------------------------------------------------------------
+//
+//
+WideBVHRay::WideBVHRay(const BVHRay& ray)
+{
+  for (int axis = 0; axis < 3; axis++)
+  {
+    origin[axis] = ray.origin[axis];
+    invDir[axis] = 1.f / ray.direction[axis];
+    negative[axis] = invDir[axis] < 0.f;
+  }
+  tMin = ray.tMin;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Test a ray against all the children of a wide node at once, storing the entry distance of each
+// child and returning a bit mask of the children hit within [tMin, tMax]
+template <int Width>
+uint32_t IntersectChildren(const WideBVHNode<Width>& node, const WideBVHRay& ray, float tMax,
+                           float tEntry[Width])
+{
+  const float* nearX = ray.negative[0] ? node.maxX : node.minX;
+  const float* farX = ray.negative[0] ? node.minX : node.maxX;
+  const float* nearY = ray.negative[1] ? node.maxY : node.minY;
+  const float* farY = ray.negative[1] ? node.minY : node.maxY;
+  const float* nearZ = ray.negative[2] ? node.maxZ : node.minZ;
+  const float* farZ = ray.negative[2] ? node.minZ : node.maxZ;
+  uint32_t mask = 0;
+
+#if defined(__AVX__) || defined(__AVX2__)
+  if (Width == 8)
+  {
+    __m256 ox = _mm256_set1_ps(ray.origin[0]);
+    __m256 oy = _mm256_set1_ps(ray.origin[1]);
+    __m256 oz = _mm256_set1_ps(ray.origin[2]);
+    __m256 ix = _mm256_set1_ps(ray.invDir[0]);
+    __m256 iy = _mm256_set1_ps(ray.invDir[1]);
+    __m256 iz = _mm256_set1_ps(ray.invDir[2]);
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearX), ox), ix);
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearY), oy), iy);
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearZ), oz), iz);
+    __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farX), ox), ix);
+    __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farY), oy), iy);
+    __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farZ), oz), iz);
+    __m256 entry = _mm256_max_ps(_mm256_max_ps(t0x, t0y),
+                                 _mm256_max_ps(t0z, _mm256_set1_ps(ray.tMin)));
+    __m256 exit =
+        _mm256_min_ps(_mm256_min_ps(t1x, t1y), _mm256_min_ps(t1z, _mm256_set1_ps(tMax)));
+    _mm256_storeu_ps(tEntry, entry);
+    return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)));
+  }
+#endif
+
+#ifdef NV_HELPERS_WIDE_BVH_SSE
+  __m128 ox = _mm_set1_ps(ray.origin[0]);
+  __m128 oy = _mm_set1_ps(ray.origin[1]);
+  __m128 oz = _mm_set1_ps(ray.origin[2]);
+  __m128 ix = _mm_set1_ps(ray.invDir[0]);
+  __m128 iy = _mm_set1_ps(ray.invDir[1]);
+  __m128 iz = _mm_set1_ps(ray.invDir[2]);
+  __m128 tmin = _mm_set1_ps(ray.tMin);
+  __m128 tmax = _mm_set1_ps(tMax);
+  for (int k = 0; k < Width; k += 4)
+  {
+    __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearX + k), ox), ix);
+    __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearY + k), oy), iy);
+    __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearZ + k), oz), iz);
+    __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farX + k), ox), ix);
+    __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farY + k), oy), iy);
+    __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farZ + k), oz), iz);
+    __m128 entry = _mm_max_ps(_mm_max_ps(t0x, t0y), _mm_max_ps(t0z, tmin));
+    __m128 exit = _mm_min_ps(_mm_min_ps(t1x, t1y), _mm_min_ps(t1z, tmax));
+    _mm_storeu_ps(tEntry + k, entry);
+    mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(entry, exit))) << k;
+  }
+#else
+  for (int k = 0; k < Width; k++)
+  {
+    float entry = (nearX[k] - ray.origin[0]) * ray.invDir[0];
+    float exit = (farX[k] - ray.origin[0]) * ray.invDir[0];
+    float ty0 = (nearY[k] - ray.origin[1]) * ray.invDir[1];
+    float ty1 = (farY[k] - ray.origin[1]) * ray.invDir[1];
+    float tz0 = (nearZ[k] - ray.origin[2]) * ray.invDir[2];
+    float tz1 = (farZ[k] - ray.origin[2]) * ray.invDir[2];
+    entry = ty0 > entry ? ty0 : entry;
+    entry = tz0 > entry ? tz0 : entry;
+    entry = ray.tMin > entry ? ray.tMin : entry;
+    exit = ty1 < exit ? ty1 : exit;
+    exit = tz1 < exit ? tz1 : exit;
+    exit = tMax < exit ? tMax : exit;
+    tEntry[k] = entry;
+    mask |= (entry <= exit ? 1u : 0u) << k;
+  }
+#endif
+  return mask;
+}
+
+template uint32_t IntersectChildren<4>(const WideBVHNode<4>&, const WideBVHRay&, float, float[4]);
+template uint32_t IntersectChildren<8>(const WideBVHNode<8>&, const WideBVHRay&, float, float[8]);
+
+namespace
+{
+// Store the bounds of a box in a child slot of a wide node
+template <int Width>
+void SetChildBounds(WideBVHNode<Width>& node, int slot, const AABB& box)
+{
+  node.minX[slot] = box.min[0];
+  node.minY[slot] = box.min[1];
+  node.minZ[slot] = box.min[2];
+  node.maxX[slot] = box.max[0];
+  node.maxY[slot] = box.max[1];
+  node.maxZ[slot] = box.max[2];
+}
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+// Build the wide hierarchy from a binary one. Each wide node gathers the binary subtree below the
+// corresponding binary node, greedily opening the child with the largest surface area, as it is
+// the most likely to be hit by a ray, until all the slots are used or only leaves remain
+template <int Width>
+void WideBVH<Width>::Collapse(const BVH& bvh)
+{
+  nodes.clear();
+  primIndices = bvh.primIndices;
+  triangles = bvh.triangles;
+  maxDepth = 0;
+  bounds.Reset();
+  if (bvh.nodes.empty())
+  {
+    return;
+  }
+  bounds = bvh.nodes[0].bounds;
+
+  struct WorkItem
+  {
+    uint32_t binaryNode;
+    uint32_t wideNode;
+    uint32_t depth;
+  };
+  std::vector<WorkItem> stack = {{0, 0, 1}};
+  nodes.emplace_back();
+
+  while (!stack.empty())
+  {
+    WorkItem item = stack.back();
+    stack.pop_back();
+    maxDepth = item.depth > maxDepth ? item.depth : maxDepth;
+
+    // A binary root leaf becomes the single child of the wide root
+    uint32_t candidates[Width];
+    int candidateCount = 0;
+    const BVHNode& binaryNode = bvh.nodes[item.binaryNode];
+    if (binaryNode.IsLeaf())
+    {
+      candidates[candidateCount++] = item.binaryNode;
+    }
+    else
+    {
+      candidates[candidateCount++] = binaryNode.leftFirst;
+      candidates[candidateCount++] = binaryNode.leftFirst + 1;
+    }
+
+    while (candidateCount < Width)
+    {
+      int largest = -1;
+      float largestArea = -1.f;
+      for (int c = 0; c < candidateCount; c++)
+      {
+        const BVHNode& candidate = bvh.nodes[candidates[c]];
+        float area = candidate.bounds.SurfaceArea();
+        if (!candidate.IsLeaf() && area > largestArea)
+        {
+          largest = c;
+          largestArea = area;
+        }
+      }
+      if (largest < 0)
+      {
+        break;
+      }
+      uint32_t opened = candidates[largest];
+      candidates[largest] = bvh.nodes[opened].leftFirst;
+      candidates[candidateCount++] = bvh.nodes[opened].leftFirst + 1;
+    }
+
+    // Fill the slots of the wide node. The nodes array may grow while doing
+    // so, hence the node is accessed by index.
+    AABB empty;
+    empty.Reset();
+    for (int slot = 0; slot < Width; slot++)
+    {
+      if (slot >= candidateCount)
+      {
+        SetChildBounds(nodes[item.wideNode], slot, empty);
+        nodes[item.wideNode].children[slot] = kInvalidChild;
+        nodes[item.wideNode].primCounts[slot] = 0;
+        continue;
+      }
+
+      const BVHNode& child = bvh.nodes[candidates[slot]];
+      SetChildBounds(nodes[item.wideNode], slot, child.bounds);
+      if (child.IsLeaf())
+      {
+        if (child.primCount > 255)
+        {
+          throw std::logic_error("Wide BVH leaves cannot contain more than 255 triangles");
+        }
+        nodes[item.wideNode].children[slot] = child.leftFirst;
+        nodes[item.wideNode].primCounts[slot] = static_cast<uint8_t>(child.primCount);
+      }
+      else
+      {
+        auto childIndex = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes[item.wideNode].children[slot] = childIndex;
+        nodes[item.wideNode].primCounts[slot] = 0;
+        stack.push_back({candidates[slot], childIndex, item.depth + 1});
+      }
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Find the closest intersection of the ray with the triangles of the hierarchy. All the children of
+// a node are tested at once, and those hit are pushed on the stack from the farthest to the
+// nearest. Entries farther than the closest hit found so far are skipped when popped.
+template <int Width>
+bool WideBVH<Width>::Intersect(const BVHRay& ray, BVHHit* hit) const
+{
+  if (nodes.empty())
+  {
+    return false;
+  }
+
+  WideBVHRay rayData(ray);
+
+  BVHRay current = ray;
+  bool found = false;
+
+  struct StackEntry
+  {
+    uint32_t child;
+    uint32_t primCount;
+    float t;
+  };
+  // Each level of the hierarchy pushes at most Width-1 entries beyond the one
+  // it pops, and the stack spills to the heap beyond 64 levels
+  BVHTraversalStack<StackEntry, 64 * Width> stack;
+  stack.Push({0, 0, ray.tMin});
+
+  while (!stack.IsEmpty())
+  {
+    StackEntry entry = stack.Pop();
+    if (entry.t > current.tMax)
+    {
+      continue;
+    }
+
+    if (entry.primCount != 0)
+    {
+      for (uint32_t i = 0; i < entry.primCount; i++)
+      {
+        const BVHTriangle& tri = triangles[primIndices[entry.child + i]];
+        float t, u, v;
+        if (tri.Intersect(current, &t, &u, &v))
+        {
+          current.tMax = t;
+          hit->t = t;
+          hit->u = u;
+          hit->v = v;
+          hit->geometryIndex = tri.geometryIndex;
+          hit->primitiveIndex = tri.primitiveIndex;
+          found = true;
+        }
+      }
+      continue;
+    }
+
+    const WideBVHNode<Width>& node = nodes[entry.child];
+    float tEntry[Width];
+    uint32_t mask = IntersectChildren(node, rayData, current.tMax, tEntry);
+
+    // Sort the children hit by decreasing distance, so that the nearest ends
+    // up on top of the stack
+    StackEntry hits[Width];
+    int hitCount = 0;
+    for (int slot = 0; slot < Width; slot++)
+    {
+      if ((mask & (1u << slot)) == 0 || node.children[slot] == kInvalidChild)
+      {
+        continue;
+      }
+      StackEntry child = {node.children[slot], node.primCounts[slot], tEntry[slot]};
+      int position = hitCount++;
+      while (position > 0 && hits[position - 1].t < child.t)
+      {
+        hits[position] = hits[position - 1];
+        position--;
+      }
+      hits[position] = child;
+    }
+    for (int i = 0; i < hitCount; i++)
+    {
+      stack.Push(hits[i]);
+    }
+  }
+  return found;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Average number of used child slots per node
+template <int Width>
+float WideBVH<Width>::GetAverageOccupancy() const
+{
+  if (nodes.empty())
+  {
+    return 0.f;
+  }
+  size_t used = 0;
+  for (const auto& node : nodes)
+  {
+    for (int slot = 0; slot < Width; slot++)
+    {
+      used += node.children[slot] != kInvalidChild ? 1 : 0;
+    }
+  }
+  return static_cast<float>(used) / static_cast<float>(nodes.size());
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Memory used by the nodes, primitive indices and triangles
+template <int Width>
+uint64_t WideBVH<Width>::GetSizeInBytes() const
+{
+  return nodes.size() * sizeof(WideBVHNode<Width>) + primIndices.size() * sizeof(uint32_t) +
+         triangles.size() * sizeof(BVHTriangle);
+}
+
+template struct WideBVH<4>;
+template struct WideBVH<8>;
+} // namespace nv_helpers_dx12
@@ -0,0 +1,132 @@
+/*-----------------------------------------------------------------------
+Copyright (c) 2014-2018, NVIDIA. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Neither the name of its contributors may be used to endorse
+or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+/*
+Wide hierarchies store up to 4 or 8 children per node, instead of the 2 of the
+binary hierarchies produced by BVHBuilder. They are obtained by collapsing a
+binary hierarchy: starting from the two children of a binary node, the child
+with the largest surface area is repeatedly replaced by its own children until
+the node is full. This halves or thirds the depth of the tree, and hence the
+number of dependent memory fetches along a ray.
+
+The bounds of the children are stored as a structure of arrays, so that a ray
+can be tested against all the children of a node at once: 4 children with one
+SSE instruction per operation, and 8 children with one AVX instruction when
+compiling with /arch:AVX2, or two SSE instructions otherwise.
+
+Example:
+
+nv_helpers_dx12::BVH bvh;
+bottomLevelAS.GenerateOnCPU(&bvh);
+
+nv_helpers_dx12::WideBVH<8> wideBvh;
+wideBvh.Collapse(bvh);
+wideBvh.Intersect(ray, &hit);
+
+*/
+
+#pragma once
+
+#include "BVHBuilder.h"
+
+namespace nv_helpers_dx12
+{
+
+/// Node of a wide hierarchy. The bounds of the children are stored as a
+/// structure of arrays for SIMD ray/box tests. Unused child slots have inverted
+/// bounds, so that they are never hit.
+template <int Width>
+struct WideBVHNode
+{
+  float minX[Width];
+  float minY[Width];
+  float minZ[Width];
+  float maxX[Width];
+  float maxY[Width];
+  float maxZ[Width];
+  /// Index of each child node, or of the first primitive of a leaf child
+  uint32_t children[Width];
+  /// Number of primitives of each leaf child, 0 for interior or unused children
+  uint8_t primCounts[Width];
+  /// Padding to a multiple of the cache line size
+  uint8_t padding[3 * Width];
+};
+
+/// Ray data precomputed once per traversal of a wide hierarchy. The near and
+/// far planes of a box are selected according to the sign of the direction,
+/// which leaves the inverted bounds of unused child slots with an entry
+/// distance beyond the exit distance.
+struct WideBVHRay
+{
+  explicit WideBVHRay(const BVHRay& ray);
+
+  float origin[3];
+  float invDir[3];
+  bool negative[3];
+  float tMin;
+};
+
+/// Test a ray against all the children of a wide node at once, storing the
+/// entry distance of each child and returning a bit mask of the children hit
+/// within [tMin, tMax]
+template <int Width>
+uint32_t IntersectChildren(const WideBVHNode<Width>& node, const WideBVHRay& ray, float tMax,
+                           float tEntry[Width]);
+
+/// Hierarchy with up to Width children per node, obtained by collapsing a
+/// binary hierarchy. Only widths of 4 and 8 are supported.
+template <int Width>
+struct WideBVH
+{
+  /// Index stored in the unused child slots
+  static const uint32_t kInvalidChild = 0xFFFFFFFFu;
+
+  /// Nodes of the hierarchy, the root being the first one
+  std::vector<WideBVHNode<Width>> nodes;
+  /// Indices of the triangles referenced by the leaves
+  std::vector<uint32_t> primIndices;
+  /// Triangles of all the geometries contained in the hierarchy
+  std::vector<BVHTriangle> triangles;
+  /// Bounds of the whole hierarchy, which are not stored in any node
+  AABB bounds;
+  /// Maximum depth of the hierarchy, counting the root as 1
+  uint32_t maxDepth = 0;
+
+  /// Build the wide hierarchy from a binary one. The primitive indices and
+  /// triangles are copied from the binary hierarchy.
+  void Collapse(const BVH& bvh);
+
+  /// Find the closest intersection of the ray with the triangles of the
+  /// hierarchy. Returns false if the ray does not hit anything.
+  bool Intersect(const BVHRay& ray, BVHHit* hit) const;
+
+  /// Average number of used child slots per node, indicating how well the
+  /// SIMD lanes are used during traversal
+  float GetAverageOccupancy() const;
+
+  /// Memory used by the nodes, primitive indices and triangles
+  uint64_t GetSizeInBytes() const;
+};
+} // namespace nv_helpers_dx12